@@ -3,6 +3,7 @@
 #include <QTextStream>
 #include <QDebug>
 #include <chrono>
+#include <cmath>
 #include <functional>
 
 #include "orbit_camera.h"
@@ -11,6 +12,7 @@ BenchmarkRunner::BenchmarkRunner(QObject *parent)
 	: QObject(parent) {
 	barkTexture = TextureLoader::loadTexture("../textures/bark_2.jpg");
 	grassTexture = TextureLoader::loadTexture("../textures/grass_2.jpg");
+	leafAtlas = LeafLibrary::buildAtlas();
 }
 
 void BenchmarkRunner::runFullSuite(const QString &outputFile) {
@@ -47,6 +49,16 @@ void BenchmarkRunner::runFullSuite(const QString &outputFile) {
 	qDebug() << "\n--- Starting Stage 4: Camera Orbit Angle ---";
 	testCameraAngle(yawAngles, fixedIterations, numRuns);
 
+	QVector<int> forestSizes = {16, 64, 256};
+	qDebug() << "\n--- Starting Stage 5: Forest Generation at Iteration" << fixedIterations - 1 << "---";
+	testForestGeneration(forestSizes, fixedIterations - 1);
+
+	qDebug() << "\n--- Starting Stage 6: Pixel Pipelines at Iteration" << fixedIterations << "---";
+	testPixelPipelines(fixedIterations, numRuns);
+
+	qDebug() << "\n--- Starting Stage 7: Wind Deformation at Iteration" << fixedIterations << "---";
+	testWindDeformation(fixedIterations, numRuns);
+
 	saveResults(outputFile);
 
 	qDebug() << "=== Benchmark Suite Completed ===";
@@ -62,6 +74,7 @@ void BenchmarkRunner::testIterations(const QVector<int> &iterations, int numRuns
 
 	config.imageWidth = originalConfig.imageWidth;
 	config.imageHeight = originalConfig.imageHeight;
+	config.useTreeCache = false;
 
 	for (int iter : iterations) {
 		qDebug() << "\nTesting iterations:" << iter;
@@ -202,45 +215,34 @@ void BenchmarkRunner::testCameraAngle(const QVector<float> &angles, int iteratio
 			// Запускаем рендеринг с этой камерой
 			auto genStart = std::chrono::high_resolution_clock::now();
 
-			LSystemGenerator lsys;
-			lsys.setAxiom(config.axiom);
-			lsys.addRule('F', config.rule);
-			lsys.setIterations(iterations);
-			QString commands = lsys.generate();
-
-			TurtleInterpreter3D turtle;
-			turtle.setStepLength(config.stepLength);
-			turtle.setAngle(config.angle);
-			turtle.setBaseRadius(config.baseRadius);
-			turtle.setRadiusDecay(config.radiusDecay);
-			turtle.setMinLeafRadius(config.minLeafRadius);
-			turtle.setGravityFactor(config.gravityFactor);
-			turtle.setRadialSegments(config.radialSegments);
-			turtle.setBarkTexture(barkTexture);
-
-			auto treeData = turtle.interpretTree(commands);
+			GeneratedTree tree = generateTree(iterations);
 			auto genEnd = std::chrono::high_resolution_clock::now();
 
 			BenchmarkResult result;
 			result.iterations = iterations;
 			result.generationTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(genEnd - genStart).count() /
 					1000.0;
-			result.triangleCount = treeData.trunk.triangles.size();
-			result.leafCount = treeData.leafPositions.size();
+			result.triangleCount = tree.trunk.triangles.size();
+			result.leafCount = tree.leaves.instances.size();
 			result.width = config.imageWidth;
 			result.height = config.imageHeight;
 			result.shadows = config.shadowMapResolution;
 
 			// Сцена
 			Scene scene;
-			scene.addObject(std::make_unique<MeshObject>(std::move(treeData.trunk), &barkTexture));
+			auto trunkObject = std::make_unique<MeshObject>(std::move(tree.trunk), &barkTexture);
+			trunkObject->setBackFaceCulling(true);
+			if (config.useLods)
+				trunkObject->buildLods();
+			scene.addObject(std::move(trunkObject));
 
-			LeafGenerator leafGen;
-			auto leafMeshData = leafGen.generate(treeData.leafPositions, treeData.leafNormals);
 			auto leafObject = std::make_unique<InstancedMeshObject>(
-				std::move(leafMeshData.prototype),
-				std::move(leafMeshData.instances)
+				std::move(tree.leaves.prototypes),
+				std::move(tree.leaves.instances),
+				&leafAtlas
 			);
+			if (config.useImpostors)
+				leafObject->buildImpostors();
 			scene.addObject(std::move(leafObject));
 
 			auto ground = std::make_unique<PlaneObject>(40.0f, 30, &grassTexture);
@@ -279,45 +281,370 @@ void BenchmarkRunner::testCameraAngle(const QVector<float> &angles, int iteratio
 	config = originalConfig;
 }
 
+void BenchmarkRunner::testForestGeneration(const QVector<int> &treeCounts, int iterations, int numRuns) {
+	qDebug() << "\n=== Stage 5: Testing Forest Generation (" << TaskScheduler::instance().getConcurrency() << "threads) ===";
+
+	TreeConfig treeConfig;
+	treeConfig.axiom = config.axiom;
+	treeConfig.rules['F'] = config.rule;
+	treeConfig.iterations = iterations;
+	treeConfig.angle = config.angle;
+	treeConfig.stepLength = config.stepLength;
+	treeConfig.baseRadius = config.baseRadius;
+	treeConfig.radiusDecay = config.radiusDecay;
+	treeConfig.minLeafRadius = config.minLeafRadius;
+	treeConfig.gravityFactor = config.gravityFactor;
+	treeConfig.radialSegments = config.radialSegments;
+	treeConfig.triangleBudget = config.triangleBudget;
+
+	ForestBuilder::Options options;
+	options.buildLods = config.useLods;
+	options.buildImpostors = config.useImpostors;
+
+	for (int count : treeCounts) {
+		// Деревья на квадратной сетке, каждое со своим зерном и поворотом
+		QVector<ForestTreeSpec> specs;
+		const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count))));
+		for (int i = 0; i < count; i++) {
+			ForestTreeSpec spec;
+			spec.config = treeConfig;
+			spec.config.seed = config.seed + i;
+			spec.position = glm::vec3((i % side - side * 0.5f) * 8.0f, 0.0f, (i / side - side * 0.5f) * 8.0f);
+			spec.rotation = (i * 137) % 360;
+			spec.scale = 0.8f + 0.05f * (i % 8);
+			specs.append(spec);
+		}
+
+		QVector<BenchmarkResult> runs;
+		for (int run = 0; run < numRuns; ++run) {
+			ForestBuilder::Result forest = forestBuilder.build(specs, &barkTexture, &leafAtlas, options);
+
+			BenchmarkResult result;
+			result.iterations = iterations;
+			result.generationTimeMs = forest.elapsedMs;
+			result.triangleCount = forest.triangleCount;
+			result.leafCount = forest.leafCount;
+			result.width = config.imageWidth;
+			result.height = config.imageHeight;
+			result.shadows = config.shadowMapResolution;
+
+			// Кадр со всем лесом: деревья рисуются как экземпляры видов ForestObject
+			Scene scene;
+			scene.addObject(std::move(forest.forest));
+
+			auto ground = std::make_unique<PlaneObject>(side * 8.0f + 16.0f, 30, &grassTexture);
+			scene.addObject(std::move(ground));
+
+			Light sunLight = Light::createDirectional(glm::normalize(config.lightDirection));
+			sunLight.diffuse = glm::vec3(1.0f);
+			sunLight.specular = glm::vec3(0.8f);
+			sunLight.ambient = glm::vec3(0.3f);
+			scene.addLight(sunLight);
+
+			SceneRenderer renderer(config.imageWidth, config.imageHeight);
+			renderer.setShadowsEnabled(config.shadowsEnabled);
+			renderer.setShadowMapSize(config.shadowMapResolution);
+			renderer.setSunLight(sunLight);
+
+			OrbitCamera camera;
+			camera.setTarget(glm::vec3(0.0f));
+			camera.setPosition(glm::vec3(side * 6.0f, side * 3.0f + 8.0f, side * 6.0f));
+
+			auto renderStart = std::chrono::high_resolution_clock::now();
+			QImage frame = renderer.render(scene, camera);
+			auto renderEnd = std::chrono::high_resolution_clock::now();
+
+			result.renderTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(renderEnd - renderStart).count()
+					/ 1000.0;
+			runs.append(result);
+
+			qDebug() << "  Trees:" << count << "Species:" << forest.speciesCount
+					<< "Run" << (run + 1) << "of" << numRuns << ":"
+					<< QString::number(forest.treesPerSecond, 'f', 1) << "trees/s";
+		}
+
+		BenchmarkResult avg = averageResults(runs);
+		results.append(avg);
+		qDebug() << "  Average:" << avg.toString()
+				<< "Throughput:" << QString::number(count * 1000.0 / avg.generationTimeMs, 'f', 1) << "trees/s";
+	}
+}
+
+void BenchmarkRunner::testPixelPipelines(int iterations, int numRuns) {
+	qDebug() << "\n=== Stage 6: Testing Pixel Pipelines (fixed Iterations:" << iterations << ") ===";
+
+	struct Variant {
+		QString name;
+		bool textured;
+		int lightCount;
+		bool shadows;
+	};
+	// От самого простого варианта к самому общему; каждый следующий добавляет одну возможность
+	const QVector<Variant> variants = {
+		{"flat", false, 0, false},
+		{"textured", true, 0, false},
+		{"lit", true, 1, false},
+		{"shadowed", true, 1, true},
+		{"two-lights", true, 2, true}
+	};
+
+	Light sunLight = Light::createDirectional(glm::normalize(config.lightDirection));
+	sunLight.diffuse = glm::vec3(1.0f);
+	sunLight.specular = glm::vec3(0.8f);
+	sunLight.ambient = glm::vec3(0.3f);
+
+	Light fillLight = Light::createPoint(glm::vec3(-8.0f, 6.0f, 8.0f));
+	fillLight.diffuse = glm::vec3(0.4f);
+	fillLight.specular = glm::vec3(0.2f);
+	fillLight.ambient = glm::vec3(0.0f);
+
+	int total = variants.size() * numRuns;
+	int current = 0;
+	// Пары результатов одного и того же кадра: вариант, собранный под набор возможностей, и общий вариант
+	QVector<QPair<BenchmarkResult, BenchmarkResult>> variantResults;
+
+	for (const Variant &variant : variants) {
+		qDebug() << "\nTesting pipeline:" << variant.name;
+
+		QVector<BenchmarkResult> runs;
+		QVector<BenchmarkResult> genericRuns;
+
+		for (int run = 0; run < numRuns; ++run) {
+			current++;
+			emit progressUpdate(current,
+			                    total,
+			                    QString("Pipeline %1, Run %2/%3").arg(variant.name).arg(run + 1).arg(numRuns));
+
+			auto genStart = std::chrono::high_resolution_clock::now();
+			GeneratedTree tree = generateTree(iterations);
+			auto genEnd = std::chrono::high_resolution_clock::now();
+
+			BenchmarkResult result;
+			result.iterations = iterations;
+			result.generationTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(genEnd - genStart).count() /
+					1000.0;
+			result.triangleCount = tree.trunk.triangles.size();
+			result.leafCount = tree.leaves.instances.size();
+			result.pipeline = variant.name;
+
+			// Без текстур листья теряют тест альфы и рисуются целыми четырёхугольниками
+			Scene scene;
+			auto trunkObject = std::make_unique<MeshObject>(std::move(tree.trunk), variant.textured ? &barkTexture : nullptr);
+			trunkObject->setBackFaceCulling(true);
+			if (config.useLods)
+				trunkObject->buildLods();
+			scene.addObject(std::move(trunkObject));
+
+			auto leafObject = std::make_unique<InstancedMeshObject>(
+				std::move(tree.leaves.prototypes),
+				std::move(tree.leaves.instances),
+				variant.textured ? &leafAtlas : nullptr
+			);
+			if (config.useImpostors)
+				leafObject->buildImpostors();
+			scene.addObject(std::move(leafObject));
+
+			auto ground = std::make_unique<PlaneObject>(40.0f, 30, variant.textured ? &grassTexture : nullptr);
+			ground->setPosition(glm::vec3(0.0f, 0.0f, 0.0f));
+			scene.addObject(std::move(ground));
+
+			if (variant.lightCount > 0)
+				scene.addLight(sunLight);
+			if (variant.lightCount > 1)
+				scene.addLight(fillLight);
+
+			SceneRenderer renderer(config.imageWidth, config.imageHeight);
+			renderer.setShadowsEnabled(variant.shadows);
+			renderer.setShadowMapSize(config.shadowMapResolution);
+			renderer.setSunLight(sunLight);
+
+			CameraManager camManager;
+			camManager.switchToOrbit();
+			auto &camera = camManager.getActiveCamera();
+
+			// Один и тот же кадр рисуется обоими вариантами; порядок чередуется, чтобы прогрев кэшей
+			// не доставался всегда одному из них
+			double renderMs[2] = {};
+			for (int pass = 0; pass < 2; ++pass) {
+				const bool generic = (pass + run) % 2 == 1;
+				renderer.setGenericPipeline(generic);
+
+				auto renderStart = std::chrono::high_resolution_clock::now();
+				QImage frame = renderer.render(scene, camera);
+				auto renderEnd = std::chrono::high_resolution_clock::now();
+
+				renderMs[generic] = std::chrono::duration_cast<std::chrono::microseconds>(renderEnd - renderStart).count()
+						/ 1000.0;
+			}
+
+			BenchmarkResult genericResult = result;
+			genericResult.pipeline = variant.name + "-generic";
+			genericResult.renderTimeMs = renderMs[1];
+			genericRuns.append(genericResult);
+
+			result.renderTimeMs = renderMs[0];
+			runs.append(result);
+		}
+
+		BenchmarkResult avg = averageResults(runs);
+		avg.pipeline = variant.name;
+		BenchmarkResult genericAvg = averageResults(genericRuns);
+		genericAvg.pipeline = variant.name + "-generic";
+		variantResults.append({avg, genericAvg});
+		results.append(avg);
+		results.append(genericAvg);
+		qDebug() << "  Average:" << avg.toString();
+		qDebug() << "  Generic:" << genericAvg.toString();
+	}
+
+	// Выигрыш от специализации: тот же кадр в общем варианте против варианта под свой набор возможностей
+	qDebug() << "\nPipeline specialization speedup (specialized vs generic):";
+	for (const auto &[specialized, generic] : variantResults) {
+		qDebug() << "  " << specialized.pipeline << ":" << QString::number(specialized.renderTimeMs, 'f', 2) << "ms vs"
+				<< QString::number(generic.renderTimeMs, 'f', 2) << "ms, x"
+				<< QString::number(generic.renderTimeMs / specialized.renderTimeMs, 'f', 2);
+	}
+}
+
+void BenchmarkRunner::testWindDeformation(int iterations, int numRuns) {
+	qDebug() << "\n=== Stage 7: Testing Wind Deformation (fixed Iterations:" << iterations << ") ===";
+
+	// Кадры идут с шагом 1/30 с, как у таймера ветра в окне
+	const int framesPerRun = 120;
+	const float frameStep = 1.0f / 30.0f;
+
+	QVector<BenchmarkResult> runs;
+	for (int run = 0; run < numRuns; ++run) {
+		emit progressUpdate(run + 1, numRuns * 2, QString("Tree wind, Run %1/%2").arg(run + 1).arg(numRuns));
+
+		auto genStart = std::chrono::high_resolution_clock::now();
+		GeneratedTree tree = generateTree(iterations);
+		auto genEnd = std::chrono::high_resolution_clock::now();
+
+		BenchmarkResult result;
+		result.iterations = iterations;
+		result.generationTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(genEnd - genStart).count() /
+				1000.0;
+		result.triangleCount = tree.trunk.triangles.size();
+		result.leafCount = tree.leaves.instances.size();
+		result.pipeline = "tree-bend";
+
+		MeshObject trunkObject(std::move(tree.trunk), &barkTexture);
+		if (config.useLods)
+			trunkObject.buildLods();
+		InstancedMeshObject leafObject(std::move(tree.leaves.prototypes), std::move(tree.leaves.instances), &leafAtlas);
+		if (config.useImpostors)
+			leafObject.buildImpostors();
+
+		WindDeformer deformer(std::move(tree.wind), trunkObject, &leafObject);
+
+		auto windStart = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < framesPerRun; frame++)
+			deformer.apply(frame * frameStep);
+		auto windEnd = std::chrono::high_resolution_clock::now();
+
+		result.renderTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(windEnd - windStart).count() /
+				1000.0 / framesPerRun;
+		runs.append(result);
+	}
+
+	BenchmarkResult treeAvg = averageResults(runs);
+	treeAvg.pipeline = "tree-bend";
+	results.append(treeAvg);
+	qDebug() << "  Tree bend:" << QString::number(treeAvg.renderTimeMs, 'f', 3) << "ms/frame";
+
+	// Лес из 256 деревьев четырёх видов: раскачиваются целые деревья, геометрия видов не меняется
+	const int forestSize = 256;
+	const int speciesCount = 4;
+	const int side = 16;
+
+	TreeConfig treeConfig;
+	treeConfig.axiom = config.axiom;
+	treeConfig.rules['F'] = config.rule;
+	treeConfig.iterations = iterations - 1;
+	treeConfig.angle = config.angle;
+	treeConfig.stepLength = config.stepLength;
+	treeConfig.baseRadius = config.baseRadius;
+	treeConfig.radiusDecay = config.radiusDecay;
+	treeConfig.minLeafRadius = config.minLeafRadius;
+	treeConfig.gravityFactor = config.gravityFactor;
+	treeConfig.radialSegments = config.radialSegments;
+	treeConfig.triangleBudget = config.triangleBudget;
+
+	QVector<ForestTreeSpec> specs;
+	for (int i = 0; i < forestSize; i++) {
+		ForestTreeSpec spec;
+		spec.config = treeConfig;
+		spec.config.seed = config.seed + i % speciesCount;
+		spec.position = glm::vec3((i % side - side * 0.5f) * 8.0f, 0.0f, (i / side - side * 0.5f) * 8.0f);
+		spec.rotation = (i * 137) % 360;
+		spec.scale = 0.8f + 0.05f * (i % 8);
+		// Шаг золотого угла: соседние деревья качаются вразнобой
+		spec.windPhase = i * 2.39996f;
+		specs.append(spec);
+	}
+
+	ForestBuilder::Options options;
+	options.buildLods = false;
+	options.buildImpostors = false;
+	ForestBuilder::Result forest = forestBuilder.build(specs, &barkTexture, &leafAtlas, options);
+
+	runs.clear();
+	const glm::vec3 windDirection(1.0f, 0.0f, 0.3f);
+	for (int run = 0; run < numRuns; ++run) {
+		emit progressUpdate(numRuns + run + 1, numRuns * 2, QString("Forest wind, Run %1/%2").arg(run + 1).arg(numRuns));
+
+		BenchmarkResult result;
+		result.iterations = iterations - 1;
+		result.generationTimeMs = forest.elapsedMs;
+		result.triangleCount = forest.triangleCount;
+		result.leafCount = forest.leafCount;
+		result.pipeline = "forest-sway";
+
+		auto windStart = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < framesPerRun; frame++)
+			forest.forest->applyWind(frame * frameStep, windDirection, 1.0f, 1.5f);
+		auto windEnd = std::chrono::high_resolution_clock::now();
+
+		result.renderTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(windEnd - windStart).count() /
+				1000.0 / framesPerRun;
+		runs.append(result);
+	}
+
+	BenchmarkResult forestAvg = averageResults(runs);
+	forestAvg.pipeline = "forest-sway";
+	results.append(forestAvg);
+	qDebug() << "  Forest sway," << forestSize << "trees:" << QString::number(forestAvg.renderTimeMs, 'f', 3) << "ms/frame";
+}
+
 BenchmarkResult BenchmarkRunner::runSingleTest(int iterations) {
 	BenchmarkResult result;
 	result.iterations = iterations;
 
 	auto genStart = std::chrono::high_resolution_clock::now();
 
-	LSystemGenerator lsys;
-	lsys.setAxiom(config.axiom);
-	lsys.addRule('F', config.rule);
-	lsys.setIterations(iterations);
-	QString commands = lsys.generate();
-
-	TurtleInterpreter3D turtle;
-	turtle.setStepLength(config.stepLength);
-	turtle.setAngle(config.angle);
-	turtle.setBaseRadius(config.baseRadius);
-	turtle.setRadiusDecay(config.radiusDecay);
-	turtle.setMinLeafRadius(config.minLeafRadius);
-	turtle.setGravityFactor(config.gravityFactor);
-	turtle.setRadialSegments(config.radialSegments);
-	turtle.setBarkTexture(barkTexture);
-
-	auto treeData = turtle.interpretTree(commands);
+	GeneratedTree tree = generateTree(iterations);
 
 	auto genEnd = std::chrono::high_resolution_clock::now();
 
 	result.generationTimeMs = std::chrono::duration_cast<std::chrono::microseconds>(genEnd - genStart).count() / 1000.0;
-	result.triangleCount = treeData.trunk.triangles.size();
-	result.leafCount = treeData.leafPositions.size();
+	result.triangleCount = tree.trunk.triangles.size();
+	result.leafCount = tree.leaves.instances.size();
 
 	Scene scene;
-	scene.addObject(std::make_unique<MeshObject>(std::move(treeData.trunk), &barkTexture));
+	auto trunkObject = std::make_unique<MeshObject>(std::move(tree.trunk), &barkTexture);
+	trunkObject->setBackFaceCulling(true);
+	if (config.useLods)
+		trunkObject->buildLods();
+	scene.addObject(std::move(trunkObject));
 
-	LeafGenerator leafGen;
-	auto leafMeshData = leafGen.generate(treeData.leafPositions, treeData.leafNormals);
 	auto leafObject = std::make_unique<InstancedMeshObject>(
-		std::move(leafMeshData.prototype),
-		std::move(leafMeshData.instances)
+		std::move(tree.leaves.prototypes),
+		std::move(tree.leaves.instances),
+		&leafAtlas
 	);
+	if (config.useImpostors)
+		leafObject->buildImpostors();
 	scene.addObject(std::move(leafObject));
 
 	auto ground = std::make_unique<PlaneObject>(40.0f, 30, &grassTexture);
@@ -350,6 +677,27 @@ BenchmarkResult BenchmarkRunner::runSingleTest(int iterations) {
 	return result;
 }
 
+GeneratedTree BenchmarkRunner::generateTree(int iterations) {
+	TreeConfig treeConfig;
+	treeConfig.axiom = config.axiom;
+	treeConfig.rules['F'] = config.rule;
+	treeConfig.iterations = iterations;
+	treeConfig.angle = config.angle;
+	treeConfig.stepLength = config.stepLength;
+	treeConfig.baseRadius = config.baseRadius;
+	treeConfig.radiusDecay = config.radiusDecay;
+	treeConfig.minLeafRadius = config.minLeafRadius;
+	treeConfig.gravityFactor = config.gravityFactor;
+	treeConfig.radialSegments = config.radialSegments;
+	treeConfig.triangleBudget = config.triangleBudget;
+	treeConfig.seed = config.seed;
+
+	if (config.useTreeCache)
+		return treeCache.getOrBuild(treeConfig, barkTexture);
+
+	return TreeBuilder::build(treeConfig, barkTexture);
+}
+
 BenchmarkResult BenchmarkRunner::averageResults(const QVector<BenchmarkResult> &runs) {
 	if (runs.isEmpty()) {
 		return BenchmarkResult();
@@ -384,7 +732,7 @@ void BenchmarkRunner::saveResults(const QString &filename) const {
 
 	QTextStream out(&file);
 
-	out << "Iterations,GenerationTime(ms),RenderTime(ms),Triangles,Leaves,wigth,height,shadowmap\n";
+	out << "Iterations,GenerationTime(ms),RenderTime(ms),Triangles,Leaves,wigth,height,shadowmap,yaw,pipeline\n";
 
 	for (const auto &result : results) {
 		out << result.toCSVRow() << "\n";
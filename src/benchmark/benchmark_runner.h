@@ -19,6 +19,9 @@
 #include "mesh_object.h"
 #include "instanced_mesh_object.h"
 #include "plane_object.h"
+#include "tree_cache.h"
+#include "forest_builder.h"
+#include "wind_deformer.h"
 
 struct BenchmarkResult {
 	int iterations;
@@ -33,6 +36,9 @@ struct BenchmarkResult {
 
 	float cameraYaw = -1.0f; // -1 означает "не задано"
 
+	// Вариант конвейера пикселя для этапа 6 или вид ветра для этапа 7, пустой в остальных этапах
+	QString pipeline;
+
 	QString toString() const {
 		return QString("Iter: %1, Gen: %2ms, Render: %3ms, Tris: %4, Leaves: %5")
 				.arg(iterations)
@@ -43,7 +49,7 @@ struct BenchmarkResult {
 	}
 
 	QString toCSVRow() const {
-		return QString("%1,%2,%3,%4,%5,%6,%7,%8,%9")
+		return QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10")
 				.arg(iterations)
 				.arg(generationTimeMs, 0, 'f', 3)
 				.arg(renderTimeMs, 0, 'f', 3)
@@ -52,7 +58,8 @@ struct BenchmarkResult {
 				.arg(width)
 				.arg(height)
 				.arg(shadows)
-		.arg(cameraYaw, 0, 'f', 1); // новое поле
+		.arg(cameraYaw, 0, 'f', 1) // новое поле
+		.arg(pipeline);
 
 	}
 };
@@ -77,6 +84,16 @@ public:
 	// Этап 4: Угол поворота камеры (орбитальный обзор)
 	void testCameraAngle(const QVector<float> &angles, int iterations, int numRuns = 5);
 
+	// Этап 5: Пакетная генерация леса на пуле потоков (деревьев в секунду) и кадр со всем лесом
+	void testForestGeneration(const QVector<int> &treeCounts, int iterations, int numRuns = 3);
+
+	// Этап 6: Варианты конвейера пикселя (текстуры, освещение, тени, число источников) на одной сцене
+	void testPixelPipelines(int iterations, int numRuns = 5);
+
+	// Этап 7: Стоимость анимации ветра за кадр — изгиб одного дерева и раскачивание леса.
+	// renderTimeMs — среднее время одного кадра деформации
+	void testWindDeformation(int iterations, int numRuns = 5);
+
 	const QVector<BenchmarkResult> &getResults() const { return results; }
 
 	void saveResults(const QString &filename) const;
@@ -102,9 +119,15 @@ private:
 		bool shadowsEnabled = true;
 		// Новое поле для этапа 3: разрешение карты теней
 		int shadowMapResolution = 2048;
+		uint32_t seed = 1;
+		bool useTreeCache = true;
+		bool useLods = true;
+		bool useImpostors = true;
+		int triangleBudget = 0;
 	};
 
 	BenchmarkResult runSingleTest(int iterations);
+	GeneratedTree generateTree(int iterations);
 	BenchmarkResult averageResults(const QVector<BenchmarkResult> &runs);
 
 	double measureTime(std::function<void()> func);
@@ -114,6 +137,10 @@ private:
 
 	QImage barkTexture;
 	QImage grassTexture;
+	QImage leafAtlas;
+
+	TreeCache treeCache;
+	ForestBuilder forestBuilder;
 };
 
 #endif // BENCHMARK_RUNNER_H
@@ -0,0 +1,323 @@
+#include "tree_cache.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+#include <type_traits>
+
+namespace {
+constexpr char cacheMagic[8] = {'L', 'S', 'Y', 'S', 'T', 'R', 'E', 'E'};
+constexpr uint32_t cacheVersion = 6;
+constexpr uint64_t sectionAlignment = 16;
+
+static_assert(std::is_trivially_copyable_v<Vertex>);
+static_assert(std::is_trivially_copyable_v<Triangle>);
+static_assert(std::is_trivially_copyable_v<LeafGenerator::Instance>);
+static_assert(std::is_trivially_copyable_v<TurtleInterpreter3D::DetailReport>);
+static_assert(std::is_trivially_copyable_v<WindBranch>);
+static_assert(std::is_trivially_copyable_v<WindWeight>);
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t vertexSize;
+	uint32_t triangleSize;
+	uint32_t instanceSize;
+
+	uint32_t trunkVertexCount;
+	uint32_t trunkTriangleCount;
+	uint32_t leafVertexCount;
+	uint32_t leafTriangleCount;
+	uint32_t instanceCount;
+	uint32_t leafPrototypeCount;
+	uint32_t windBranchCount;
+	uint32_t windTrunkWeightCount;
+	uint32_t windLeafWeightCount;
+
+	float boundsMin[3];
+	float boundsMax[3];
+
+	TurtleInterpreter3D::DetailReport detail;
+
+	uint64_t trunkVertexOffset;
+	uint64_t trunkTriangleOffset;
+	uint64_t leafVertexOffset;
+	uint64_t leafTriangleOffset;
+	uint64_t prototypeTableOffset;
+	uint64_t instanceOffset;
+	uint64_t windBranchOffset;
+	uint64_t windTrunkWeightOffset;
+	uint64_t windLeafWeightOffset;
+	uint64_t fileSize;
+};
+
+// Прототипы листьев записаны подряд в секциях листьев; таблица хранит размер каждого
+struct PrototypeRange {
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+};
+
+uint64_t alignUp(uint64_t value) {
+	return (value + sectionAlignment - 1) & ~(sectionAlignment - 1);
+}
+
+template<typename T>
+void hashValue(QCryptographicHash &hash, const T &value) {
+	hash.addData(QByteArray::fromRawData(reinterpret_cast<const char *>(&value), sizeof(T)));
+}
+
+template<typename T>
+bool sectionFits(const CacheHeader &header, uint64_t offset, uint32_t count) {
+	return offset % sectionAlignment == 0 && offset + static_cast<uint64_t>(count) * sizeof(T) <= header.fileSize;
+}
+
+template<typename T>
+QVector<T> readSection(const uchar *base, uint64_t offset, uint32_t count) {
+	const T *begin = reinterpret_cast<const T *>(base + offset);
+	return QVector<T>(begin, begin + count);
+}
+
+bool writeSection(QSaveFile &file, const void *data, uint64_t size, uint64_t offset) {
+	static const char padding[sectionAlignment] = {};
+	qint64 pos = file.pos();
+	if (static_cast<uint64_t>(pos) < offset && file.write(padding, offset - pos) != static_cast<qint64>(offset - pos))
+		return false;
+
+	return size == 0 || file.write(static_cast<const char *>(data), size) == static_cast<qint64>(size);
+}
+
+// Вершины всех прототипов, затем их треугольники; индексы треугольников локальны для прототипа
+bool writeLeafPrototypes(QSaveFile &file, const QVector<Mesh> &prototypes, const CacheHeader &header) {
+	uint64_t offset = header.leafVertexOffset;
+	for (const Mesh &prototype : prototypes) {
+		const uint64_t size = prototype.vertices.size() * sizeof(Vertex);
+		if (!writeSection(file, prototype.vertices.constData(), size, offset))
+			return false;
+		offset += size;
+	}
+
+	offset = header.leafTriangleOffset;
+	for (const Mesh &prototype : prototypes) {
+		const uint64_t size = prototype.triangles.size() * sizeof(Triangle);
+		if (!writeSection(file, prototype.triangles.constData(), size, offset))
+			return false;
+		offset += size;
+	}
+
+	return true;
+}
+}
+
+TreeCache::TreeCache(const QString &directory)
+	: directory(directory) {
+}
+
+QString TreeCache::defaultDirectory() {
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/trees";
+}
+
+QByteArray TreeCache::keyFor(const TreeConfig &config, const QImage &barkTexture) {
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+
+	hashValue(hash, cacheVersion);
+	hash.addData(config.axiom.toUtf8());
+	for (const QChar &symbol : config.rules.keys()) {
+		hashValue(hash, symbol.unicode());
+		hash.addData(config.rules.value(symbol).toUtf8());
+	}
+
+	hashValue(hash, config.iterations);
+	hashValue(hash, config.angle);
+	hashValue(hash, config.stepLength);
+	hashValue(hash, config.baseRadius);
+	hashValue(hash, config.radiusDecay);
+	hashValue(hash, config.minLeafRadius);
+	hashValue(hash, config.gravityFactor);
+	hashValue(hash, config.radialSegments);
+	hashValue(hash, config.splineResolution);
+	hashValue(hash, config.triangleBudget);
+	hashValue(hash, config.memoryBudget);
+	hashValue(hash, config.seed);
+
+	if (!barkTexture.isNull()) {
+		hashValue(hash, barkTexture.width());
+		hashValue(hash, barkTexture.height());
+		hash.addData(QByteArray::fromRawData(reinterpret_cast<const char *>(barkTexture.constBits()),
+		                                     barkTexture.sizeInBytes()));
+	}
+
+	return hash.result().toHex();
+}
+
+QString TreeCache::pathFor(const QByteArray &key) const {
+	return directory + "/" + QString::fromLatin1(key) + ".tree";
+}
+
+bool TreeCache::load(const QByteArray &key, GeneratedTree &tree) const {
+	QFile file(pathFor(key));
+	if (!file.exists() || !file.open(QIODevice::ReadOnly))
+		return false;
+
+	const qint64 size = file.size();
+	if (size < static_cast<qint64>(sizeof(CacheHeader)))
+		return false;
+
+	uchar *data = file.map(0, size);
+	if (!data) {
+		qWarning() << "Cannot map tree cache file:" << file.fileName();
+		return false;
+	}
+
+	CacheHeader header;
+	std::memcpy(&header, data, sizeof(CacheHeader));
+
+	bool valid = std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+			header.version == cacheVersion &&
+			header.vertexSize == sizeof(Vertex) &&
+			header.triangleSize == sizeof(Triangle) &&
+			header.instanceSize == sizeof(LeafGenerator::Instance) &&
+			header.fileSize == static_cast<uint64_t>(size) &&
+			sectionFits<Vertex>(header, header.trunkVertexOffset, header.trunkVertexCount) &&
+			sectionFits<Triangle>(header, header.trunkTriangleOffset, header.trunkTriangleCount) &&
+			sectionFits<Vertex>(header, header.leafVertexOffset, header.leafVertexCount) &&
+			sectionFits<Triangle>(header, header.leafTriangleOffset, header.leafTriangleCount) &&
+			sectionFits<PrototypeRange>(header, header.prototypeTableOffset, header.leafPrototypeCount) &&
+			sectionFits<LeafGenerator::Instance>(header, header.instanceOffset, header.instanceCount) &&
+			sectionFits<WindBranch>(header, header.windBranchOffset, header.windBranchCount) &&
+			sectionFits<WindWeight>(header, header.windTrunkWeightOffset, header.windTrunkWeightCount) &&
+			sectionFits<WindWeight>(header, header.windLeafWeightOffset, header.windLeafWeightCount);
+
+	QVector<PrototypeRange> ranges;
+	if (valid) {
+		ranges = readSection<PrototypeRange>(data, header.prototypeTableOffset, header.leafPrototypeCount);
+		uint64_t vertexTotal = 0;
+		uint64_t triangleTotal = 0;
+		for (const PrototypeRange &range : ranges) {
+			vertexTotal += range.vertexCount;
+			triangleTotal += range.triangleCount;
+		}
+		valid = vertexTotal == header.leafVertexCount && triangleTotal == header.leafTriangleCount;
+	}
+
+	if (valid) {
+		tree.trunk.vertices = readSection<Vertex>(data, header.trunkVertexOffset, header.trunkVertexCount);
+		tree.trunk.triangles = readSection<Triangle>(data, header.trunkTriangleOffset, header.trunkTriangleCount);
+
+		tree.leaves.prototypes.clear();
+		uint64_t vertexOffset = header.leafVertexOffset;
+		uint64_t triangleOffset = header.leafTriangleOffset;
+		for (const PrototypeRange &range : ranges) {
+			Mesh prototype;
+			prototype.vertices = readSection<Vertex>(data, vertexOffset, range.vertexCount);
+			prototype.triangles = readSection<Triangle>(data, triangleOffset, range.triangleCount);
+			tree.leaves.prototypes.append(std::move(prototype));
+			vertexOffset += range.vertexCount * sizeof(Vertex);
+			triangleOffset += range.triangleCount * sizeof(Triangle);
+		}
+
+		tree.leaves.instances = readSection<LeafGenerator::Instance>(data, header.instanceOffset, header.instanceCount);
+		tree.wind.branches = readSection<WindBranch>(data, header.windBranchOffset, header.windBranchCount);
+		tree.wind.trunkWeights = readSection<WindWeight>(data, header.windTrunkWeightOffset, header.windTrunkWeightCount);
+		tree.wind.leafWeights = readSection<WindWeight>(data, header.windLeafWeightOffset, header.windLeafWeightCount);
+		tree.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+		tree.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+		tree.detail = header.detail;
+	} else
+		qWarning() << "Ignoring stale or corrupt tree cache file:" << file.fileName();
+
+	file.unmap(data);
+	return valid;
+}
+
+bool TreeCache::store(const QByteArray &key, const GeneratedTree &tree) const {
+	if (!QDir().mkpath(directory)) {
+		qWarning() << "Cannot create tree cache directory:" << directory;
+		return false;
+	}
+
+	CacheHeader header{};
+	std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = cacheVersion;
+	header.vertexSize = sizeof(Vertex);
+	header.triangleSize = sizeof(Triangle);
+	header.instanceSize = sizeof(LeafGenerator::Instance);
+
+	header.trunkVertexCount = tree.trunk.vertices.size();
+	header.trunkTriangleCount = tree.trunk.triangles.size();
+	header.instanceCount = tree.leaves.instances.size();
+	header.leafPrototypeCount = tree.leaves.prototypes.size();
+	header.windBranchCount = tree.wind.branches.size();
+	header.windTrunkWeightCount = tree.wind.trunkWeights.size();
+	header.windLeafWeightCount = tree.wind.leafWeights.size();
+
+	QVector<PrototypeRange> ranges;
+	for (const Mesh &prototype : tree.leaves.prototypes) {
+		ranges.append({static_cast<uint32_t>(prototype.vertices.size()),
+		               static_cast<uint32_t>(prototype.triangles.size())});
+		header.leafVertexCount += prototype.vertices.size();
+		header.leafTriangleCount += prototype.triangles.size();
+	}
+
+	for (int i = 0; i < 3; i++) {
+		header.boundsMin[i] = tree.boundsMin[i];
+		header.boundsMax[i] = tree.boundsMax[i];
+	}
+	header.detail = tree.detail;
+
+	header.trunkVertexOffset = alignUp(sizeof(CacheHeader));
+	header.trunkTriangleOffset = alignUp(header.trunkVertexOffset + header.trunkVertexCount * sizeof(Vertex));
+	header.leafVertexOffset = alignUp(header.trunkTriangleOffset + header.trunkTriangleCount * sizeof(Triangle));
+	header.leafTriangleOffset = alignUp(header.leafVertexOffset + header.leafVertexCount * sizeof(Vertex));
+	header.prototypeTableOffset = alignUp(header.leafTriangleOffset + header.leafTriangleCount * sizeof(Triangle));
+	header.instanceOffset = alignUp(header.prototypeTableOffset + header.leafPrototypeCount * sizeof(PrototypeRange));
+	header.windBranchOffset = alignUp(header.instanceOffset + header.instanceCount * sizeof(LeafGenerator::Instance));
+	header.windTrunkWeightOffset = alignUp(header.windBranchOffset + header.windBranchCount * sizeof(WindBranch));
+	header.windLeafWeightOffset = alignUp(header.windTrunkWeightOffset + header.windTrunkWeightCount * sizeof(WindWeight));
+	header.fileSize = header.windLeafWeightOffset + header.windLeafWeightCount * sizeof(WindWeight);
+
+	QSaveFile file(pathFor(key));
+	if (!file.open(QIODevice::WriteOnly)) {
+		qWarning() << "Cannot open tree cache file for writing:" << file.fileName();
+		return false;
+	}
+
+	bool written = writeSection(file, &header, sizeof(CacheHeader), 0) &&
+			writeSection(file, tree.trunk.vertices.constData(), header.trunkVertexCount * sizeof(Vertex),
+			             header.trunkVertexOffset) &&
+			writeSection(file, tree.trunk.triangles.constData(), header.trunkTriangleCount * sizeof(Triangle),
+			             header.trunkTriangleOffset) &&
+			writeLeafPrototypes(file, tree.leaves.prototypes, header) &&
+			writeSection(file, ranges.constData(), header.leafPrototypeCount * sizeof(PrototypeRange),
+			             header.prototypeTableOffset) &&
+			writeSection(file, tree.leaves.instances.constData(),
+			             header.instanceCount * sizeof(LeafGenerator::Instance), header.instanceOffset) &&
+			writeSection(file, tree.wind.branches.constData(), header.windBranchCount * sizeof(WindBranch),
+			             header.windBranchOffset) &&
+			writeSection(file, tree.wind.trunkWeights.constData(), header.windTrunkWeightCount * sizeof(WindWeight),
+			             header.windTrunkWeightOffset) &&
+			writeSection(file, tree.wind.leafWeights.constData(), header.windLeafWeightCount * sizeof(WindWeight),
+			             header.windLeafWeightOffset);
+
+	if (!written || !file.commit()) {
+		qWarning() << "Cannot write tree cache file:" << file.fileName();
+		return false;
+	}
+
+	return true;
+}
+
+GeneratedTree TreeCache::getOrBuild(const TreeConfig &config, const QImage &barkTexture) {
+	const QByteArray key = keyFor(config, barkTexture);
+
+	GeneratedTree tree;
+	if (load(key, tree))
+		return tree;
+
+	tree = TreeBuilder::build(config, barkTexture);
+	store(key, tree);
+
+	return tree;
+}
@@ -0,0 +1,28 @@
+#ifndef TREE_CACHE_H
+#define TREE_CACHE_H
+
+#include "tree_builder.h"
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+class TreeCache {
+public:
+	explicit TreeCache(const QString &directory = defaultDirectory());
+
+	static QString defaultDirectory();
+
+	[[nodiscard]] static QByteArray keyFor(const TreeConfig &config, const QImage &barkTexture);
+
+	bool load(const QByteArray &key, GeneratedTree &tree) const;
+	bool store(const QByteArray &key, const GeneratedTree &tree) const;
+
+	GeneratedTree getOrBuild(const TreeConfig &config, const QImage &barkTexture);
+
+private:
+	QString directory;
+
+	[[nodiscard]] QString pathFor(const QByteArray &key) const;
+};
+
+#endif // TREE_CACHE_H
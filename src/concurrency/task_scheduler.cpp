@@ -0,0 +1,243 @@
+#include "task_scheduler.h"
+#include <algorithm>
+
+namespace {
+thread_local TaskScheduler *currentScheduler = nullptr;
+thread_local int currentWorker = -1;
+}
+
+TaskScheduler::TaskScheduler(int workerCount) {
+	workerCount = std::max(workerCount, 0);
+
+	for (int i = 0; i < workerCount; i++)
+		queues.push_back(std::make_unique<WorkQueue>());
+
+	for (int i = 0; i < workerCount; i++)
+		workers.emplace_back(&TaskScheduler::workerLoop, this, i);
+}
+
+TaskScheduler::~TaskScheduler() {
+	{
+		std::lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+}
+
+TaskScheduler &TaskScheduler::instance() {
+	static TaskScheduler scheduler(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return scheduler;
+}
+
+void TaskScheduler::submit(Task task) {
+	if (workers.empty()) {
+		task();
+		return;
+	}
+
+	WorkQueue &queue = currentScheduler == this ? *queues[currentWorker] : injectQueue;
+	{
+		std::lock_guard lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard lock(sleepMutex);
+		queuedTasks++;
+	}
+	wake.notify_one();
+}
+
+bool TaskScheduler::popBack(WorkQueue &queue, Task &task) {
+	std::lock_guard lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool TaskScheduler::popFront(WorkQueue &queue, Task &task) {
+	std::lock_guard lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+
+	task = std::move(queue.tasks.front());
+	queue.tasks.pop_front();
+	return true;
+}
+
+bool TaskScheduler::popTask(Task &task) {
+	if (queuedTasks.load(std::memory_order_relaxed) == 0)
+		return false;
+
+	const int self = currentScheduler == this ? currentWorker : -1;
+	bool found = (self >= 0 && popBack(*queues[self], task)) || popFront(injectQueue, task);
+
+	// Кража начинается с соседа, чтобы потоки не конкурировали за одну очередь
+	for (size_t i = 1; !found && i <= queues.size(); i++) {
+		size_t victim = (std::max(self, 0) + i) % queues.size();
+		found = popFront(*queues[victim], task);
+	}
+
+	if (found)
+		queuedTasks--;
+
+	return found;
+}
+
+bool TaskScheduler::runPendingTask() {
+	Task task;
+	if (!popTask(task))
+		return false;
+
+	task();
+	return true;
+}
+
+void TaskScheduler::helpWhilePending(const std::atomic<int> &pending) {
+	while (pending.load() > 0) {
+		if (runPendingTask())
+			continue;
+
+		std::unique_lock lock(sleepMutex);
+		wake.wait(lock, [&] { return pending.load() == 0 || queuedTasks.load() > 0; });
+	}
+}
+
+void TaskScheduler::notifyWaiters() {
+	// Пустая блокировка: ожидающий либо ещё не проверил счётчик, либо уже спит и получит сигнал
+	{
+		std::lock_guard lock(sleepMutex);
+	}
+	wake.notify_all();
+}
+
+void TaskScheduler::workerLoop(int index) {
+	currentScheduler = this;
+	currentWorker = index;
+
+	while (true) {
+		if (runPendingTask())
+			continue;
+
+		std::unique_lock lock(sleepMutex);
+		wake.wait(lock, [this] { return stopping || queuedTasks.load() > 0; });
+		if (stopping && queuedTasks.load() == 0)
+			return;
+	}
+}
+
+void TaskScheduler::parallelFor(qsizetype begin,
+                                qsizetype end,
+                                qsizetype grainSize,
+                                const std::function<void(qsizetype, qsizetype)> &body) {
+	const qsizetype count = end - begin;
+	if (count <= 0)
+		return;
+
+	grainSize = std::max<qsizetype>(grainSize, 1);
+
+	// Несколько блоков на поток сглаживают неравномерную нагрузку
+	qsizetype blockCount = std::min<qsizetype>((count + grainSize - 1) / grainSize, getConcurrency() * 4);
+	if (blockCount <= 1 || workers.empty()) {
+		body(begin, end);
+		return;
+	}
+
+	const qsizetype blockSize = (count + blockCount - 1) / blockCount;
+
+	TaskGroup group(*this);
+	for (qsizetype blockBegin = begin + blockSize; blockBegin < end; blockBegin += blockSize) {
+		qsizetype blockEnd = std::min(blockBegin + blockSize, end);
+		group.run([&body, blockBegin, blockEnd] { body(blockBegin, blockEnd); });
+	}
+
+	// Первый блок выполняется вызывающим потоком
+	body(begin, std::min(begin + blockSize, end));
+	group.wait();
+}
+
+TaskGroup::TaskGroup(TaskScheduler &scheduler)
+	: scheduler(scheduler),
+	  pending(std::make_shared<std::atomic<int> >(0)),
+	  error(std::make_shared<std::exception_ptr>()),
+	  errorMutex(std::make_shared<std::mutex>()) {
+}
+
+TaskGroup::~TaskGroup() {
+	scheduler.helpWhilePending(*pending);
+}
+
+void TaskGroup::run(TaskScheduler::Task task) {
+	(*pending)++;
+
+	scheduler.submit([task = std::move(task), &scheduler = scheduler, pending = pending, error = error, errorMutex = errorMutex] {
+		try {
+			task();
+		} catch (...) {
+			std::lock_guard lock(*errorMutex);
+			if (!*error)
+				*error = std::current_exception();
+		}
+		if (--(*pending) == 0)
+			scheduler.notifyWaiters();
+	});
+}
+
+void TaskGroup::wait() {
+	scheduler.helpWhilePending(*pending);
+
+	std::exception_ptr failure;
+	{
+		std::lock_guard lock(*errorMutex);
+		std::swap(failure, *error);
+	}
+
+	if (failure)
+		std::rethrow_exception(failure);
+}
+
+TaskGraph::TaskGraph(TaskScheduler &scheduler)
+	: scheduler(scheduler) {
+}
+
+int TaskGraph::addTask(TaskScheduler::Task task, const QVector<int> &dependencies) {
+	auto node = std::make_unique<Node>();
+	node->task = std::move(task);
+	node->dependencyCount = dependencies.size();
+
+	const int index = static_cast<int>(nodes.size());
+	for (int dependency : dependencies)
+		nodes[dependency]->successors.append(index);
+
+	nodes.push_back(std::move(node));
+	return index;
+}
+
+void TaskGraph::launch(TaskGroup &group, int index) {
+	group.run([this, &group, index] {
+		nodes[index]->task();
+
+		for (int successor : nodes[index]->successors) {
+			if (--nodes[successor]->remaining == 0)
+				launch(group, successor);
+		}
+	});
+}
+
+void TaskGraph::run() {
+	for (auto &node : nodes)
+		node->remaining = node->dependencyCount;
+
+	TaskGroup group(scheduler);
+	for (int i = 0; i < static_cast<int>(nodes.size()); i++) {
+		if (nodes[i]->dependencyCount == 0)
+			launch(group, i);
+	}
+
+	group.wait();
+}
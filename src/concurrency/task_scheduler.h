@@ -0,0 +1,110 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <QVector>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Общий для процесса пул потоков с перехватом задач (work stealing).
+// Каждый рабочий поток берёт задачи из своей очереди с конца, а чужие крадёт с начала;
+// поток, ожидающий группу задач, сам выполняет задачи, поэтому вложенный параллелизм не блокирует пул
+class TaskScheduler {
+public:
+	using Task = std::function<void()>;
+
+	explicit TaskScheduler(int workerCount);
+	~TaskScheduler();
+
+	TaskScheduler(const TaskScheduler &) = delete;
+	TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+	// Пул размером под число аппаратных потоков (рабочие потоки плюс вызывающий)
+	static TaskScheduler &instance();
+
+	// Число потоков, выполняющих задачи, включая вызывающий
+	[[nodiscard]] int getConcurrency() const { return static_cast<int>(workers.size()) + 1; }
+
+	void submit(Task task);
+
+	// Выполняет одну задачу из очередей; false, если задач нет
+	bool runPendingTask();
+
+	// Выполняет задачи из очередей, пока pending не станет нулём; когда задач нет, поток спит
+	// до появления новой задачи или до notifyWaiters()
+	void helpWhilePending(const std::atomic<int> &pending);
+	// Будит потоки, ждущие в helpWhilePending; вызывается после обнуления счётчика
+	void notifyWaiters();
+
+	// Делит [begin, end) на блоки не меньше grainSize и вызывает body(blockBegin, blockEnd)
+	void parallelFor(qsizetype begin, qsizetype end, qsizetype grainSize,
+	                 const std::function<void(qsizetype, qsizetype)> &body);
+
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue> > queues;
+	WorkQueue injectQueue;
+
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<int> queuedTasks{0};
+	bool stopping = false;
+
+	void workerLoop(int index);
+	bool popTask(Task &task);
+	static bool popBack(WorkQueue &queue, Task &task);
+	static bool popFront(WorkQueue &queue, Task &task);
+};
+
+// Набор независимых задач с ожиданием завершения; первое исключение пробрасывается из wait()
+class TaskGroup {
+public:
+	explicit TaskGroup(TaskScheduler &scheduler = TaskScheduler::instance());
+	~TaskGroup();
+
+	void run(TaskScheduler::Task task);
+	void wait();
+
+private:
+	TaskScheduler &scheduler;
+	std::shared_ptr<std::atomic<int> > pending;
+	std::shared_ptr<std::exception_ptr> error;
+	std::shared_ptr<std::mutex> errorMutex;
+};
+
+// Граф задач: узел запускается, когда завершены все его зависимости
+class TaskGraph {
+public:
+	explicit TaskGraph(TaskScheduler &scheduler = TaskScheduler::instance());
+
+	int addTask(TaskScheduler::Task task, const QVector<int> &dependencies = {});
+
+	// Запускает граф и ждёт завершения всех узлов
+	void run();
+
+private:
+	struct Node {
+		TaskScheduler::Task task;
+		QVector<int> successors;
+		int dependencyCount = 0;
+		std::atomic<int> remaining{0};
+	};
+
+	TaskScheduler &scheduler;
+	std::vector<std::unique_ptr<Node> > nodes;
+
+	void launch(TaskGroup &group, int index);
+};
+
+#endif // TASK_SCHEDULER_H
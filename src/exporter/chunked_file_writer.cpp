@@ -0,0 +1,83 @@
+#include "chunked_file_writer.h"
+#include <QDebug>
+#include <charconv>
+
+namespace {
+constexpr qsizetype maxNumberLength = 32;
+}
+
+ChunkedFileWriter::ChunkedFileWriter(const QString &path, qsizetype chunkSize)
+	: file(path), buffer(std::max(chunkSize, maxNumberLength)) {
+	opened = file.open(QIODevice::WriteOnly);
+	failed = !opened;
+
+	if (!opened)
+		qWarning() << "Cannot open file for writing:" << path << file.errorString();
+}
+
+void ChunkedFileWriter::flush() {
+	if (used == 0)
+		return;
+
+	if (!failed && file.write(buffer.data(), used) != used) {
+		qWarning() << "Write failed:" << file.fileName() << file.errorString();
+		failed = true;
+	}
+
+	written += used;
+	used = 0;
+}
+
+char *ChunkedFileWriter::reserve(qsizetype size) {
+	if (used + size > static_cast<qsizetype>(buffer.size()))
+		flush();
+
+	return buffer.data() + used;
+}
+
+void ChunkedFileWriter::write(const void *data, qsizetype size) {
+	const char *bytes = static_cast<const char *>(data);
+	const qsizetype capacity = buffer.size();
+
+	while (size > 0) {
+		if (used == capacity)
+			flush();
+
+		qsizetype chunk = std::min(size, capacity - used);
+		std::memcpy(buffer.data() + used, bytes, chunk);
+		used += chunk;
+		bytes += chunk;
+		size -= chunk;
+	}
+}
+
+void ChunkedFileWriter::write(char c) {
+	*reserve(1) = c;
+	used++;
+}
+
+void ChunkedFileWriter::writeFloat(float value) {
+	char *out = reserve(maxNumberLength);
+	auto [end, ec] = std::to_chars(out, out + maxNumberLength, value);
+	used += end - out;
+}
+
+void ChunkedFileWriter::writeUInt(uint32_t value) {
+	char *out = reserve(maxNumberLength);
+	auto [end, ec] = std::to_chars(out, out + maxNumberLength, value);
+	used += end - out;
+}
+
+bool ChunkedFileWriter::finish() {
+	if (!opened)
+		return false;
+
+	flush();
+
+	if (failed) {
+		file.cancelWriting();
+		return false;
+	}
+
+	return file.commit();
+}
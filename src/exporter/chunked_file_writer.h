@@ -0,0 +1,43 @@
+#ifndef CHUNKED_FILE_WRITER_H
+#define CHUNKED_FILE_WRITER_H
+
+#include <QSaveFile>
+#include <QString>
+#include <cstring>
+#include <vector>
+
+class ChunkedFileWriter {
+public:
+	static constexpr qsizetype defaultChunkSize = 1 << 20;
+
+	explicit ChunkedFileWriter(const QString &path, qsizetype chunkSize = defaultChunkSize);
+
+	[[nodiscard]] bool isOpen() const { return opened; }
+	[[nodiscard]] bool hasFailed() const { return failed; }
+	[[nodiscard]] qint64 bytesWritten() const { return written + used; }
+
+	void write(const void *data, qsizetype size);
+	void write(const char *text) { write(text, static_cast<qsizetype>(std::strlen(text))); }
+	void write(char c);
+
+	void writeFloat(float value);
+	void writeUInt(uint32_t value);
+
+	template<typename T>
+	void writeBinary(const T &value) { write(&value, sizeof(T)); }
+
+	bool finish();
+
+private:
+	QSaveFile file;
+	std::vector<char> buffer;
+	qsizetype used = 0;
+	qint64 written = 0;
+	bool opened = false;
+	bool failed = false;
+
+	void flush();
+	char *reserve(qsizetype size);
+};
+
+#endif // CHUNKED_FILE_WRITER_H
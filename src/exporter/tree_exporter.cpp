@@ -0,0 +1,477 @@
+#include "tree_exporter.h"
+#include "chunked_file_writer.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <bit>
+#include <cfloat>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+static_assert(std::endian::native == std::endian::little, "binary exporters assume a little-endian host");
+
+namespace {
+Vertex transformVertex(const Vertex &v, const InstancedMeshObject &leaves, qsizetype instance) {
+	Vertex result = v;
+	result.position = leaves.getModelMatrices()[instance] * glm::vec4(v.position, 1.0f);
+	result.normal = glm::normalize(leaves.getNormalMatrices()[instance] * v.normal);
+	return result;
+}
+
+uint8_t toByte(float value) {
+	return static_cast<uint8_t>(std::clamp(static_cast<int>(value * 255.0f + 0.5f), 0, 255));
+}
+
+void writeObjVertex(ChunkedFileWriter &out, const Vertex &v) {
+	out.write("v ");
+	out.writeFloat(v.position.x);
+	out.write(' ');
+	out.writeFloat(v.position.y);
+	out.write(' ');
+	out.writeFloat(v.position.z);
+	out.write(' ');
+	out.writeFloat(v.color.r);
+	out.write(' ');
+	out.writeFloat(v.color.g);
+	out.write(' ');
+	out.writeFloat(v.color.b);
+	out.write("\nvt ");
+	out.writeFloat(v.texCoord.x);
+	out.write(' ');
+	out.writeFloat(v.texCoord.y);
+	out.write("\nvn ");
+	out.writeFloat(v.normal.x);
+	out.write(' ');
+	out.writeFloat(v.normal.y);
+	out.write(' ');
+	out.writeFloat(v.normal.z);
+	out.write('\n');
+}
+
+void writeObjFaces(ChunkedFileWriter &out, const Mesh &mesh, uint32_t baseIndex) {
+	for (const Triangle &tri : mesh.triangles) {
+		out.write('f');
+		for (uint32_t index : {tri.i0, tri.i1, tri.i2}) {
+			uint32_t objIndex = baseIndex + index + 1;
+			out.write(' ');
+			out.writeUInt(objIndex);
+			out.write('/');
+			out.writeUInt(objIndex);
+			out.write('/');
+			out.writeUInt(objIndex);
+		}
+		out.write('\n');
+	}
+}
+
+void writePlyVertex(ChunkedFileWriter &out, const Vertex &v) {
+	out.writeBinary(v.position);
+	out.writeBinary(v.normal);
+	out.writeBinary(toByte(v.color.r));
+	out.writeBinary(toByte(v.color.g));
+	out.writeBinary(toByte(v.color.b));
+	out.writeBinary(v.texCoord);
+}
+
+void writePlyFaces(ChunkedFileWriter &out, const Mesh &mesh, uint32_t baseIndex) {
+	for (const Triangle &tri : mesh.triangles) {
+		out.writeBinary(static_cast<uint8_t>(3));
+		out.writeBinary(baseIndex + tri.i0);
+		out.writeBinary(baseIndex + tri.i1);
+		out.writeBinary(baseIndex + tri.i2);
+	}
+}
+
+constexpr int gltfFloat = 5126;
+constexpr int gltfUnsignedInt = 5125;
+
+constexpr int gltfArrayBuffer = 34962;
+constexpr int gltfElementArrayBuffer = 34963;
+// Буфер без привязки к GPU: атрибуты экземпляров читаются расширением, а не вершинным шейдером
+constexpr int gltfNoTarget = 0;
+
+class GltfBufferLayout {
+public:
+	int addView(qint64 byteLength, int target) {
+		QJsonObject view;
+		view["buffer"] = 0;
+		view["byteOffset"] = byteOffset;
+		view["byteLength"] = byteLength;
+		if (target != gltfNoTarget)
+			view["target"] = target;
+		views.append(view);
+
+		byteOffset += byteLength;
+		return views.size() - 1;
+	}
+
+	int addAccessor(int view, qint64 count, int componentType, const char *type) {
+		QJsonObject accessor;
+		accessor["bufferView"] = view;
+		accessor["componentType"] = componentType;
+		accessor["count"] = count;
+		accessor["type"] = type;
+		accessors.append(accessor);
+		return accessors.size() - 1;
+	}
+
+	void setBounds(int accessor, const glm::vec3 &minBound, const glm::vec3 &maxBound) {
+		QJsonObject object = accessors[accessor].toObject();
+		object["min"] = QJsonArray{minBound.x, minBound.y, minBound.z};
+		object["max"] = QJsonArray{maxBound.x, maxBound.y, maxBound.z};
+		accessors[accessor] = object;
+	}
+
+	qint64 byteOffset = 0;
+	QJsonArray views;
+	QJsonArray accessors;
+};
+
+// Описывает меш в layout и добавляет его в meshes; данные пишутся в том же порядке:
+// позиции, нормали, текстурные координаты, цвета, индексы. Возвращает аксессор позиций
+int addGltfMesh(GltfBufferLayout &layout,
+                QJsonArray &meshes,
+                qint64 vertexCount,
+                qint64 triangleCount,
+                const QString &name) {
+	int position = layout.addAccessor(layout.addView(vertexCount * sizeof(glm::vec3), gltfArrayBuffer),
+	                                  vertexCount, gltfFloat, "VEC3");
+	int normal = layout.addAccessor(layout.addView(vertexCount * sizeof(glm::vec3), gltfArrayBuffer),
+	                                vertexCount, gltfFloat, "VEC3");
+	int texCoord = layout.addAccessor(layout.addView(vertexCount * sizeof(glm::vec2), gltfArrayBuffer),
+	                                  vertexCount, gltfFloat, "VEC2");
+	int color = layout.addAccessor(layout.addView(vertexCount * sizeof(glm::vec3), gltfArrayBuffer),
+	                               vertexCount, gltfFloat, "VEC3");
+	int indices = layout.addAccessor(layout.addView(triangleCount * sizeof(Triangle), gltfElementArrayBuffer),
+	                                 triangleCount * 3,
+	                                 gltfUnsignedInt,
+	                                 "SCALAR");
+
+	QJsonObject attributes;
+	attributes["POSITION"] = position;
+	attributes["NORMAL"] = normal;
+	attributes["TEXCOORD_0"] = texCoord;
+	attributes["COLOR_0"] = color;
+
+	QJsonObject primitive;
+	primitive["attributes"] = attributes;
+	primitive["indices"] = indices;
+
+	QJsonObject gltfMesh;
+	gltfMesh["name"] = name;
+	gltfMesh["primitives"] = QJsonArray{primitive};
+	meshes.append(gltfMesh);
+	return position;
+}
+
+void addGltfMesh(GltfBufferLayout &layout, QJsonArray &meshes, const Mesh &mesh, const QString &name) {
+	glm::vec3 minBound(FLT_MAX);
+	glm::vec3 maxBound(-FLT_MAX);
+	for (const Vertex &v : mesh.vertices) {
+		minBound = glm::min(minBound, v.position);
+		maxBound = glm::max(maxBound, v.position);
+	}
+
+	int position = addGltfMesh(layout, meshes, mesh.vertices.size(), mesh.triangles.size(), name);
+	layout.setBounds(position, minBound, maxBound);
+}
+
+void writeGltfMeshData(ChunkedFileWriter &out, const Mesh &mesh) {
+	for (const Vertex &v : mesh.vertices)
+		out.writeBinary(v.position);
+	for (const Vertex &v : mesh.vertices)
+		out.writeBinary(v.normal);
+	for (const Vertex &v : mesh.vertices)
+		out.writeBinary(v.texCoord);
+	for (const Vertex &v : mesh.vertices)
+		out.writeBinary(v.color);
+
+	out.write(mesh.triangles.constData(), mesh.triangles.size() * sizeof(Triangle));
+}
+
+// Все листья одним мешем, вершины уже преобразованы матрицами экземпляров, как в OBJ и PLY.
+// Пишется потоком по атрибутам; границы позиций собираются по ходу записи
+void writeGltfExpandedLeaves(ChunkedFileWriter &out,
+                             const InstancedMeshObject &leaves,
+                             glm::vec3 &minBound,
+                             glm::vec3 &maxBound) {
+	const auto &instances = leaves.getInstances();
+	const auto &prototypes = leaves.getPrototypes();
+	const auto &modelMatrices = leaves.getModelMatrices();
+	const auto &normalMatrices = leaves.getNormalMatrices();
+
+	minBound = glm::vec3(FLT_MAX);
+	maxBound = glm::vec3(-FLT_MAX);
+	for (qsizetype i = 0; i < instances.size(); i++) {
+		for (const Vertex &v : prototypes[instances[i].prototype].vertices) {
+			const glm::vec3 position = modelMatrices[i] * glm::vec4(v.position, 1.0f);
+			minBound = glm::min(minBound, position);
+			maxBound = glm::max(maxBound, position);
+			out.writeBinary(position);
+		}
+	}
+
+	for (qsizetype i = 0; i < instances.size(); i++) {
+		for (const Vertex &v : prototypes[instances[i].prototype].vertices)
+			out.writeBinary(glm::normalize(normalMatrices[i] * v.normal));
+	}
+
+	for (const auto &inst : instances) {
+		for (const Vertex &v : prototypes[inst.prototype].vertices)
+			out.writeBinary(v.texCoord);
+	}
+
+	for (const auto &inst : instances) {
+		for (const Vertex &v : prototypes[inst.prototype].vertices)
+			out.writeBinary(v.color);
+	}
+
+	uint32_t baseIndex = 0;
+	for (const auto &inst : instances) {
+		const Mesh &proto = prototypes[inst.prototype];
+		for (const Triangle &tri : proto.triangles) {
+			out.writeBinary(baseIndex + tri.i0);
+			out.writeBinary(baseIndex + tri.i1);
+			out.writeBinary(baseIndex + tri.i2);
+		}
+		baseIndex += proto.vertices.size();
+	}
+}
+}
+
+bool TreeExporter::exportObj(const QString &path, const Mesh &trunk, const InstancedMeshObject *leaves) {
+	ChunkedFileWriter out(path);
+	if (!out.isOpen())
+		return false;
+
+	out.write("# L-system tree\no trunk\n");
+	for (const Vertex &v : trunk.vertices)
+		writeObjVertex(out, v);
+	writeObjFaces(out, trunk, 0);
+
+	if (leaves) {
+		uint32_t baseIndex = trunk.vertices.size();
+
+		out.write("o leaves\n");
+		for (qsizetype i = 0; i < leaves->getInstances().size(); i++) {
+			const Mesh &proto = leaves->getPrototypes()[leaves->getInstances()[i].prototype];
+			for (const Vertex &v : proto.vertices)
+				writeObjVertex(out, transformVertex(v, *leaves, i));
+
+			writeObjFaces(out, proto, baseIndex);
+			baseIndex += proto.vertices.size();
+		}
+	}
+
+	return out.finish();
+}
+
+bool TreeExporter::exportPly(const QString &path, const Mesh &trunk, const InstancedMeshObject *leaves) {
+	ChunkedFileWriter out(path);
+	if (!out.isOpen())
+		return false;
+
+	qint64 vertexCount = trunk.vertices.size();
+	qint64 faceCount = trunk.triangles.size();
+	if (leaves) {
+		for (const auto &inst : leaves->getInstances()) {
+			vertexCount += leaves->getPrototypes()[inst.prototype].vertices.size();
+			faceCount += leaves->getPrototypes()[inst.prototype].triangles.size();
+		}
+	}
+
+	out.write("ply\nformat binary_little_endian 1.0\ncomment L-system tree\nelement vertex ");
+	out.writeUInt(vertexCount);
+	out.write("\nproperty float x\nproperty float y\nproperty float z\n"
+		"property float nx\nproperty float ny\nproperty float nz\n"
+		"property uchar red\nproperty uchar green\nproperty uchar blue\n"
+		"property float s\nproperty float t\nelement face ");
+	out.writeUInt(faceCount);
+	out.write("\nproperty list uchar uint vertex_indices\nend_header\n");
+
+	for (const Vertex &v : trunk.vertices)
+		writePlyVertex(out, v);
+
+	if (leaves) {
+		for (qsizetype i = 0; i < leaves->getInstances().size(); i++) {
+			for (const Vertex &v : leaves->getPrototypes()[leaves->getInstances()[i].prototype].vertices)
+				writePlyVertex(out, transformVertex(v, *leaves, i));
+		}
+	}
+
+	writePlyFaces(out, trunk, 0);
+
+	if (leaves) {
+		uint32_t baseIndex = trunk.vertices.size();
+		for (const auto &inst : leaves->getInstances()) {
+			const Mesh &proto = leaves->getPrototypes()[inst.prototype];
+			writePlyFaces(out, proto, baseIndex);
+			baseIndex += proto.vertices.size();
+		}
+	}
+
+	return out.finish();
+}
+
+bool TreeExporter::exportGltf(const QString &path,
+                              const Mesh &trunk,
+                              const InstancedMeshObject *leaves,
+                              LeafMode leafMode) {
+	QFileInfo info(path);
+	const QString binName = info.completeBaseName() + ".bin";
+
+	GltfBufferLayout layout;
+	QJsonArray meshes;
+	addGltfMesh(layout, meshes, trunk, "trunk");
+	QJsonArray nodes;
+	QJsonArray rootChildren;
+
+	QJsonObject trunkNode;
+	trunkNode["name"] = "trunk";
+	trunkNode["mesh"] = 0;
+	nodes.append(trunkNode);
+	rootChildren.append(0);
+
+	const bool hasLeaves = leaves && !leaves->getInstances().isEmpty();
+	const bool instanced = hasLeaves && leafMode == LeafMode::Instanced;
+	const bool expanded = hasLeaves && leafMode == LeafMode::Expanded;
+
+	// Экземпляры, сгруппированные по прототипу: каждому прототипу свой меш и свой узел с инстансингом
+	QVector<QVector<qsizetype>> instancesByPrototype;
+	int expandedPositions = -1;
+
+	if (instanced) {
+		const auto &prototypes = leaves->getPrototypes();
+		for (int p = 0; p < prototypes.size(); p++)
+			addGltfMesh(layout, meshes, prototypes[p], QString("leaf_%1").arg(p));
+
+		instancesByPrototype.resize(prototypes.size());
+		for (qsizetype i = 0; i < leaves->getInstances().size(); i++)
+			instancesByPrototype[leaves->getInstances()[i].prototype].append(i);
+
+		for (int p = 0; p < prototypes.size(); p++) {
+			const qint64 count = instancesByPrototype[p].size();
+			if (count == 0)
+				continue;
+
+			QJsonObject attributes;
+			attributes["TRANSLATION"] = layout.addAccessor(layout.addView(count * sizeof(glm::vec3), gltfNoTarget),
+			                                               count, gltfFloat, "VEC3");
+			attributes["ROTATION"] = layout.addAccessor(layout.addView(count * sizeof(glm::vec4), gltfNoTarget),
+			                                            count, gltfFloat, "VEC4");
+			attributes["SCALE"] = layout.addAccessor(layout.addView(count * sizeof(glm::vec3), gltfNoTarget),
+			                                         count, gltfFloat, "VEC3");
+
+			QJsonObject instancing;
+			instancing["attributes"] = attributes;
+
+			QJsonObject extensions;
+			extensions["EXT_mesh_gpu_instancing"] = instancing;
+
+			QJsonObject leafNode;
+			leafNode["name"] = QString("leaves_%1").arg(p);
+			leafNode["mesh"] = 1 + p;
+			leafNode["extensions"] = extensions;
+			rootChildren.append(nodes.size());
+			nodes.append(leafNode);
+		}
+	} else if (expanded) {
+		qint64 vertexCount = 0;
+		qint64 triangleCount = 0;
+		for (const auto &inst : leaves->getInstances()) {
+			vertexCount += leaves->getPrototypes()[inst.prototype].vertices.size();
+			triangleCount += leaves->getPrototypes()[inst.prototype].triangles.size();
+		}
+		expandedPositions = addGltfMesh(layout, meshes, vertexCount, triangleCount, "leaves");
+
+		QJsonObject leafNode;
+		leafNode["name"] = "leaves";
+		leafNode["mesh"] = 1;
+		rootChildren.append(nodes.size());
+		nodes.append(leafNode);
+	}
+
+	ChunkedFileWriter bin(info.absolutePath() + "/" + binName);
+	if (!bin.isOpen())
+		return false;
+
+	writeGltfMeshData(bin, trunk);
+	if (instanced) {
+		for (const Mesh &proto : leaves->getPrototypes())
+			writeGltfMeshData(bin, proto);
+
+		// Сдвиг берётся из матрицы экземпляра: в ней текущая поза от ветра, как у ствола и в Expanded
+		const auto &instances = leaves->getInstances();
+		const auto &modelMatrices = leaves->getModelMatrices();
+		for (const auto &subset : instancesByPrototype) {
+			for (qsizetype i : subset)
+				bin.writeBinary(modelMatrices[i][3]);
+			for (qsizetype i : subset) {
+				const glm::quat &rotation = instances[i].rotation;
+				bin.writeBinary(glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w));
+			}
+			for (qsizetype i : subset)
+				bin.writeBinary(instances[i].scale);
+		}
+	} else if (expanded) {
+		glm::vec3 minBound;
+		glm::vec3 maxBound;
+		writeGltfExpandedLeaves(bin, *leaves, minBound, maxBound);
+		layout.setBounds(expandedPositions, minBound, maxBound);
+	}
+
+	if (!bin.finish())
+		return false;
+
+	QJsonObject buffer;
+	buffer["uri"] = binName;
+	buffer["byteLength"] = layout.byteOffset;
+
+	QJsonObject asset;
+	asset["version"] = "2.0";
+	asset["generator"] = "l_sys_tree_generator";
+
+	QJsonObject scene;
+	scene["nodes"] = rootChildren;
+
+	QJsonObject root;
+	root["asset"] = asset;
+	root["scene"] = 0;
+	root["scenes"] = QJsonArray{scene};
+	root["nodes"] = nodes;
+	root["meshes"] = meshes;
+	root["buffers"] = QJsonArray{buffer};
+	root["bufferViews"] = layout.views;
+	root["accessors"] = layout.accessors;
+	if (instanced)
+		root["extensionsUsed"] = QJsonArray{"EXT_mesh_gpu_instancing"};
+
+	ChunkedFileWriter json(path);
+	if (!json.isOpen())
+		return false;
+
+	const QByteArray text = QJsonDocument(root).toJson(QJsonDocument::Compact);
+	json.write(text.constData(), text.size());
+	return json.finish();
+}
+
+bool TreeExporter::exportTree(const QString &path,
+                              const Mesh &trunk,
+                              const InstancedMeshObject *leaves,
+                              LeafMode leafMode) {
+	const QString suffix = QFileInfo(path).suffix().toLower();
+
+	if (suffix == "obj")
+		return exportObj(path, trunk, leaves);
+	if (suffix == "ply")
+		return exportPly(path, trunk, leaves);
+	if (suffix == "gltf")
+		return exportGltf(path, trunk, leaves, leafMode);
+
+	qWarning() << "Unsupported export format:" << suffix;
+	return false;
+}
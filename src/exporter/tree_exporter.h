@@ -0,0 +1,32 @@
+#ifndef TREE_EXPORTER_H
+#define TREE_EXPORTER_H
+
+#include "mesh.h"
+#include "instanced_mesh_object.h"
+#include <QString>
+
+class TreeExporter {
+public:
+	// Листья в glTF: Expanded — один меш из преобразованных копий прототипов,
+	// Instanced — меш на прототип и узел с EXT_mesh_gpu_instancing
+	enum class LeafMode {
+		Expanded,
+		Instanced
+	};
+
+	static bool exportObj(const QString &path, const Mesh &trunk, const InstancedMeshObject *leaves);
+	static bool exportPly(const QString &path, const Mesh &trunk, const InstancedMeshObject *leaves);
+	static bool exportGltf(const QString &path,
+	                       const Mesh &trunk,
+	                       const InstancedMeshObject *leaves,
+	                       LeafMode leafMode = LeafMode::Instanced);
+
+	// Формат выбирается по расширению файла: .obj, .ply или .gltf.
+	// leafMode действует только на glTF: OBJ и PLY всегда пишут листья одним мешем
+	static bool exportTree(const QString &path,
+	                       const Mesh &trunk,
+	                       const InstancedMeshObject *leaves,
+	                       LeafMode leafMode = LeafMode::Instanced);
+};
+
+#endif // TREE_EXPORTER_H
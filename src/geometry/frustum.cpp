@@ -0,0 +1,41 @@
+#include "frustum.h"
+
+Frustum::Frustum(const glm::mat4 &viewProj) {
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+	// Отсечение в clip-space: -w <= x, y, z <= w
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	for (glm::vec4 &plane : planes)
+		plane /= glm::length(glm::vec3(plane));
+}
+
+bool Frustum::intersectsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const {
+	for (const glm::vec4 &plane : planes) {
+		// Вершина коробки, дальше всех продвинутая вдоль нормали плоскости
+		glm::vec3 farthest(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+		                   plane.y >= 0.0f ? boxMax.y : boxMin.y,
+		                   plane.z >= 0.0f ? boxMax.z : boxMin.z);
+
+		if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+bool Frustum::intersectsSphere(const glm::vec3 &center, float radius) const {
+	for (const glm::vec4 &plane : planes) {
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,19 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// Шесть плоскостей пирамиды видимости, извлечённые из матрицы view-projection
+class Frustum {
+public:
+	explicit Frustum(const glm::mat4 &viewProj);
+
+	// Консервативный тест: false только если коробка целиком снаружи одной из плоскостей
+	[[nodiscard]] bool intersectsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+	[[nodiscard]] bool intersectsSphere(const glm::vec3 &center, float radius) const;
+
+private:
+	glm::vec4 planes[6];
+};
+
+#endif // FRUSTUM_H
@@ -26,6 +26,7 @@ struct VertexGroup {
 struct Triangle {
   uint32_t i0, i1, i2;
 
+  Triangle() : i0(0), i1(0), i2(0) {}
   Triangle(uint32_t a, uint32_t b, uint32_t c) : i0(a), i1(b), i2(c) {}
 };
 
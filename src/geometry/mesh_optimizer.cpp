@@ -0,0 +1,218 @@
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+constexpr float lastTriangleScore = 0.75f;
+constexpr float cacheDecayPower = 1.5f;
+constexpr float valenceBoostScale = 2.0f;
+constexpr float valenceBoostPower = 0.5f;
+
+float vertexScore(int cachePosition, int remainingTriangles, int cacheSize) {
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3)
+			score = lastTriangleScore;
+		else {
+			float scaler = 1.0f / static_cast<float>(cacheSize - 3);
+			score = std::pow(1.0f - static_cast<float>(cachePosition - 3) * scaler, cacheDecayPower);
+		}
+	}
+
+	score += valenceBoostScale * std::pow(static_cast<float>(remainingTriangles), -valenceBoostPower);
+	return score;
+}
+}
+
+void MeshOptimizer::optimize(Mesh &mesh, int cacheSize) {
+	optimizeVertexCache(mesh, cacheSize);
+	optimizeVertexFetch(mesh);
+}
+
+void MeshOptimizer::optimize(Mesh &mesh, std::vector<uint32_t> &remap, int cacheSize) {
+	optimizeVertexCache(mesh, cacheSize);
+	optimizeVertexFetch(mesh, remap);
+}
+
+void MeshOptimizer::optimizeVertexCache(Mesh &mesh, int cacheSize) {
+	const int vertexCount = mesh.vertices.size();
+	const int triangleCount = mesh.triangles.size();
+	if (triangleCount < 2 || vertexCount == 0)
+		return;
+
+	cacheSize = std::max(cacheSize, 4);
+
+	std::vector<int> valence(vertexCount, 0);
+	for (const Triangle &tri : mesh.triangles) {
+		valence[tri.i0]++;
+		valence[tri.i1]++;
+		valence[tri.i2]++;
+	}
+
+	std::vector<int> adjacencyOffsets(vertexCount + 1, 0);
+	for (int v = 0; v < vertexCount; v++)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + valence[v];
+
+	std::vector<int> adjacency(adjacencyOffsets[vertexCount]);
+	std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (int t = 0; t < triangleCount; t++) {
+		const Triangle &tri = mesh.triangles[t];
+		adjacency[fill[tri.i0]++] = t;
+		adjacency[fill[tri.i1]++] = t;
+		adjacency[fill[tri.i2]++] = t;
+	}
+
+	std::vector<int> remaining = valence;
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vScore(vertexCount);
+	for (int v = 0; v < vertexCount; v++)
+		vScore[v] = vertexScore(-1, remaining[v], cacheSize);
+
+	auto triangleVertices = [&](int t, uint32_t (&out)[3]) {
+		const Triangle &tri = mesh.triangles[t];
+		out[0] = tri.i0;
+		out[1] = tri.i1;
+		out[2] = tri.i2;
+	};
+
+	std::vector<float> tScore(triangleCount);
+	std::vector<char> emitted(triangleCount, 0);
+	for (int t = 0; t < triangleCount; t++) {
+		uint32_t idx[3];
+		triangleVertices(t, idx);
+		tScore[t] = vScore[idx[0]] + vScore[idx[1]] + vScore[idx[2]];
+	}
+
+	std::vector<int> cache;
+	std::vector<int> nextCache;
+	cache.reserve(cacheSize + 3);
+	nextCache.reserve(cacheSize + 3);
+
+	QVector<Triangle> ordered;
+	ordered.reserve(triangleCount);
+
+	int bestTriangle = static_cast<int>(std::max_element(tScore.begin(), tScore.end()) - tScore.begin());
+	int scanCursor = 0;
+
+	while (bestTriangle >= 0) {
+		emitted[bestTriangle] = 1;
+		ordered.append(mesh.triangles[bestTriangle]);
+
+		uint32_t idx[3];
+		triangleVertices(bestTriangle, idx);
+
+		nextCache.clear();
+		for (uint32_t v : idx) {
+			if (std::find(nextCache.begin(), nextCache.end(), static_cast<int>(v)) == nextCache.end())
+				nextCache.push_back(static_cast<int>(v));
+
+			remaining[v]--;
+			int *begin = adjacency.data() + adjacencyOffsets[v];
+			int *end = begin + remaining[v] + 1;
+			int *slot = std::find(begin, end, bestTriangle);
+			if (slot != end)
+				std::swap(*slot, *(end - 1));
+		}
+
+		for (int v : cache) {
+			if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+				nextCache.push_back(v);
+		}
+
+		for (int i = 0; i < static_cast<int>(nextCache.size()); i++) {
+			int v = nextCache[i];
+			cachePosition[v] = i < cacheSize ? i : -1;
+			vScore[v] = vertexScore(cachePosition[v], remaining[v], cacheSize);
+		}
+
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+
+		for (int v : nextCache) {
+			const int *begin = adjacency.data() + adjacencyOffsets[v];
+			const int *end = begin + remaining[v];
+			for (const int *it = begin; it != end; ++it) {
+				int t = *it;
+				uint32_t tv[3];
+				triangleVertices(t, tv);
+				tScore[t] = vScore[tv[0]] + vScore[tv[1]] + vScore[tv[2]];
+
+				if (tScore[t] > bestScore) {
+					bestScore = tScore[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		if (static_cast<int>(nextCache.size()) > cacheSize)
+			nextCache.resize(cacheSize);
+		std::swap(cache, nextCache);
+
+		if (bestTriangle < 0) {
+			while (scanCursor < triangleCount && emitted[scanCursor])
+				scanCursor++;
+
+			if (scanCursor < triangleCount)
+				bestTriangle = scanCursor;
+		}
+	}
+
+	mesh.triangles = std::move(ordered);
+}
+
+void MeshOptimizer::optimizeVertexFetch(Mesh &mesh) {
+	std::vector<uint32_t> remap;
+	optimizeVertexFetch(mesh, remap);
+}
+
+void MeshOptimizer::optimizeVertexFetch(Mesh &mesh, std::vector<uint32_t> &remap) {
+	const int vertexCount = mesh.vertices.size();
+	remap.assign(vertexCount, unusedVertex);
+	if (vertexCount == 0)
+		return;
+
+	QVector<Vertex> ordered;
+	ordered.reserve(vertexCount);
+
+	auto fetch = [&](uint32_t &index) {
+		if (remap[index] == unusedVertex) {
+			remap[index] = static_cast<uint32_t>(ordered.size());
+			ordered.append(mesh.vertices[index]);
+		}
+		index = remap[index];
+	};
+
+	for (Triangle &tri : mesh.triangles) {
+		fetch(tri.i0);
+		fetch(tri.i1);
+		fetch(tri.i2);
+	}
+
+	mesh.vertices = std::move(ordered);
+}
+
+float MeshOptimizer::averageCacheMissRatio(const Mesh &mesh, int cacheSize) {
+	if (mesh.triangles.isEmpty())
+		return 0.0f;
+
+	std::vector<uint32_t> fifo(std::max(cacheSize, 1), ~0u);
+	size_t head = 0;
+	int misses = 0;
+
+	for (const Triangle &tri : mesh.triangles) {
+		for (uint32_t v : {tri.i0, tri.i1, tri.i2}) {
+			if (std::find(fifo.begin(), fifo.end(), v) != fifo.end())
+				continue;
+
+			fifo[head] = v;
+			head = (head + 1) % fifo.size();
+			misses++;
+		}
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(mesh.triangles.size());
+}
@@ -0,0 +1,29 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "mesh.h"
+#include <vector>
+
+class MeshOptimizer {
+public:
+	static constexpr int defaultCacheSize = 32;
+
+	static void optimize(Mesh &mesh, int cacheSize = defaultCacheSize);
+
+	// То же; remap[старый индекс] = новый индекс вершины или unusedVertex для удалённых.
+	// Нужен, чтобы переставить данные, параллельные вершинам (веса ветра)
+	static void optimize(Mesh &mesh, std::vector<uint32_t> &remap, int cacheSize = defaultCacheSize);
+	static constexpr uint32_t unusedVertex = ~0u;
+
+	// Переупорядочивает треугольники для локальности кэша преобразованных вершин (алгоритм Форсайта)
+	static void optimizeVertexCache(Mesh &mesh, int cacheSize = defaultCacheSize);
+
+	// Переупорядочивает вершины в порядке первого обращения, неиспользуемые вершины удаляются
+	static void optimizeVertexFetch(Mesh &mesh);
+	static void optimizeVertexFetch(Mesh &mesh, std::vector<uint32_t> &remap);
+
+	// Среднее число преобразований вершины на треугольник (ACMR) для FIFO-кэша заданного размера
+	[[nodiscard]] static float averageCacheMissRatio(const Mesh &mesh, int cacheSize = defaultCacheSize);
+};
+
+#endif // MESH_OPTIMIZER_H
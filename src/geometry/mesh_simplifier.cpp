@@ -0,0 +1,334 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+struct Quadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+
+	void addPlane(const glm::vec3 &n, double d, double weight) {
+		a2 += weight * n.x * n.x;
+		ab += weight * n.x * n.y;
+		ac += weight * n.x * n.z;
+		ad += weight * n.x * d;
+		b2 += weight * n.y * n.y;
+		bc += weight * n.y * n.z;
+		bd += weight * n.y * d;
+		c2 += weight * n.z * n.z;
+		cd += weight * n.z * d;
+		d2 += weight * d * d;
+	}
+
+	Quadric &operator+=(const Quadric &q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		return *this;
+	}
+
+	[[nodiscard]] double error(const glm::vec3 &p) const {
+		const double x = p.x, y = p.y, z = p.z;
+		double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+		           + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+		           + c2 * z * z + 2 * cd * z
+		           + d2;
+		return std::abs(e);
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+	if (a > b)
+		std::swap(a, b);
+	return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+enum class VertexKind : char {
+	Manifold,
+	Border,
+	Locked
+};
+
+constexpr double borderWeight = 10.0;
+
+// Вершина на открытом крае может скользить только вдоль него; вершины на стыках
+// нескольких ветвей (неманифолдные рёбра) и на изломах края не перемещаются
+void classifyVertices(const QVector<Triangle> &triangles,
+                      std::unordered_map<uint64_t, int> &edgeUse,
+                      std::vector<VertexKind> &kind) {
+	edgeUse.clear();
+	for (const Triangle &tri : triangles) {
+		edgeUse[edgeKey(tri.i0, tri.i1)]++;
+		edgeUse[edgeKey(tri.i1, tri.i2)]++;
+		edgeUse[edgeKey(tri.i2, tri.i0)]++;
+	}
+
+	std::vector<int> borderEdges(kind.size(), 0);
+	std::fill(kind.begin(), kind.end(), VertexKind::Manifold);
+
+	for (const auto &[key, count] : edgeUse) {
+		const uint32_t a = key >> 32;
+		const uint32_t b = key & 0xffffffffu;
+
+		if (count == 1) {
+			borderEdges[a]++;
+			borderEdges[b]++;
+		} else if (count > 2) {
+			kind[a] = VertexKind::Locked;
+			kind[b] = VertexKind::Locked;
+		}
+	}
+
+	for (size_t v = 0; v < kind.size(); v++) {
+		if (kind[v] == VertexKind::Locked || borderEdges[v] == 0)
+			continue;
+		kind[v] = borderEdges[v] == 2 ? VertexKind::Border : VertexKind::Locked;
+	}
+}
+
+bool isDegenerate(const Triangle &tri) {
+	return tri.i0 == tri.i1 || tri.i1 == tri.i2 || tri.i0 == tri.i2;
+}
+
+glm::vec3 faceNormal(const Mesh &mesh, uint32_t i0, uint32_t i1, uint32_t i2) {
+	const glm::vec3 &p0 = mesh.vertices[i0].position;
+	return glm::cross(mesh.vertices[i1].position - p0, mesh.vertices[i2].position - p0);
+}
+
+// Проверяет, что перенос вершины from в to не выворачивает ни один из оставшихся треугольников
+bool collapseFlipsTriangle(const Mesh &mesh,
+                           const QVector<Triangle> &triangles,
+                           const std::vector<int> &adjacencyOffsets,
+                           const std::vector<int> &adjacency,
+                           uint32_t from,
+                           uint32_t to) {
+	for (int k = adjacencyOffsets[from]; k < adjacencyOffsets[from + 1]; k++) {
+		Triangle tri = triangles[adjacency[k]];
+		if (tri.i0 == to || tri.i1 == to || tri.i2 == to)
+			continue;
+
+		glm::vec3 before = faceNormal(mesh, tri.i0, tri.i1, tri.i2);
+
+		if (tri.i0 == from) tri.i0 = to;
+		if (tri.i1 == from) tri.i1 = to;
+		if (tri.i2 == from) tri.i2 = to;
+
+		glm::vec3 after = faceNormal(mesh, tri.i0, tri.i1, tri.i2);
+		if (glm::dot(before, after) <= 0.0f)
+			return true;
+	}
+
+	return false;
+}
+}
+
+Mesh MeshSimplifier::simplifyRatio(const Mesh &mesh, float ratio, float maxError) {
+	std::vector<uint32_t> sourceVertices;
+	return simplifyRatio(mesh, ratio, sourceVertices, maxError);
+}
+
+Mesh MeshSimplifier::simplifyRatio(const Mesh &mesh,
+                                   float ratio,
+                                   std::vector<uint32_t> &sourceVertices,
+                                   float maxError) {
+	int target = static_cast<int>(std::ceil(mesh.triangles.size() * std::clamp(ratio, 0.0f, 1.0f)));
+	return simplify(mesh, target, sourceVertices, maxError);
+}
+
+Mesh MeshSimplifier::simplify(const Mesh &mesh, int targetTriangles, float maxError) {
+	std::vector<uint32_t> sourceVertices;
+	return simplify(mesh, targetTriangles, sourceVertices, maxError);
+}
+
+Mesh MeshSimplifier::simplify(const Mesh &mesh,
+                              int targetTriangles,
+                              std::vector<uint32_t> &sourceVertices,
+                              float maxError) {
+	Mesh result = mesh;
+	const int vertexCount = result.vertices.size();
+	if (result.triangles.size() <= targetTriangles || vertexCount == 0) {
+		sourceVertices.resize(vertexCount);
+		for (int v = 0; v < vertexCount; v++)
+			sourceVertices[v] = v;
+		return result;
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (const Triangle &tri : result.triangles) {
+		const glm::vec3 &p0 = result.vertices[tri.i0].position;
+		glm::vec3 cross = faceNormal(result, tri.i0, tri.i1, tri.i2);
+		float area = glm::length(cross);
+		if (area <= 0.0f)
+			continue;
+
+		glm::vec3 n = cross / area;
+		double d = -glm::dot(n, p0);
+		for (uint32_t v : {tri.i0, tri.i1, tri.i2})
+			quadrics[v].addPlane(n, d, area * 0.5);
+	}
+
+	std::unordered_map<uint64_t, int> edgeUse;
+	edgeUse.reserve(result.triangles.size() * 3);
+	std::vector<VertexKind> kind(vertexCount);
+	classifyVertices(result.triangles, edgeUse, kind);
+
+	// Плоскости, перпендикулярные открытым краям, удерживают форму концов ветвей
+	for (const Triangle &tri : result.triangles) {
+		glm::vec3 n = faceNormal(result, tri.i0, tri.i1, tri.i2);
+		if (glm::length(n) <= 0.0f)
+			continue;
+		n = glm::normalize(n);
+
+		const uint32_t idx[3] = {tri.i0, tri.i1, tri.i2};
+		for (int e = 0; e < 3; e++) {
+			uint32_t a = idx[e];
+			uint32_t b = idx[(e + 1) % 3];
+			if (edgeUse[edgeKey(a, b)] != 1)
+				continue;
+
+			glm::vec3 edge = result.vertices[b].position - result.vertices[a].position;
+			float length = glm::length(edge);
+			if (length <= 0.0f)
+				continue;
+
+			glm::vec3 planeNormal = glm::normalize(glm::cross(edge, n));
+			double d = -glm::dot(planeNormal, result.vertices[a].position);
+			quadrics[a].addPlane(planeNormal, d, length * length * borderWeight);
+			quadrics[b].addPlane(planeNormal, d, length * length * borderWeight);
+		}
+	}
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<char> touched(vertexCount);
+	std::vector<int> adjacencyOffsets(vertexCount + 1);
+	std::vector<int> adjacency;
+	std::vector<Collapse> collapses;
+
+	const double errorLimit = static_cast<double>(maxError) * maxError;
+	bool classified = true;
+
+	while (result.triangles.size() > targetTriangles) {
+		if (!classified)
+			classifyVertices(result.triangles, edgeUse, kind);
+		classified = false;
+
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (const Triangle &tri : result.triangles) {
+			adjacencyOffsets[tri.i0 + 1]++;
+			adjacencyOffsets[tri.i1 + 1]++;
+			adjacencyOffsets[tri.i2 + 1]++;
+		}
+		for (int v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+		adjacency.resize(adjacencyOffsets[vertexCount]);
+		std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (int t = 0; t < result.triangles.size(); t++) {
+			const Triangle &tri = result.triangles[t];
+			adjacency[fill[tri.i0]++] = t;
+			adjacency[fill[tri.i1]++] = t;
+			adjacency[fill[tri.i2]++] = t;
+		}
+
+		// Для каждого ребра выбирается более дешёвое допустимое направление стягивания
+		collapses.clear();
+		for (const Triangle &tri : result.triangles) {
+			const uint32_t idx[3] = {tri.i0, tri.i1, tri.i2};
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = idx[e];
+				uint32_t b = idx[(e + 1) % 3];
+
+				const int use = edgeUse[edgeKey(a, b)];
+				const bool border = use == 1;
+				if (!border && (use != 2 || a > b))
+					continue;
+
+				auto canMove = [&](uint32_t from) {
+					return kind[from] == VertexKind::Manifold || (kind[from] == VertexKind::Border && border);
+				};
+
+				Quadric q = quadrics[a];
+				q += quadrics[b];
+
+				double costAB = canMove(a) ? q.error(result.vertices[b].position) : DBL_MAX;
+				double costBA = canMove(b) ? q.error(result.vertices[a].position) : DBL_MAX;
+				if (costAB == DBL_MAX && costBA == DBL_MAX)
+					continue;
+
+				if (costAB <= costBA)
+					collapses.push_back({a, b, costAB});
+				else
+					collapses.push_back({b, a, costBA});
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &l, const Collapse &r) {
+			return l.cost < r.cost;
+		});
+
+		for (int v = 0; v < vertexCount; v++)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		// Каждое стягивание внутреннего ребра убирает два треугольника
+		int collapseBudget = std::max<int>((result.triangles.size() - targetTriangles + 1) / 2, 1);
+		int collapsed = 0;
+
+		for (const Collapse &c : collapses) {
+			if (collapsed >= collapseBudget || c.cost > errorLimit)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+			if (collapseFlipsTriangle(result, result.triangles, adjacencyOffsets, adjacency, c.from, c.to))
+				continue;
+
+			remap[c.from] = c.to;
+			quadrics[c.to] += quadrics[c.from];
+
+			// Соседи обеих вершин блокируются до следующего прохода, чтобы смежность оставалась верной
+			for (uint32_t v : {c.from, c.to}) {
+				for (int k = adjacencyOffsets[v]; k < adjacencyOffsets[v + 1]; k++) {
+					const Triangle &tri = result.triangles[adjacency[k]];
+					touched[tri.i0] = 1;
+					touched[tri.i1] = 1;
+					touched[tri.i2] = 1;
+				}
+			}
+
+			collapsed++;
+		}
+
+		if (collapsed == 0)
+			break;
+
+		QVector<Triangle> kept;
+		kept.reserve(result.triangles.size());
+		for (const Triangle &tri : result.triangles) {
+			Triangle mapped(remap[tri.i0], remap[tri.i1], remap[tri.i2]);
+			if (!isDegenerate(mapped))
+				kept.append(mapped);
+		}
+		result.triangles = std::move(kept);
+	}
+
+	// Стягивание не создаёт вершин: после сжатия каждая оставшаяся — копия исходной
+	MeshOptimizer::optimize(result, remap);
+	sourceVertices.resize(result.vertices.size());
+	for (int v = 0; v < vertexCount; v++) {
+		if (remap[v] != MeshOptimizer::unusedVertex)
+			sourceVertices[remap[v]] = v;
+	}
+	return result;
+}
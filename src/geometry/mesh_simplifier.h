@@ -0,0 +1,30 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include "mesh.h"
+#include <cfloat>
+#include <vector>
+
+class MeshSimplifier {
+public:
+	// Упрощение стягиванием рёбер по квадрикам ошибки (Garland–Heckbert).
+	// Вершина стягивается в одну из соседних, поэтому атрибуты не интерполируются;
+	// вершина на открытом крае скользит только вдоль своего края, а вершины на неманифолдных рёбрах
+	// и на изломах края не перемещаются
+	[[nodiscard]] static Mesh simplify(const Mesh &mesh, int targetTriangles, float maxError = FLT_MAX);
+
+	[[nodiscard]] static Mesh simplifyRatio(const Mesh &mesh, float ratio, float maxError = FLT_MAX);
+
+	// То же; sourceVertices[i] — индекс вершины mesh, копией которой стала вершина i результата.
+	// Нужен, чтобы перенести на упрощённую сетку данные, параллельные вершинам (веса ветра)
+	[[nodiscard]] static Mesh simplify(const Mesh &mesh,
+	                                   int targetTriangles,
+	                                   std::vector<uint32_t> &sourceVertices,
+	                                   float maxError = FLT_MAX);
+	[[nodiscard]] static Mesh simplifyRatio(const Mesh &mesh,
+	                                        float ratio,
+	                                        std::vector<uint32_t> &sourceVertices,
+	                                        float maxError = FLT_MAX);
+};
+
+#endif // MESH_SIMPLIFIER_H
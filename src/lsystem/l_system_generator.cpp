@@ -1,4 +1,5 @@
 #include "l_system_generator.h"
+#include "task_scheduler.h"
 
 LSystemGenerator::LSystemGenerator()
 	: axiom("F"), iterations(3) {
@@ -18,19 +19,47 @@ void LSystemGenerator::setIterations(int n) {
 }
 
 QString LSystemGenerator::generate() const {
+	// Строки короче порога переписываются в вызывающем потоке
+	constexpr qsizetype parallelChunkSize = 1 << 16;
+
 	QString current = axiom;
 
 	for (int i = 0; i < iterations; i++) {
+		const qsizetype chunkCount = (current.size() + parallelChunkSize - 1) / parallelChunkSize;
+		QVector<QString> chunks(chunkCount);
+
+		// Потоки только читают: неконстантный operator[] отделил бы общие с axiom данные в каждом потоке сразу
+		const QString &source = current;
+		const QMap<QChar, QString> &rules = this->rules;
+
+		TaskScheduler::instance().parallelFor(0, chunkCount, 1, [&](qsizetype first, qsizetype last) {
+			for (qsizetype chunk = first; chunk < last; chunk++) {
+				const qsizetype begin = chunk * parallelChunkSize;
+				const qsizetype end = std::min(begin + parallelChunkSize, source.size());
+
+				QString &next = chunks[chunk];
+				for (qsizetype j = begin; j < end; j++) {
+					const QChar c = source.at(j);
+					const auto rule = rules.constFind(c);
+					if (rule != rules.constEnd())
+						next += rule.value();
+					else
+						next += c;
+				}
+			}
+		});
+
+		qsizetype totalSize = 0;
+		for (const QString &chunk : chunks)
+			totalSize += chunk.size();
+
 		QString next;
+		next.reserve(totalSize);
+		for (const QString &chunk : chunks)
+			next += chunk;
 
-		for (const QChar &c : current) {
-			if (rules.contains(c))
-				next += rules[c];
-			else
-				next += c;
-		}
-		current = next;
+		current = std::move(next);
 	}
 
 	return current;
-}
\ No newline at end of file
+}
@@ -1,157 +1,150 @@
 #include "leaf_generator.h"
-#include <random>
-#include <thread>
+#include "task_scheduler.h"
 #include <vector>
 #include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr int laneCount = 8;
+// Случайные величины листа: три угла, масштаб и прототип
+constexpr uint32_t randomStreams = 5;
+
+// Листья обрабатываются пачками по 8 в виде SoA: каждое поле — отдельный массив дорожек
+struct LeafLanes {
+	float nx[laneCount], ny[laneCount], nz[laneCount];
+	float qw[laneCount], qx[laneCount], qy[laneCount], qz[laneCount];
+	float scale[laneCount];
+	uint32_t prototype[laneCount];
+};
+
+struct Quat {
+	float w, x, y, z;
+};
+
+inline Quat mul(const Quat &a, const Quat &b) {
+	return {
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y + a.y * b.w + a.z * b.x - a.x * b.z,
+		a.w * b.z + a.z * b.w + a.x * b.y - a.y * b.x
+	};
+}
 
-LeafGenerator::LeafMesh LeafGenerator::generate(
-	const QVector<glm::vec3> &positions,
-	const QVector<glm::vec3> &normals) {
-	Mesh prototype;
-
-	glm::vec3 darkGreen(0.05f, 0.35f, 0.05f);
-	glm::vec3 green(0.15f, 0.6f, 0.1f);
-	glm::vec3 lightGreen(0.2f, 0.7f, 0.15f);
-	glm::vec3 yellowEdge(0.3f, 0.65f, 0.1f);
-
-	float width = leafSize * 0.3f;
-	float height = leafSize * 0.6f;
-	float tipOffset = leafSize * 0.1f;
-
-	Vertex v0(glm::vec3(0, -height * 0.3f, 0), glm::vec3(0, 0, 1), darkGreen, glm::vec2(0.5f, 0.1f));
-	Vertex v1(glm::vec3(-width, 0, 0), glm::vec3(0, 0, 1), yellowEdge, glm::vec2(0.1f, 0.5f));
-
-	Vertex v2(glm::vec3(0, height + tipOffset, 0), glm::vec3(0, 0, 1), lightGreen, glm::vec2(0.5f, 0.9f));
-
-	Vertex v3(glm::vec3(width, 0, 0), glm::vec3(0, 0, 1), green, glm::vec2(0.9f, 0.5f));
+// Счётчиковый генератор: значение зависит только от ключа и номера, а не от порядка вызовов
+inline uint32_t mixBits(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
 
-	prototype.vertices.append(v0);
-	prototype.vertices.append(v1);
-	prototype.vertices.append(v2);
-	prototype.vertices.append(v3);
+inline float uniform01(uint32_t key, uint32_t counter) {
+	return static_cast<float>(mixBits(key ^ mixBits(counter)) >> 8) * (1.0f / 16777216.0f);
+}
 
-	prototype.addTriangle(0, 1, 2);
-	prototype.addTriangle(0, 2, 3);
+// Ряды Тейлора для половинных углов; точны до 1e-8 при |x| <= pi/4
+inline float sinSmall(float x) {
+	float x2 = x * x;
+	return x * (1.0f - x2 / 6.0f * (1.0f - x2 / 20.0f * (1.0f - x2 / 42.0f * (1.0f - x2 / 72.0f))));
+}
 
-	glm::vec3 backTint(0.7f, 0.7f, 0.7f);
-	Vertex v0b(glm::vec3(0, -height * 0.3f, 0), glm::vec3(0, 0, -1), darkGreen * backTint, glm::vec2(0.5f, 0.1f));
-	Vertex v1b(glm::vec3(-width, 0, 0), glm::vec3(0, 0, -1), yellowEdge * backTint, glm::vec2(0.1f, 0.5f));
-	Vertex v2b(glm::vec3(0, height + tipOffset, 0), glm::vec3(0, 0, -1), lightGreen * backTint, glm::vec2(0.5f, 0.9f));
-	Vertex v3b(glm::vec3(width, 0, 0), glm::vec3(0, 0, -1), green * backTint, glm::vec2(0.9f, 0.5f));
+inline float cosSmall(float x) {
+	float x2 = x * x;
+	return 1.0f - x2 / 2.0f * (1.0f - x2 / 12.0f * (1.0f - x2 / 30.0f * (1.0f - x2 / 56.0f)));
+}
 
-	prototype.vertices.append(v0b);
-	prototype.vertices.append(v1b);
-	prototype.vertices.append(v2b);
-	prototype.vertices.append(v3b);
+// Базовая ориентация (right, up, normal) раскладывается на рыскание и тангаж, поэтому
+// ядро обходится без ветвлений и без преобразования матрицы в кватернион
+void orientLeaves(LeafLanes &lanes, uint32_t key, uint32_t firstLeaf, float rotationVariation) {
+	for (int l = 0; l < laneCount; l++) {
+		float invLength = 1.0f / std::sqrt(lanes.nx[l] * lanes.nx[l] + lanes.ny[l] * lanes.ny[l] + lanes.nz[l] * lanes.nz[l]);
+		float nx = lanes.nx[l] * invLength;
+		float ny = lanes.ny[l] * invLength;
+		float nz = lanes.nz[l] * invLength;
+
+		float horizontal2 = nx * nx + nz * nz;
+		bool vertical = horizontal2 < 1e-12f;
+		float horizontal = std::sqrt(horizontal2);
+		float invHorizontal = 1.0f / std::max(horizontal, 1e-6f);
+		float cosYaw = vertical ? 1.0f : nz * invHorizontal;
+		float sinYaw = vertical ? 0.0f : nx * invHorizontal;
+
+		// Половинные углы: большая компонента через корень, меньшая через sin a = 2 sin(a/2) cos(a/2)
+		float yawLarge = std::sqrt(0.5f + 0.5f * std::abs(cosYaw));
+		float yawSmall = sinYaw / (2.0f * yawLarge);
+		bool yawFront = cosYaw >= 0.0f;
+		Quat yaw{yawFront ? yawLarge : std::abs(yawSmall), 0.0f,
+		         yawFront ? yawSmall : std::copysign(yawLarge, sinYaw), 0.0f};
+
+		// Тангаж лежит в [-90°, 90°], косинус половинного угла не меньше 0.7
+		float pitchCos = std::sqrt(0.5f + 0.5f * horizontal);
+		Quat pitch{pitchCos, -ny / (2.0f * pitchCos), 0.0f, 0.0f};
+
+		// Переворот на 180° вокруг X
+		constexpr Quat flip{0.0f, 1.0f, 0.0f, 0.0f};
+
+		uint32_t counter = (firstLeaf + l) * randomStreams;
+		float halfX = (uniform01(key, counter) * 2.0f - 1.0f) * rotationVariation * 0.25f;
+		float halfY = (uniform01(key, counter + 1) * 2.0f - 1.0f) * rotationVariation * 0.5f;
+		float halfZ = (uniform01(key, counter + 2) * 2.0f - 1.0f) * rotationVariation * 0.25f;
+
+		Quat qX{cosSmall(halfX), sinSmall(halfX), 0.0f, 0.0f};
+		Quat qY{cosSmall(halfY), 0.0f, sinSmall(halfY), 0.0f};
+		Quat qZ{cosSmall(halfZ), 0.0f, 0.0f, sinSmall(halfZ)};
+
+		Quat q = mul(mul(mul(qZ, qX), qY), mul(flip, mul(yaw, pitch)));
+
+		lanes.qw[l] = q.w;
+		lanes.qx[l] = q.x;
+		lanes.qy[l] = q.y;
+		lanes.qz[l] = q.z;
+		lanes.scale[l] = 0.8f + 0.4f * uniform01(key, counter + 3);
+		lanes.prototype[l] = std::min(static_cast<uint32_t>(uniform01(key, counter + 4) * LeafLibrary::prototypeCount),
+		                              static_cast<uint32_t>(LeafLibrary::prototypeCount - 1));
+	}
+}
+}
 
-	prototype.addTriangle(4, 6, 5);
-	prototype.addTriangle(4, 7, 6);
+LeafGenerator::LeafMesh LeafGenerator::generate(
+	const QVector<glm::vec3> &positions,
+	const QVector<glm::vec3> &normals) {
+	if (prototypes.isEmpty())
+		prototypes = LeafLibrary::buildPrototypes(leafSize);
 
 	QVector<Instance> instances;
 	instances.resize(positions.size());
 
-	const size_t numLeaves = positions.size();
-	
-	if (numLeaves < 50) {
-		std::random_device rd;
-		std::mt19937 gen(rd());
-		std::uniform_real_distribution rotDist(-1.0f, 1.0f);
-		std::uniform_real_distribution sizeDist(0.8f, 1.2f);
-
-		for (int i = 0; i < positions.size(); i++) {
-			Instance inst{};
-			inst.position = positions[i];
-
-			glm::vec3 normal = glm::normalize(normals[i]);
-
-			glm::vec3 up = glm::vec3(0, 1, 0);
-			glm::vec3 right = glm::normalize(glm::cross(up, normal));
-			if (glm::length(right) < 0.001f) {
-				right = glm::vec3(1, 0, 0);
-				up = glm::normalize(glm::cross(normal, right));
+	const qsizetype leafCount = positions.size();
+	const qsizetype packCount = (leafCount + laneCount - 1) / laneCount;
+	const uint32_t key = mixBits(seed);
+
+	TaskScheduler::instance().parallelFor(0, packCount, 256, [&](qsizetype firstPack, qsizetype lastPack) {
+		LeafLanes lanes;
+		for (qsizetype pack = firstPack; pack < lastPack; pack++) {
+			const qsizetype first = pack * laneCount;
+			const int active = static_cast<int>(std::min<qsizetype>(laneCount, leafCount - first));
+
+			// Неполная пачка дополняется последним листом, лишние дорожки отбрасываются
+			for (int l = 0; l < laneCount; l++) {
+				const glm::vec3 &normal = normals[first + std::min(l, active - 1)];
+				lanes.nx[l] = normal.x;
+				lanes.ny[l] = normal.y;
+				lanes.nz[l] = normal.z;
 			}
-			else
-				up = glm::normalize(glm::cross(normal, right));
-
-			glm::mat3 orient(right, up, normal);
-
-			float rx = rotDist(gen) * rotationVariation * 0.5f;
-			float ry = rotDist(gen) * rotationVariation * 1.0f;
-			float rz = rotDist(gen) * rotationVariation * 0.5f;
-
-			glm::quat qX = glm::angleAxis(rx, glm::vec3(1, 0, 0));
-			glm::quat qY = glm::angleAxis(ry, glm::vec3(0, 1, 0));
-			glm::quat qZ = glm::angleAxis(rz, glm::vec3(0, 0, 1));
 
-			glm::quat baseRotation = glm::quat_cast(glm::mat4(orient));
+			orientLeaves(lanes, key, static_cast<uint32_t>(first), rotationVariation);
 
-			glm::quat flipRotation = glm::angleAxis(glm::radians(180.0f), glm::vec3(1, 0, 0));
-
-			inst.rotation = qZ * qX * qY * flipRotation * baseRotation;
-
-			float scale = sizeDist(gen);
-			inst.scale = glm::vec3(scale);
-
-			instances[i] = inst;
-		}
-	} else {
-		constexpr size_t numThreads = 8;
-		std::vector<std::thread> threads;
-		const size_t leavesPerThread = (numLeaves + numThreads - 1) / numThreads;
-
-		for (size_t t = 0; t < numThreads; ++t) {
-			threads.emplace_back([&positions, &normals, &instances, t, leavesPerThread, numLeaves, this]() {
-				size_t start = t * leavesPerThread;
-				size_t end = std::min(start + leavesPerThread, numLeaves);
-
-				std::random_device rd;
-				std::mt19937 gen(rd() + static_cast<unsigned>(t));
-				std::uniform_real_distribution rotDist(-1.0f, 1.0f);
-				std::uniform_real_distribution sizeDist(0.8f, 1.2f);
-
-				for (size_t i = start; i < end; i++) {
-					Instance inst{};
-					inst.position = positions[i];
-
-					glm::vec3 normal = glm::normalize(normals[i]);
-
-					glm::vec3 up = glm::vec3(0, 1, 0);
-					glm::vec3 right = glm::normalize(glm::cross(up, normal));
-					if (glm::length(right) < 0.001f) {
-						right = glm::vec3(1, 0, 0);
-						up = glm::normalize(glm::cross(normal, right));
-					}
-					else
-						up = glm::normalize(glm::cross(normal, right));
-
-					glm::mat3 orient(right, up, normal);
-
-					float rx = rotDist(gen) * rotationVariation * 0.5f;
-					float ry = rotDist(gen) * rotationVariation * 1.0f;
-					float rz = rotDist(gen) * rotationVariation * 0.5f;
-
-					glm::quat qX = glm::angleAxis(rx, glm::vec3(1, 0, 0));
-					glm::quat qY = glm::angleAxis(ry, glm::vec3(0, 1, 0));
-					glm::quat qZ = glm::angleAxis(rz, glm::vec3(0, 0, 1));
-
-					glm::quat baseRotation = glm::quat_cast(glm::mat4(orient));
-
-					glm::quat flipRotation = glm::angleAxis(glm::radians(180.0f), glm::vec3(1, 0, 0));
-
-					inst.rotation = qZ * qX * qY * flipRotation * baseRotation;
-
-					float scale = sizeDist(gen);
-					inst.scale = glm::vec3(scale);
-
-					instances[i] = inst;
-				}
-			});
-		}
-
-		for (auto& thread : threads) {
-			thread.join();
+			for (int l = 0; l < active; l++) {
+				Instance &inst = instances[first + l];
+				inst.position = positions[first + l];
+				inst.rotation = glm::quat(lanes.qw[l], lanes.qx[l], lanes.qy[l], lanes.qz[l]);
+				inst.scale = glm::vec3(lanes.scale[l]);
+				inst.prototype = lanes.prototype[l];
+			}
 		}
-	}
+	});
 
-	return {std::move(prototype), std::move(instances)};
+	return {prototypes, std::move(instances)};
 }
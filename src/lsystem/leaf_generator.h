@@ -2,8 +2,10 @@
 #define LEAF_GENERATOR_H
 
 #include "mesh.h"
+#include "leaf_library.h"
 #include <glm/gtc/quaternion.hpp>
 #include <QVector>
+#include <random>
 
 class LeafGenerator {
 public:
@@ -11,17 +13,25 @@ public:
 		glm::vec3 position;
 		glm::quat rotation;
 		glm::vec3 scale = glm::vec3(1.0f);
+		// Индекс прототипа в LeafLibrary
+		uint32_t prototype = 0;
 	};
 
 	struct LeafMesh {
-		Mesh prototype;
+		QVector<Mesh> prototypes;
 		QVector<Instance> instances;
 	};
 
 	LeafMesh generate(const QVector<glm::vec3>& positions, const QVector<glm::vec3>& normals);
 
+	void setSeed(uint32_t value) { seed = value; }
+
 private:
 	float leafSize = 0.2f;
 	float rotationVariation = 0.5f;
+	uint32_t seed = std::random_device{}();
+
+	// Прототипы не зависят от дерева: строятся при первом вызове и разделяются всеми результатами
+	QVector<Mesh> prototypes;
 };
 #endif // LEAF_GENERATOR_H
\ No newline at end of file
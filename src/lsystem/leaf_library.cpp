@@ -0,0 +1,115 @@
+#include "leaf_library.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+struct LeafShape {
+	float width;
+	float length;
+	float stalk;
+	glm::vec3 baseColor;
+	glm::vec3 leftColor;
+	glm::vec3 tipColor;
+	glm::vec3 rightColor;
+};
+
+// Форма 0 совпадает с прежним единственным листом
+const LeafShape leafShapes[LeafLibrary::prototypeCount] = {
+	{0.3f, 0.6f, 0.3f, {0.05f, 0.35f, 0.05f}, {0.3f, 0.65f, 0.1f}, {0.2f, 0.7f, 0.15f}, {0.15f, 0.6f, 0.1f}},
+	{0.15f, 0.8f, 0.2f, {0.04f, 0.3f, 0.06f}, {0.12f, 0.5f, 0.08f}, {0.1f, 0.55f, 0.1f}, {0.1f, 0.45f, 0.08f}},
+	{0.4f, 0.45f, 0.35f, {0.1f, 0.4f, 0.05f}, {0.35f, 0.7f, 0.12f}, {0.3f, 0.75f, 0.1f}, {0.25f, 0.65f, 0.1f}},
+	{0.25f, 0.55f, 0.25f, {0.2f, 0.4f, 0.05f}, {0.5f, 0.6f, 0.1f}, {0.45f, 0.65f, 0.12f}, {0.4f, 0.55f, 0.08f}},
+};
+
+glm::vec2 toTile(const glm::vec2 &uv, const glm::vec4 &tile) {
+	return {tile.x + uv.x * (tile.z - tile.x), tile.y + uv.y * (tile.w - tile.y)};
+}
+}
+
+QVector<Mesh> LeafLibrary::buildPrototypes(float leafSize) {
+	QVector<Mesh> prototypes;
+	prototypes.reserve(prototypeCount);
+
+	for (int index = 0; index < prototypeCount; index++) {
+		const LeafShape &shape = leafShapes[index];
+		const glm::vec4 tile = atlasTile(index);
+
+		float width = leafSize * shape.width;
+		float height = leafSize * shape.length;
+		float tipOffset = leafSize * 0.1f;
+		float stalk = height * shape.stalk;
+
+		glm::vec3 positions[4] = {
+			{0, -stalk, 0},
+			{-width, 0, 0},
+			{0, height + tipOffset, 0},
+			{width, 0, 0},
+		};
+		glm::vec3 colors[4] = {shape.baseColor, shape.leftColor, shape.tipColor, shape.rightColor};
+		glm::vec2 uvs[4] = {{0.5f, 0.1f}, {0.1f, 0.5f}, {0.5f, 0.9f}, {0.9f, 0.5f}};
+
+		Mesh prototype;
+		for (int i = 0; i < 4; i++)
+			prototype.vertices.append(Vertex(positions[i], glm::vec3(0, 0, 1), colors[i], toTile(uvs[i], tile)));
+
+		prototype.addTriangle(0, 1, 2);
+		prototype.addTriangle(0, 2, 3);
+
+		glm::vec3 backTint(0.7f, 0.7f, 0.7f);
+		for (int i = 0; i < 4; i++)
+			prototype.vertices.append(Vertex(positions[i], glm::vec3(0, 0, -1), colors[i] * backTint, toTile(uvs[i], tile)));
+
+		prototype.addTriangle(4, 6, 5);
+		prototype.addTriangle(4, 7, 6);
+
+		MeshOptimizer::optimize(prototype);
+		prototypes.append(std::move(prototype));
+	}
+
+	return prototypes;
+}
+
+QImage LeafLibrary::buildAtlas() {
+	// Лишний пиксель по краям не даёт выборке последней ячейки заворачиваться на первую
+	QImage atlas(prototypeCount * atlasTileSize + 1, atlasTileSize + 1, QImage::Format_RGB32);
+	atlas.fill(qRgb(255, 255, 255));
+
+	// Текстура модулирует цвет вершин: светлые центральная и боковые жилки на чуть затемнённой пластине
+	for (int index = 0; index < prototypeCount; index++) {
+		const float veinSpacing = 0.12f + 0.03f * index;
+
+		for (int y = 0; y < atlasTileSize; y++) {
+			QRgb *row = reinterpret_cast<QRgb *>(atlas.scanLine(y)) + index * atlasTileSize;
+			float v = (y + 0.5f) / atlasTileSize;
+
+			for (int x = 0; x < atlasTileSize; x++) {
+				float u = (x + 0.5f) / atlasTileSize;
+				float side = std::abs(u - 0.5f);
+
+				float shade = 0.82f;
+				if (side < 0.02f)
+					shade = 1.0f;
+				else {
+					float phase = (v - side * 0.8f) / veinSpacing;
+					if (phase - std::floor(phase) < 0.12f)
+						shade = 0.95f;
+				}
+
+				int value = static_cast<int>(shade * 255.0f + 0.5f);
+				row[x] = qRgb(value, value, value);
+			}
+		}
+	}
+
+	return atlas;
+}
+
+glm::vec4 LeafLibrary::atlasTile(int index) {
+	// Rasterizer выбирает тексель как u * (width - 1), поэтому границы смещены на полтекселя внутрь
+	const float invWidth = 1.0f / static_cast<float>(prototypeCount * atlasTileSize);
+	const float invHeight = 1.0f / static_cast<float>(atlasTileSize);
+	const float x = static_cast<float>(index * atlasTileSize);
+
+	return {(x + 0.5f) * invWidth, 0.5f * invHeight, (x + atlasTileSize - 0.5f) * invWidth, (atlasTileSize - 0.5f) * invHeight};
+}
@@ -0,0 +1,26 @@
+#ifndef LEAF_LIBRARY_H
+#define LEAF_LIBRARY_H
+
+#include "mesh.h"
+#include <QImage>
+#include <QVector>
+
+// Набор прототипов листьев с общим атласом текстур. Экземпляры ссылаются на прототип
+// по индексу, поэтому разнообразие не требует отдельного объекта и текстуры на каждую форму
+class LeafLibrary {
+public:
+	static constexpr int prototypeCount = 4;
+	static constexpr int atlasTileSize = 64;
+
+	// Каждый прототип — двусторонний четырёхугольник из 4 треугольников
+	static constexpr int prototypeTriangleCount = 4;
+
+	// Текстурные координаты прототипа index лежат в его ячейке атласа
+	static QVector<Mesh> buildPrototypes(float leafSize);
+	static QImage buildAtlas();
+
+	// Ячейка атласа в текстурных координатах: (u0, v0, u1, v1)
+	static glm::vec4 atlasTile(int index);
+};
+
+#endif // LEAF_LIBRARY_H
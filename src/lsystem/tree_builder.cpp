@@ -0,0 +1,98 @@
+#include "tree_builder.h"
+#include "l_system_generator.h"
+#include "task_scheduler.h"
+#include <cfloat>
+
+GeneratedTree TreeBuilder::build(const TreeConfig &config, const QImage &barkTexture) {
+	TurtleInterpreter3D turtle;
+	LeafGenerator leafGen;
+	return build(config, barkTexture, turtle, leafGen);
+}
+
+GeneratedTree TreeBuilder::build(const TreeConfig &config,
+                                 const QImage &barkTexture,
+                                 TurtleInterpreter3D &turtle,
+                                 LeafGenerator &leafGen) {
+	LSystemGenerator lsys;
+	lsys.setAxiom(config.axiom);
+	for (const QChar &symbol : config.rules.keys())
+		lsys.addRule(symbol, config.rules.value(symbol));
+	lsys.setIterations(config.iterations);
+
+	turtle.setSeed(config.seed);
+	turtle.setStepLength(config.stepLength);
+	turtle.setAngle(config.angle);
+	turtle.setBaseRadius(config.baseRadius);
+	turtle.setRadiusDecay(config.radiusDecay);
+	turtle.setMinLeafRadius(config.minLeafRadius);
+	turtle.setGravityFactor(config.gravityFactor);
+	turtle.setRadialSegments(config.radialSegments);
+	turtle.setSplineResolution(config.splineResolution);
+	turtle.setBarkTexture(barkTexture);
+
+	TurtleInterpreter3D::DetailBudget budget;
+	budget.maxTriangles = config.triangleBudget;
+	budget.maxBytes = config.memoryBudget;
+	budget.leafTriangles = LeafLibrary::prototypeTriangleCount;
+	budget.leafBytes = sizeof(LeafGenerator::Instance);
+	turtle.setDetailBudget(budget);
+
+	leafGen.setSeed(config.seed);
+
+	// Переписывание строки и каркас идут друг за другом, а оптимизация ствола и листья — параллельно.
+	// Зерна трубок берутся при построении каркаса, поэтому порядок этапов не меняет результат
+	QString commands;
+	TurtleInterpreter3D::TreeMeshes treeData;
+	GeneratedTree tree;
+
+	TaskGraph graph;
+	const int rewrite = graph.addTask([&] { commands = lsys.generate(); });
+	const int skeleton = graph.addTask([&] { treeData = turtle.buildSkeleton(commands); }, {rewrite});
+	graph.addTask([&] { TurtleInterpreter3D::optimizeTrunk(treeData.trunk, treeData.wind); }, {skeleton});
+	graph.addTask([&] {
+		turtle.placeLeaves(treeData);
+		tree.leaves = leafGen.generate(treeData.leafPositions, treeData.leafNormals);
+	}, {skeleton});
+	graph.run();
+
+	turtle.finishTree(treeData);
+
+	tree.trunk = std::move(treeData.trunk);
+	tree.wind = std::move(treeData.wind);
+	tree.detail = turtle.getDetailReport();
+	computeBounds(tree);
+
+	if (budget.isActive()) {
+		qDebug() << "Tree detail: radialSegments" << tree.detail.radialSegments
+				<< "splineResolution" << tree.detail.splineResolution
+				<< "pruneRadius" << tree.detail.pruneRadius
+				<< "prunedBranches" << tree.detail.prunedBranches
+				<< "triangles" << tree.detail.totalTriangles << "/" << config.triangleBudget
+				<< "bytes" << tree.detail.totalBytes << "/" << config.memoryBudget;
+	}
+
+	return tree;
+}
+
+void TreeBuilder::computeBounds(GeneratedTree &tree) {
+	glm::vec3 minBound(FLT_MAX);
+	glm::vec3 maxBound(-FLT_MAX);
+
+	for (const auto &v : tree.trunk.vertices) {
+		minBound = glm::min(minBound, v.position);
+		maxBound = glm::max(maxBound, v.position);
+	}
+
+	for (const auto &inst : tree.leaves.instances) {
+		minBound = glm::min(minBound, inst.position);
+		maxBound = glm::max(maxBound, inst.position);
+	}
+
+	if (minBound.x > maxBound.x) {
+		minBound = glm::vec3(0.0f);
+		maxBound = glm::vec3(0.0f);
+	}
+
+	tree.boundsMin = minBound;
+	tree.boundsMax = maxBound;
+}
@@ -0,0 +1,55 @@
+#ifndef TREE_BUILDER_H
+#define TREE_BUILDER_H
+
+#include "mesh.h"
+#include "leaf_generator.h"
+#include "turtle_interpreter_3_d.h"
+#include <QImage>
+#include <QMap>
+#include <QString>
+
+struct TreeConfig {
+	QString axiom = "F";
+	QMap<QChar, QString> rules;
+	int iterations = 3;
+
+	float angle = 25.7f;
+	float stepLength = 1.0f;
+	float baseRadius = 0.1f;
+	float radiusDecay = 0.7f;
+	float minLeafRadius = 0.02f;
+	float gravityFactor = 0.05f;
+	int radialSegments = 12;
+	float splineResolution = 2.0f;
+
+	// Бюджет на ствол и листья; при превышении снижается тесселяция и отсекаются тонкие ветви
+	int triangleBudget = 0;
+	qint64 memoryBudget = 0;
+
+	uint32_t seed = 1;
+};
+
+struct GeneratedTree {
+	Mesh trunk;
+	LeafGenerator::LeafMesh leaves;
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	TurtleInterpreter3D::DetailReport detail;
+	WindRig wind;
+};
+
+class TreeBuilder {
+public:
+	static GeneratedTree build(const TreeConfig &config, const QImage &barkTexture);
+
+	// То же на переданных интерпретаторе и генераторе листьев: их буферы переживают вызов
+	// и переиспользуются при построении следующего дерева
+	static GeneratedTree build(const TreeConfig &config,
+	                           const QImage &barkTexture,
+	                           TurtleInterpreter3D &turtle,
+	                           LeafGenerator &leafGen);
+
+	static void computeBounds(GeneratedTree &tree);
+};
+
+#endif // TREE_BUILDER_H
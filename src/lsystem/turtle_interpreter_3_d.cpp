@@ -1,8 +1,46 @@
 #include "turtle_interpreter_3_d.h"
+#include "mesh_optimizer.h"
+#include "task_scheduler.h"
+#include <cfloat>
 #include <iostream>
 #include <random>
 #include <glm/gtx/rotate_vector.hpp>
 
+namespace {
+// Расстояние от начала ветви до каждого сегмента в долях полной длины
+QVector<float> alongBranch(const QVector<BranchSegment> &segments, float *totalLength = nullptr) {
+	QVector<float> along(segments.size(), 0.0f);
+	float length = 0.0f;
+	for (int i = 1; i < segments.size(); i++) {
+		length += glm::length(segments[i].position - segments[i - 1].position);
+		along[i] = length;
+	}
+
+	if (length > 0.0f) {
+		for (float &value : along)
+			value /= length;
+	}
+
+	if (totalLength)
+		*totalLength = length;
+	return along;
+}
+
+float nearestAlong(const QVector<BranchSegment> &segments, const glm::vec3 &point) {
+	QVector<float> along = alongBranch(segments);
+	int nearest = 0;
+	float best = FLT_MAX;
+	for (int i = 0; i < segments.size(); i++) {
+		float distance = glm::length(segments[i].position - point);
+		if (distance < best) {
+			best = distance;
+			nearest = i;
+		}
+	}
+	return along.isEmpty() ? 0.0f : along[nearest];
+}
+}
+
 TurtleInterpreter3D::TurtleInterpreter3D()
 	: state(), stepLength(1.0f), angle(glm::radians(25.7f)), baseRadius(0.1f), radiusDecay(0.7f), minLeafRadius(0.02f),
 	  gravityFactor(0.05f), radialSegments(12), rng(std::random_device{}()) {
@@ -52,6 +90,10 @@ void TurtleInterpreter3D::setRadialSegments(int segments) {
 	radialSegments = segments;
 }
 
+void TurtleInterpreter3D::setSeed(uint32_t seed) {
+	rng.seed(seed);
+}
+
 Mesh TurtleInterpreter3D::interpret(const QString &commands) {
 	reset();
 
@@ -59,24 +101,210 @@ Mesh TurtleInterpreter3D::interpret(const QString &commands) {
 	computeRadii(root);
 	generateSplines(root);
 
-	return generateMesh();
+	Mesh mesh = generateMesh(rng);
+	MeshOptimizer::optimize(mesh);
+
+	return mesh;
 }
 
 TurtleInterpreter3D::TreeMeshes TurtleInterpreter3D::interpretTree(const QString &commands) {
+	TreeMeshes meshes = buildSkeleton(commands);
+	optimizeTrunk(meshes.trunk, meshes.wind);
+	placeLeaves(meshes);
+	finishTree(meshes);
+	return meshes;
+}
+
+TurtleInterpreter3D::TreeMeshes TurtleInterpreter3D::buildSkeleton(const QString &commands) {
 	reset();
 
 	buildTree(commands);
 	computeRadii(root);
+
+	configuredSegments = radialSegments;
+	configuredResolution = splineResolution;
+
+	detailReport = DetailReport();
+	if (detailBudget.isActive())
+		fitDetailToBudget();
+
 	generateSplines(root);
 
-	Mesh trunk = generateMesh();
+	TreeMeshes meshes;
+	meshes.trunk = generateMesh(rng, &meshes.wind);
+	return meshes;
+}
+
+void TurtleInterpreter3D::optimizeTrunk(Mesh &trunk, WindRig &wind) {
+	// Оптимизатор переставляет вершины — веса ветра переставляются вместе с ними
+	std::vector<uint32_t> remap;
+	MeshOptimizer::optimize(trunk, remap);
+	QVector<WindWeight> trunkWeights(trunk.vertices.size());
+	for (size_t i = 0; i < remap.size(); i++) {
+		if (remap[i] != MeshOptimizer::unusedVertex)
+			trunkWeights[remap[i]] = wind.trunkWeights[i];
+	}
+	wind.trunkWeights = std::move(trunkWeights);
+}
+
+void TurtleInterpreter3D::placeLeaves(TreeMeshes &meshes) {
+	// Пишет только листья и их веса, ствол в это время может оптимизироваться
+	collectLeafPositionsAndNormals(root, meshes.leafPositions, meshes.leafNormals, &meshes.wind.leafWeights);
+}
+
+void TurtleInterpreter3D::finishTree(const TreeMeshes &meshes) {
+	const Mesh &trunk = meshes.trunk;
+
+	detailReport.radialSegments = radialSegments;
+	detailReport.splineResolution = splineResolution;
+	detailReport.trunkTriangles = trunk.triangles.size();
+	detailReport.leafInstances = meshes.leafPositions.size();
+	detailReport.totalTriangles = detailReport.trunkTriangles + detailReport.leafInstances * detailBudget.leafTriangles;
+	detailReport.totalBytes = trunk.vertices.size() * static_cast<qint64>(sizeof(Vertex))
+	                          + trunk.triangles.size() * static_cast<qint64>(sizeof(Triangle))
+	                          + detailReport.leafInstances * detailBudget.leafBytes;
+	detailReport.withinBudget = (detailBudget.maxTriangles <= 0 || detailReport.totalTriangles <= detailBudget.maxTriangles)
+	                            && (detailBudget.maxBytes <= 0 || detailReport.totalBytes <= detailBudget.maxBytes);
+
+	radialSegments = configuredSegments;
+	splineResolution = configuredResolution;
+}
+
+void TurtleInterpreter3D::estimateDetail(const std::shared_ptr<TreeNode> &node,
+                                         int segments,
+                                         int resolution,
+                                         float pruneRadius,
+                                         DetailEstimate &estimate) const {
+	// Повторяет generateSplines/generateMesh/collectLeafPositionsAndNormals без построения геометрии
+	if (node->splinePoints.size() < 2)
+		return;
+
+	const qint64 rings = static_cast<qint64>(node->splinePoints.size() - 1) * (resolution + 1);
+	estimate.trunkVertices += rings * segments;
+	estimate.trunkTriangles += (rings - 1) * 2 * segments;
+
+	int keptChildren = 0;
+	for (const auto &child : node->children) {
+		if (child->radius < pruneRadius)
+			continue;
+
+		keptChildren++;
+		if (child->splinePoints.size() >= 2)
+			estimate.trunkTriangles += 2 * segments;
+		estimateDetail(child, segments, resolution, pruneRadius, estimate);
+	}
+
+	const bool hasLeaf = node->hasLeaf || (!node->children.isEmpty() && keptChildren == 0);
+	if (hasLeaf)
+		estimate.leafInstances += 2 * std::min<qint64>(3, rings);
+}
+
+bool TurtleInterpreter3D::fitsBudget(const DetailEstimate &estimate) const {
+	const qint64 triangles = estimate.trunkTriangles + estimate.leafInstances * detailBudget.leafTriangles;
+	const qint64 bytes = estimate.trunkVertices * static_cast<qint64>(sizeof(Vertex))
+	                     + estimate.trunkTriangles * static_cast<qint64>(sizeof(Triangle))
+	                     + estimate.leafInstances * detailBudget.leafBytes;
+
+	return (detailBudget.maxTriangles <= 0 || triangles <= detailBudget.maxTriangles)
+	       && (detailBudget.maxBytes <= 0 || bytes <= detailBudget.maxBytes);
+}
+
+void TurtleInterpreter3D::fitDetailToBudget() {
+	int segments = radialSegments;
+	int resolution = std::max(1, static_cast<int>(splineResolution));
+	const int minSegments = std::min(segments, std::max(3, detailBudget.minRadialSegments));
+
+	auto estimateFor = [&](int s, int r, float prune) {
+		DetailEstimate estimate;
+		estimateDetail(root, s, r, prune, estimate);
+		return estimate;
+	};
+
+	// Сначала снижается тесселяция: на каждом шаге выбирается вариант, который
+	// укладывается в бюджет, либо тот, что убирает больше треугольников
+	while (!fitsBudget(estimateFor(segments, resolution, 0.0f))) {
+		const bool canReduceSegments = segments > minSegments;
+		const bool canReduceResolution = resolution > 1;
+		if (!canReduceSegments && !canReduceResolution)
+			break;
+
+		if (!canReduceResolution) {
+			segments--;
+			continue;
+		}
+		if (!canReduceSegments) {
+			resolution--;
+			continue;
+		}
+
+		DetailEstimate fewerSegments = estimateFor(segments - 1, resolution, 0.0f);
+		DetailEstimate lowerResolution = estimateFor(segments, resolution - 1, 0.0f);
+
+		if (fitsBudget(fewerSegments))
+			segments--;
+		else if (fitsBudget(lowerResolution) || lowerResolution.trunkTriangles < fewerSegments.trunkTriangles)
+			resolution--;
+		else
+			segments--;
+	}
 
-	QVector<glm::vec3> leafPositions;
-	QVector<glm::vec3> leafNormals;
+	radialSegments = segments;
+	splineResolution = static_cast<float>(resolution);
 
-	collectLeafPositionsAndNormals(root, leafPositions, leafNormals);
+	if (fitsBudget(estimateFor(segments, resolution, 0.0f)))
+		return;
 
-	return {std::move(trunk), std::move(leafPositions), std::move(leafNormals)};
+	// Затем отсекаются самые тонкие ветви: наименьший порог, при котором дерево укладывается в бюджет
+	QVector<float> radii;
+	std::function<void(const std::shared_ptr<TreeNode> &)> collectRadii = [&](const std::shared_ptr<TreeNode> &node) {
+		for (const auto &child : node->children) {
+			radii.append(child->radius);
+			collectRadii(child);
+		}
+	};
+	collectRadii(root);
+
+	std::sort(radii.begin(), radii.end());
+	radii.erase(std::unique(radii.begin(), radii.end()), radii.end());
+
+	int low = 0;
+	int high = radii.size() - 1;
+	float pruneRadius = radii.isEmpty() ? 0.0f : radii.last() * 1.001f;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		float candidate = radii[mid] * 1.001f;
+		if (fitsBudget(estimateFor(segments, resolution, candidate))) {
+			pruneRadius = candidate;
+			high = mid - 1;
+		} else
+			low = mid + 1;
+	}
+
+	detailReport.pruneRadius = pruneRadius;
+	detailReport.prunedBranches = pruneBranches(root, pruneRadius);
+}
+
+int TurtleInterpreter3D::pruneBranches(const std::shared_ptr<TreeNode> &node, float pruneRadius) {
+	int pruned = 0;
+	QVector<std::shared_ptr<TreeNode> > kept;
+
+	for (const auto &child : node->children) {
+		if (child->radius < pruneRadius) {
+			pruned++;
+			continue;
+		}
+
+		pruned += pruneBranches(child, pruneRadius);
+		kept.append(child);
+	}
+
+	// Обрезанная ветвь становится концевой и получает листья
+	if (!node->children.isEmpty() && kept.isEmpty())
+		node->hasLeaf = true;
+
+	node->children = std::move(kept);
+	return pruned;
 }
 
 void TurtleInterpreter3D::buildTree(const QString &commands) {
@@ -118,47 +346,38 @@ void TurtleInterpreter3D::buildTree(const QString &commands) {
 			break;
 		}
 		case '+': {
-			static std::mt19937 gen(std::random_device{}());
 			std::normal_distribution angleNoise(0.0f, angleVariation * 0.1f);
-			float actualAngle = angle + glm::radians(angleNoise(gen));
+			float actualAngle = angle + glm::radians(angleNoise(rng));
 			rotateAroundAxis(state.up, actualAngle);
 			break;
 		}
 		case '-': {
-			static std::mt19937 gen(std::random_device{}());
 			std::normal_distribution angleNoise(0.0f, angleVariation * 0.1f);
-			float actualAngle = -angle + glm::radians(angleNoise(gen));
+			float actualAngle = -angle + glm::radians(angleNoise(rng));
 			rotateAroundAxis(state.up, actualAngle);
 			break;
 		}
 		case '&': {
-			static std::mt19937 gen(std::random_device{}());  // ← Инициализация ОДИН РАЗ
 			std::normal_distribution angleNoise(0.0f, angleVariation * 0.1f);
-			float actualAngle = angle + glm::radians(angleNoise(gen));
+			float actualAngle = angle + glm::radians(angleNoise(rng));
 			rotateAroundAxis(state.left, actualAngle);
 			break;
 		}
 		case '^': {
-			static std::mt19937 gen(std::random_device{}());  // ← Инициализация ОДИН РАЗ
-
 			std::normal_distribution angleNoise(0.0f, angleVariation * 0.1f);
-			float actualAngle = -angle + glm::radians(angleNoise(gen));
+			float actualAngle = -angle + glm::radians(angleNoise(rng));
 			rotateAroundAxis(state.left, actualAngle);
 			break;
 		}
 		case '\\': {
-			static std::mt19937 gen(std::random_device{}());  // ← Инициализация ОДИН РАЗ
-
 			std::normal_distribution angleNoise(0.0f, angleVariation * 0.1f);
-			float actualAngle = angle + glm::radians(angleNoise(gen));
+			float actualAngle = angle + glm::radians(angleNoise(rng));
 			rotateAroundAxis(state.heading, actualAngle);
 			break;
 		}
 		case '/': {
-			static std::mt19937 gen(std::random_device{}());  // ← Инициализация ОДИН РАЗ
-
 			std::normal_distribution angleNoise(0.0f, angleVariation * 0.1f);
-			float actualAngle = -angle + glm::radians(angleNoise(gen));
+			float actualAngle = -angle + glm::radians(angleNoise(rng));
 			rotateAroundAxis(state.heading, actualAngle);
 			break;
 		}
@@ -342,12 +561,17 @@ void TurtleInterpreter3D::collectLeafPositions(std::shared_ptr<TreeNode> node) {
 void TurtleInterpreter3D::collectLeafPositionsAndNormals(
 	std::shared_ptr<TreeNode> node,
 	QVector<glm::vec3>& positions,
-	QVector<glm::vec3>& normals)
+	QVector<glm::vec3>& normals,
+	QVector<WindWeight>* windWeights)
 {
 	 if (node->hasLeaf && !node->branchSegments.isEmpty()) {
        int segmentCount = node->branchSegments.size();
        int startSegment = std::max(0, segmentCount - 3);
 
+       // Узел без своей трубки висит на конце ветви предка
+       const bool ownBranch = segmentCount >= 2;
+       const QVector<float> along = ownBranch ? alongBranch(node->branchSegments) : QVector<float>();
+
        std::uniform_real_distribution<float> angleDist(0.0f, 2.0f * M_PI);
        std::uniform_real_distribution radiusDist(1.5f, 2.5f);
        std::uniform_real_distribution forwardDist(0.0f, 2.0f);
@@ -356,7 +580,7 @@ void TurtleInterpreter3D::collectLeafPositionsAndNormals(
        for (int segIdx = startSegment; segIdx < segmentCount; segIdx++) {
           const auto& seg = node->branchSegments[segIdx];
 
-          int leavesOnSegment = 1 + (rand() % 2);
+          int leavesOnSegment = 1 + static_cast<int>(rng() % 2);
 
           for (int i = 0; i < leavesOnSegment; i++) {
              glm::vec3 right, up;
@@ -382,106 +606,151 @@ void TurtleInterpreter3D::collectLeafPositionsAndNormals(
 
              positions.append(leafPos);
              normals.append(leafNormal);
+             if (windWeights) {
+                WindWeight weight{static_cast<uint32_t>(std::max(node->windBranch, 0)),
+                                  static_cast<uint32_t>(node->depth),
+                                  ownBranch ? along[segIdx] : 1.0f};
+                windWeights->append(weight);
+             }
           }
        }
     }
 
 	for (auto& child : node->children)
-		collectLeafPositionsAndNormals(child, positions, normals);
+		collectLeafPositionsAndNormals(child, positions, normals, windWeights);
 }
 
-Mesh TurtleInterpreter3D::generateMesh() const {
+Mesh TurtleInterpreter3D::generateMesh(std::mt19937 &tubeSeeds, WindRig *wind) const {
 	Mesh mesh;
 	glm::vec3 brownColor(0.45f, 0.25f, 0.1f);
 
-	struct ConnectionInfo {
-		std::shared_ptr<TreeNode> node;
-		QVector<uint32_t> vertexIndices;
-		glm::vec3 connectionPoint;  // Добавлено: позиция соединения
+	struct TubeJob {
+		const TreeNode *node;
+		uint32_t firstVertex;
+		qsizetype firstTriangle;
+		uint32_t seed;
 	};
 
-	QMap<std::shared_ptr<TreeNode>, ConnectionInfo> connections;
+	struct Connection {
+		int parent;
+		int child;
+	};
 
-	std::function<void(std::shared_ptr<TreeNode>)> traverse = [&](const std::shared_ptr<TreeNode> &node) {
-		if (!node->branchSegments.isEmpty()) {
-			addTube(mesh, node->branchSegments, brownColor, radialSegments);
+	// Последовательный проход раскладывает трубки по буферу в порядке обхода,
+	// поэтому сами трубки строятся независимо; зерно шума у каждой трубки своё
+	QVector<TubeJob> tubes;
+	QVector<Connection> connections;
+	uint32_t vertexCount = 0;
+	qsizetype triangleCount = 0;
+
+	// Индекс трубки совпадает с индексом ветви WindRig
+	std::function<int(const std::shared_ptr<TreeNode> &, int)> collect = [&](const std::shared_ptr<TreeNode> &node,
+	                                                                          int parentBranch) {
+		node->windBranch = parentBranch;
+		if (node->branchSegments.isEmpty())
+			return -1;
+
+		int index = -1;
+		if (node->branchSegments.size() >= 2) {
+			index = tubes.size();
+			tubes.append({node.get(), vertexCount, triangleCount, static_cast<uint32_t>(tubeSeeds())});
+			node->windBranch = index;
+
+			if (wind) {
+				WindBranch branch{parentBranch, static_cast<uint32_t>(node->depth), 0.0f, 0.0f};
+				alongBranch(node->branchSegments, &branch.length);
+				if (parentBranch >= 0)
+					branch.attach = nearestAlong(tubes[parentBranch].node->branchSegments,
+					                             node->branchSegments.first().position);
+				wind->branches.append(branch);
+			}
 
-			ConnectionInfo info;
-			info.node = node;
-			uint32_t endRingStart = mesh.vertices.size() - radialSegments;
+			vertexCount += node->branchSegments.size() * radialSegments;
+			triangleCount += (node->branchSegments.size() - 1) * 2 * radialSegments;
+		}
 
-			// Сохраняем позицию последнего сегмента для проверки расстояния
-			info.connectionPoint = node->branchSegments.last().position;
+		for (auto &child : node->children) {
+			int childIndex = collect(child, node->windBranch);
+			if (index >= 0 && childIndex >= 0)
+				connections.append({index, childIndex});
+		}
 
-			for (int i = 0; i < radialSegments; i++) {
-				info.vertexIndices.append(endRingStart + i);
-			}
-			connections[node] = info;
-
-			for (auto &child : node->children) {
-				if (connections.contains(node)) {
-					uint32_t childStartIdx = mesh.vertices.size();
-
-					// Получаем позицию начала дочерней ветви
-					glm::vec3 childStartPos = child->branchSegments.isEmpty()
-						? child->position
-						: child->branchSegments.first().position;
-
-					traverse(child);
-
-					auto &parentRing = connections[node].vertexIndices;
-					uint32_t childFirstRing = childStartIdx;
-
-					// КРИТИЧЕСКАЯ ПРОВЕРКА: расстояние между родителем и ребёнком
-					float distance = glm::length(connections[node].connectionPoint - childStartPos);
-					float maxAllowedDistance = 2.0f; // Максимальное расстояние для соединения
-
-					// Только создаём соединение если ветви достаточно близко
-					if (distance < maxAllowedDistance && childFirstRing < mesh.vertices.size()) {
-						// Проверяем что у нас есть достаточно вершин
-						uint32_t childRingEnd = childFirstRing + radialSegments;
-						if (childRingEnd <= mesh.vertices.size()) {
-							for (int i = 0; i < radialSegments; i++) {
-								uint32_t i0 = parentRing[i];
-								uint32_t i1 = parentRing[(i + 1) % radialSegments];
-								uint32_t i2 = childFirstRing + i;
-								uint32_t i3 = childFirstRing + ((i + 1) % radialSegments);
-
-								// Дополнительная проверка валидности индексов
-								if (i0 < mesh.vertices.size() && i1 < mesh.vertices.size() &&
-									i2 < mesh.vertices.size() && i3 < mesh.vertices.size()) {
-
-									// Проверка что треугольники не вырожденные
-									glm::vec3 v0 = mesh.vertices[i0].position;
-									glm::vec3 v1 = mesh.vertices[i1].position;
-									glm::vec3 v2 = mesh.vertices[i2].position;
-									glm::vec3 v3 = mesh.vertices[i3].position;
-
-									// Вычисляем площадь треугольников
-									float area1 = glm::length(glm::cross(v1 - v0, v2 - v0));
-									float area2 = glm::length(glm::cross(v2 - v1, v3 - v1));
-
-									// Только добавляем треугольники если они не вырожденные
-									if (area1 > 0.001f) {
-										mesh.addTriangle(i0, i2, i1);
-									}
-									if (area2 > 0.001f) {
-										mesh.addTriangle(i1, i2, i3);
-									}
-								}
-							}
-						}
-					} else if (distance >= maxAllowedDistance) {
-						qDebug() << "Skipping connection - distance too large:" << distance;
-					}
-				} else {
-					traverse(child);
+		return index;
+	};
+
+	collect(root, -1);
+
+	mesh.vertices.resize(vertexCount);
+	mesh.triangles.resize(triangleCount);
+
+	Vertex *vertices = mesh.vertices.data();
+	Triangle *triangles = mesh.triangles.data();
+
+	TaskScheduler::instance().parallelFor(0, tubes.size(), 16, [&](qsizetype first, qsizetype last) {
+		for (qsizetype i = first; i < last; i++) {
+			const TubeJob &job = tubes[i];
+			std::mt19937 noise(job.seed);
+			addTube(vertices + job.firstVertex, triangles + job.firstTriangle, job.firstVertex,
+			        job.node->branchSegments, brownColor, radialSegments, noise);
+		}
+	});
+
+	// Кольцо трубки целиком лежит на одном расстоянии от начала ветви
+	if (wind) {
+		wind->trunkWeights.resize(vertexCount);
+		WindWeight *weights = wind->trunkWeights.data();
+		TaskScheduler::instance().parallelFor(0, tubes.size(), 16, [&](qsizetype first, qsizetype last) {
+			for (qsizetype i = first; i < last; i++) {
+				const TubeJob &job = tubes[i];
+				const QVector<float> along = alongBranch(job.node->branchSegments);
+				for (int ring = 0; ring < along.size(); ring++) {
+					for (int j = 0; j < radialSegments; j++)
+						weights[job.firstVertex + ring * radialSegments + j] = {static_cast<uint32_t>(i),
+						                                                        static_cast<uint32_t>(job.node->depth),
+						                                                        along[ring]};
 				}
 			}
+		});
+	}
+
+	for (const Connection &connection : connections) {
+		const TubeJob &parent = tubes[connection.parent];
+		const TubeJob &child = tubes[connection.child];
+
+		uint32_t parentRing = parent.firstVertex + (parent.node->branchSegments.size() - 1) * radialSegments;
+		uint32_t childFirstRing = child.firstVertex;
+
+		// КРИТИЧЕСКАЯ ПРОВЕРКА: расстояние между родителем и ребёнком
+		float distance = glm::length(parent.node->branchSegments.last().position - child.node->branchSegments.first().position);
+		float maxAllowedDistance = 2.0f; // Максимальное расстояние для соединения
+
+		if (distance >= maxAllowedDistance) {
+			qDebug() << "Skipping connection - distance too large:" << distance;
+			continue;
 		}
-	};
 
-	traverse(root);
+		for (int i = 0; i < radialSegments; i++) {
+			uint32_t i0 = parentRing + i;
+			uint32_t i1 = parentRing + (i + 1) % radialSegments;
+			uint32_t i2 = childFirstRing + i;
+			uint32_t i3 = childFirstRing + (i + 1) % radialSegments;
+
+			glm::vec3 v0 = mesh.vertices[i0].position;
+			glm::vec3 v1 = mesh.vertices[i1].position;
+			glm::vec3 v2 = mesh.vertices[i2].position;
+			glm::vec3 v3 = mesh.vertices[i3].position;
+
+			// Только добавляем треугольники если они не вырожденные.
+			// Обход тот же, что у сегментов трубки, иначе отсечение задних граней выбьет стык
+			float area1 = glm::length(glm::cross(v1 - v0, v2 - v0));
+			float area2 = glm::length(glm::cross(v2 - v1, v3 - v1));
+
+			if (area1 > 0.001f)
+				mesh.addTriangle(i0, i1, i2);
+			if (area2 > 0.001f)
+				mesh.addTriangle(i1, i3, i2);
+		}
+	}
 
 	return mesh;
 
@@ -535,15 +804,16 @@ Mesh TurtleInterpreter3D::generateMesh() const {
 	// return mesh;
 }
 
-void TurtleInterpreter3D::addTube(Mesh &mesh,
+void TurtleInterpreter3D::addTube(Vertex *vertices,
+                                  Triangle *triangles,
+                                  uint32_t baseVertexIdx,
                                   const QVector<BranchSegment> &segments,
                                   const glm::vec3 &color,
-                                  int segmentsPerRing) const {
+                                  int segmentsPerRing,
+                                  std::mt19937 &noise) const {
 	if (segments.size() < 2)
 		return;
 
-	uint32_t baseVertexIdx = mesh.vertices.size();
-
 	float totalLength = 0.0f;
 	QVector<float> segLengths;
 	segLengths.resize(segments.size());
@@ -571,8 +841,6 @@ void TurtleInterpreter3D::addTube(Mesh &mesh,
 		return glm::vec3(qRed(pixel) / 255.0f, qGreen(pixel) / 255.0f, qBlue(pixel) / 255.0f);
 	};
 
-	std::random_device rd;
-	std::mt19937 gen(rd());
 	std::uniform_real_distribution noiseDist(-1.0f, 1.0f);
 
 	for (int i = 0; i < segments.size(); i++) {
@@ -584,7 +852,7 @@ void TurtleInterpreter3D::addTube(Mesh &mesh,
 			float angle = 2.0f * M_PI * j / segmentsPerRing;
 			glm::vec3 radialDir = std::cos(angle) * right + std::sin(angle) * up;
 
-			float detailNoise = noiseDist(gen) * 0.03f;
+			float detailNoise = noiseDist(noise) * 0.03f;
 			float radiusVar = 1.0f + detailNoise;
 
 			float nodeThickness = 1.0f;
@@ -609,7 +877,7 @@ void TurtleInterpreter3D::addTube(Mesh &mesh,
 			float colorMult = 0.7f + heightFactor * 0.4f;
 			v.color *= colorMult;
 
-			mesh.vertices.append(v);
+			*vertices++ = v;
 		}
 	}
 
@@ -620,8 +888,8 @@ void TurtleInterpreter3D::addTube(Mesh &mesh,
 			uint32_t i2 = baseVertexIdx + (i + 1) * segmentsPerRing + j;
 			uint32_t i3 = baseVertexIdx + (i + 1) * segmentsPerRing + (j + 1) % segmentsPerRing;
 
-			mesh.addTriangle(i0, i1, i2);
-			mesh.addTriangle(i1, i3, i2);
+			*triangles++ = Triangle(i0, i1, i2);
+			*triangles++ = Triangle(i1, i3, i2);
 		}
 	}
 }
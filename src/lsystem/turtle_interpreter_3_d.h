@@ -6,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include "mesh.h"
+#include "wind_rig.h"
 #include <QStack>
 #include <QDebug>
 #include <QImage>
@@ -35,6 +36,8 @@ struct TreeNode {
 	QList<float> splineRadii;
 	bool isTerminal = false;
 	bool hasLeaf = false;
+	// Ветвь WindRig, к которой привязаны вершины и листья узла (у узла без трубки — ближайший предок)
+	int windBranch = -1;
 };
 
 class TurtleInterpreter3D {
@@ -43,6 +46,31 @@ public:
 		Mesh trunk;
 		QVector<glm::vec3> leafPositions;
 		QVector<glm::vec3> leafNormals;
+		WindRig wind;
+	};
+
+	// Ограничение на размер результата; 0 — без ограничения
+	struct DetailBudget {
+		int maxTriangles = 0;
+		qint64 maxBytes = 0;
+		int leafTriangles = 0;
+		qint64 leafBytes = 0;
+		int minRadialSegments = 4;
+
+		[[nodiscard]] bool isActive() const { return maxTriangles > 0 || maxBytes > 0; }
+	};
+
+	// Параметры, выбранные в режиме бюджета, и фактический размер результата
+	struct DetailReport {
+		int radialSegments = 0;
+		float splineResolution = 0.0f;
+		float pruneRadius = 0.0f;
+		int prunedBranches = 0;
+		int trunkTriangles = 0;
+		int leafInstances = 0;
+		int totalTriangles = 0;
+		qint64 totalBytes = 0;
+		bool withinBudget = true;
 	};
 
 	TurtleInterpreter3D();
@@ -57,12 +85,23 @@ public:
 	void setSplineResolution(float resolution) { splineResolution = resolution; }
 	void setBranchBendFactor(float factor) { branchBendFactor = factor; }
 	void setRadiusVariation(float variation) { radiusVariation = variation; }
+	void setSeed(uint32_t seed);
+	void setDetailBudget(const DetailBudget &budget) { detailBudget = budget; }
+
+	[[nodiscard]] const DetailReport &getDetailReport() const { return detailReport; }
 
 	void setBarkTexture(const QImage &texture);
 	void setLeafTexture(const QImage &texture);
 
 	Mesh interpret(const QString &commands);
 	TreeMeshes interpretTree(const QString &commands);
+
+	// Этапы interpretTree по отдельности. После buildSkeleton оптимизация ствола и расстановка листьев
+	// не зависят друг от друга и могут идти параллельно; finishTree вызывается после обоих
+	TreeMeshes buildSkeleton(const QString &commands);
+	static void optimizeTrunk(Mesh &trunk, WindRig &wind);
+	void placeLeaves(TreeMeshes &meshes);
+	void finishTree(const TreeMeshes &meshes);
 	void reset();
 
 private:
@@ -70,13 +109,28 @@ private:
 	void buildTree(const QString &commands);
 	void computeRadii(const std::shared_ptr<TreeNode> &node);
 	void generateSplines(std::shared_ptr<TreeNode> node);
-	Mesh generateMesh() const;
-	void addTube(Mesh &mesh, const QVector<BranchSegment> &segments, const glm::vec3 &color, int segmentsPerRing) const;
+
+	struct DetailEstimate {
+		qint64 trunkVertices = 0;
+		qint64 trunkTriangles = 0;
+		qint64 leafInstances = 0;
+	};
+
+	void estimateDetail(const std::shared_ptr<TreeNode> &node, int segments, int resolution, float pruneRadius,
+	                    DetailEstimate &estimate) const;
+	[[nodiscard]] bool fitsBudget(const DetailEstimate &estimate) const;
+	void fitDetailToBudget();
+	int pruneBranches(const std::shared_ptr<TreeNode> &node, float pruneRadius);
+	// Зерно шума каждой трубки берётся из tubeSeeds в порядке обхода, сами трубки строятся параллельно
+	Mesh generateMesh(std::mt19937 &tubeSeeds, WindRig *wind = nullptr) const;
+	void addTube(Vertex *vertices, Triangle *triangles, uint32_t baseVertexIdx, const QVector<BranchSegment> &segments,
+	             const glm::vec3 &color, int segmentsPerRing, std::mt19937 &noise) const;
 	static void computeFrenetFrame(const glm::vec3 &forward, glm::vec3 &right, glm::vec3 &up);
 	void collectLeafPositions(std::shared_ptr<TreeNode> node);
 	void collectLeafPositionsAndNormals(std::shared_ptr<TreeNode> node,
 	                                    QVector<glm::vec3> &positions,
-	                                    QVector<glm::vec3> &normals);
+	                                    QVector<glm::vec3> &normals,
+	                                    QVector<WindWeight> *windWeights = nullptr);
 
 	struct TurtleState3D {
 		glm::vec3 position;
@@ -108,7 +162,13 @@ private:
 	QImage barkTexture;
 	QImage leafTexture;
 
-	mutable std::mt19937 rng;
+	std::mt19937 rng;
+
+	DetailBudget detailBudget;
+	DetailReport detailReport;
+	// Настройки детализации до подбора под бюджет; finishTree возвращает их
+	int configuredSegments = 0;
+	float configuredResolution = 0.0f;
 };
 
 #endif // TURTLEINTERPRETER3D_H
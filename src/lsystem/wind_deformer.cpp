@@ -0,0 +1,188 @@
+#include "wind_deformer.h"
+#include "task_scheduler.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr float fullTurn = 2.0f * static_cast<float>(M_PI);
+
+// Размах изгиба на единицу длины ветви при strength = 1; глубокие ветви гибче
+constexpr float bendPerLength = 0.02f;
+constexpr float depthFlexibility = 1.0f;
+constexpr float depthFrequencyScale = 0.35f;
+constexpr float crossWindRatio = 0.25f;
+
+// Постоянная фаза ветви, чтобы соседние ветви не качались синхронно
+float branchPhase(uint32_t branch) {
+	uint32_t h = branch * 0x9e3779b9u;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return static_cast<float>(h >> 8) * (fullTurn / 16777216.0f);
+}
+
+// Родитель раньше потомка, веса ссылаются на существующие ветви
+bool rigValid(const WindRig &rig) {
+	const uint32_t branchCount = rig.branches.size();
+	for (qsizetype b = 0; b < rig.branches.size(); b++) {
+		if (rig.branches[b].parent >= b)
+			return false;
+	}
+	for (const WindWeight &w : rig.trunkWeights) {
+		if (w.branch >= branchCount)
+			return false;
+	}
+	for (const WindWeight &w : rig.leafWeights) {
+		if (w.branch >= branchCount)
+			return false;
+	}
+	return true;
+}
+}
+
+WindDeformer::WindDeformer(WindRig windRig, MeshObject &trunk, InstancedMeshObject *leaves)
+	: rig(std::move(windRig)), trunk(trunk), leaves(leaves) {
+	if (!rigValid(rig)) {
+		qWarning() << "WindDeformer: inconsistent wind rig, tree stays static";
+		rig = WindRig();
+	}
+	if (rig.isEmpty()) {
+		this->leaves = nullptr;
+		return;
+	}
+
+	const MeshObject &trunkLods = trunk;
+	if (rig.trunkWeights.size() != trunkLods.getMesh().vertices.size()) {
+		qWarning() << "WindDeformer: trunk weights do not match the mesh, trunk stays static";
+	} else {
+		// Вершина упрощённого уровня — копия вершины исходной сетки и берёт её вес
+		levelOffsets.append(0);
+		for (int level = 0; level < trunkLods.getLodCount(); level++) {
+			const QVector<Vertex> &vertices = trunkLods.getLod(level).vertices;
+			for (qsizetype i = 0; i < vertices.size(); i++) {
+				const uint32_t base = level == 0 ? i : trunkLods.getLodSourceVertices(level)[i];
+				restPositions.append(vertices[i].position);
+				trunkWeights.append(rig.trunkWeights[base]);
+			}
+			levelOffsets.append(restPositions.size());
+		}
+	}
+	rig.trunkWeights.clear();
+
+	if (leaves) {
+		const QVector<uint32_t> &source = leaves->getSourceIndices();
+		bool valid = true;
+		for (uint32_t index : source)
+			valid = valid && index < static_cast<uint32_t>(rig.leafWeights.size());
+
+		if (valid) {
+			leafWeights.resize(source.size());
+			for (qsizetype i = 0; i < source.size(); i++)
+				leafWeights[i] = rig.leafWeights[source[i]];
+			leafOffsets.resize(source.size());
+		} else {
+			qWarning() << "WindDeformer: leaf weights do not match the instances, leaves stay static";
+			this->leaves = nullptr;
+		}
+	}
+
+	branchBase.resize(rig.branches.size());
+	branchTip.resize(rig.branches.size());
+}
+
+void WindDeformer::updateBranches(float time, float phase) {
+	glm::vec3 along(settings.direction.x, 0.0f, settings.direction.z);
+	float horizontal = glm::length(along);
+	along = horizontal > 1e-6f ? along / horizontal : glm::vec3(1.0f, 0.0f, 0.0f);
+	const glm::vec3 across(-along.z, 0.0f, along.x);
+
+	maxOffset = 0.0f;
+	for (qsizetype b = 0; b < rig.branches.size(); b++) {
+		const WindBranch &branch = rig.branches[b];
+		const float depth = static_cast<float>(branch.depth);
+		const float amplitude = settings.strength * bendPerLength * branch.length * (1.0f + depthFlexibility * depth);
+		const float omega = settings.frequency * (1.0f + depthFrequencyScale * depth);
+		const float angle = omega * time + branchPhase(static_cast<uint32_t>(b)) + phase;
+
+		// Ветвь постоянно наклонена по ветру и качается вокруг этого наклона
+		branchTip[b] = amplitude * ((0.6f + 0.4f * std::sin(angle)) * along +
+		                            crossWindRatio * std::sin(1.3f * angle) * across);
+
+		if (branch.parent >= 0) {
+			const float attach = branch.attach * branch.attach;
+			branchBase[b] = branchBase[branch.parent] + branchTip[branch.parent] * attach;
+		} else
+			branchBase[b] = glm::vec3(0.0f);
+
+		maxOffset = std::max(maxOffset, glm::length(branchBase[b]) + glm::length(branchTip[b]));
+	}
+}
+
+void WindDeformer::apply(float time, float phase) {
+	if (rig.isEmpty())
+		return;
+
+	updateBranches(time, phase);
+
+	const glm::vec3 *base = branchBase.constData();
+	const glm::vec3 *tip = branchTip.constData();
+
+	if (!trunkWeights.isEmpty()) {
+		const int levelCount = levelOffsets.size() - 1;
+		QVector<Vertex *> levelVertices(levelCount);
+		for (int level = 0; level < levelCount; level++)
+			levelVertices[level] = trunk.getLod(level).vertices.data();
+
+		const WindWeight *weights = trunkWeights.constData();
+		const glm::vec3 *rest = restPositions.constData();
+		const qsizetype *offsets = levelOffsets.constData();
+
+		// Один проход по вершинам всех уровней: поза покоя плюс смещение своей ветви
+		TaskScheduler::instance().parallelFor(0, restPositions.size(), 4096, [&](qsizetype first, qsizetype last) {
+			for (int level = 0; level < levelCount; level++) {
+				const qsizetype begin = std::max(first, offsets[level]);
+				const qsizetype end = std::min(last, offsets[level + 1]);
+				Vertex *vertices = levelVertices[level] - offsets[level];
+				for (qsizetype i = begin; i < end; i++) {
+					const WindWeight &w = weights[i];
+					vertices[i].position = rest[i] + base[w.branch] + tip[w.branch] * (w.along * w.along);
+				}
+			}
+		});
+	}
+
+	// Уровень детализации выбирается по сфере, вмещающей отклонённую позу
+	trunk.setBoundsPadding(maxOffset);
+
+	if (leaves) {
+		glm::vec3 *offsets = leafOffsets.data();
+		const WindWeight *weights = leafWeights.constData();
+		TaskScheduler::instance().parallelFor(0, leafOffsets.size(), 4096, [&](qsizetype first, qsizetype last) {
+			for (qsizetype i = first; i < last; i++) {
+				const WindWeight &w = weights[i];
+				offsets[i] = base[w.branch] + tip[w.branch] * (w.along * w.along);
+			}
+		});
+		leaves->applyOffsets(offsets, maxOffset);
+	}
+}
+
+void WindDeformer::reset() {
+	if (rig.isEmpty())
+		return;
+
+	for (int level = 0; level + 1 < levelOffsets.size(); level++) {
+		QVector<Vertex> &vertices = trunk.getLod(level).vertices;
+		for (qsizetype i = 0; i < vertices.size(); i++)
+			vertices[i].position = restPositions[levelOffsets[level] + i];
+	}
+
+	if (leaves) {
+		leafOffsets.fill(glm::vec3(0.0f));
+		leaves->applyOffsets(leafOffsets.constData(), 0.0f);
+	}
+
+	maxOffset = 0.0f;
+	trunk.setBoundsPadding(0.0f);
+}
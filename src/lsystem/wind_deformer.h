@@ -0,0 +1,61 @@
+#ifndef WIND_DEFORMER_H
+#define WIND_DEFORMER_H
+
+#include "wind_rig.h"
+#include "mesh_object.h"
+#include "instanced_mesh_object.h"
+#include <QVector>
+
+// Покадровая деформация дерева ветром поверх сохранённой позы покоя.
+// Каждая ветвь изгибается как балка: смещение точки растёт квадратично вдоль ветви
+// и добавляется к смещению точки крепления на родителе
+class WindDeformer {
+public:
+	struct Settings {
+		// Направление ветра в горизонтальной плоскости
+		glm::vec3 direction = glm::vec3(1.0f, 0.0f, 0.0f);
+		float strength = 1.0f;
+		// Частота раскачивания ствола, рад/с; тонкие ветви качаются быстрее
+		float frequency = 1.5f;
+	};
+
+	// Объекты не принадлежат деформеру и должны жить дольше него; leaves может быть nullptr.
+	// Уровни детализации ствола строятся до создания деформера: он изгибает их все
+	WindDeformer(WindRig rig, MeshObject &trunk, InstancedMeshObject *leaves);
+
+	void setSettings(const Settings &value) { settings = value; }
+	[[nodiscard]] const Settings &getSettings() const { return settings; }
+
+	// Записывает в объекты позу для момента time (секунды); phase сдвигает колебания всего дерева
+	void apply(float time, float phase = 0.0f);
+
+	// Возвращает ствол и листья в позу покоя
+	void reset();
+
+	// Наибольшее смещение точки дерева в последней позе
+	[[nodiscard]] float getMaxOffset() const { return maxOffset; }
+
+private:
+	void updateBranches(float time, float phase);
+
+	WindRig rig;
+	MeshObject &trunk;
+	InstancedMeshObject *leaves;
+	Settings settings;
+
+	// Вершины всех уровней детализации ствола подряд; уровень level занимает
+	// [levelOffsets[level], levelOffsets[level + 1])
+	QVector<glm::vec3> restPositions;
+	QVector<WindWeight> trunkWeights;
+	QVector<qsizetype> levelOffsets;
+	// Веса листьев в порядке экземпляров объекта
+	QVector<WindWeight> leafWeights;
+
+	// Смещение начала и изгиб конца каждой ветви в текущем кадре
+	QVector<glm::vec3> branchBase;
+	QVector<glm::vec3> branchTip;
+	QVector<glm::vec3> leafOffsets;
+	float maxOffset = 0.0f;
+};
+
+#endif // WIND_DEFORMER_H
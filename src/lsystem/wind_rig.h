@@ -0,0 +1,35 @@
+#ifndef WIND_RIG_H
+#define WIND_RIG_H
+
+#include <QVector>
+#include <cstdint>
+
+// Ветвь в иерархии изгиба: ветви идут в порядке обхода, родитель всегда раньше потомков
+struct WindBranch {
+	int32_t parent;
+	uint32_t depth;
+	// Доля длины родителя, в которой начинается ветвь
+	float attach;
+	float length;
+};
+
+// Привязка вершины ствола или листа к ветви
+struct WindWeight {
+	uint32_t branch;
+	uint32_t depth;
+	// Расстояние от начала ветви в долях её длины
+	float along;
+};
+
+// Данные для анимации ветром, снятые при генерации: поза покоя остаётся в самой геометрии
+struct WindRig {
+	QVector<WindBranch> branches;
+	// Параллельно вершинам ствола
+	QVector<WindWeight> trunkWeights;
+	// Параллельно экземплярам листьев в порядке генерации
+	QVector<WindWeight> leafWeights;
+
+	[[nodiscard]] bool isEmpty() const { return branches.isEmpty(); }
+};
+
+#endif // WIND_RIG_H
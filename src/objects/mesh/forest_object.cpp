@@ -0,0 +1,126 @@
+#include "forest_object.h"
+#include "base_visitor.h"
+#include "task_scheduler.h"
+#include <QDebug>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+int ForestObject::addSpecies(std::unique_ptr<MeshObject> trunk, std::unique_ptr<InstancedMeshObject> leaves) {
+	glm::vec3 minBound(FLT_MAX);
+	glm::vec3 maxBound(-FLT_MAX);
+
+	if (trunk) {
+		for (const Vertex &v : trunk->getMesh().vertices) {
+			minBound = glm::min(minBound, v.position);
+			maxBound = glm::max(maxBound, v.position);
+		}
+	}
+
+	if (leaves) {
+		for (const auto &cluster : leaves->getClusters()) {
+			minBound = glm::min(minBound, cluster.boundsMin);
+			maxBound = glm::max(maxBound, cluster.boundsMax);
+		}
+	}
+
+	if (minBound.x > maxBound.x) {
+		minBound = glm::vec3(0.0f);
+		maxBound = glm::vec3(0.0f);
+	}
+
+	Species entry{std::move(trunk), std::move(leaves), (minBound + maxBound) * 0.5f, 0.0f};
+	entry.boundsRadius = glm::length(maxBound - minBound) * 0.5f;
+	species.push_back(std::move(entry));
+
+	return static_cast<int>(species.size()) - 1;
+}
+
+void ForestObject::setInstances(QVector<TreeInstance> instances) {
+	instances_ = std::move(instances);
+
+	const uint32_t speciesCount = species.size();
+	qsizetype invalid = 0;
+	for (const TreeInstance &inst : instances_) {
+		if (inst.species >= speciesCount)
+			invalid++;
+	}
+
+	// Экземпляры несуществующих видов отбрасываются
+	if (invalid > 0) {
+		qWarning() << "ForestObject:" << invalid << "instances reference a missing species, dropped";
+		auto invalidBegin = std::remove_if(instances_.begin(), instances_.end(), [speciesCount](const TreeInstance &inst) {
+			return inst.species >= speciesCount;
+		});
+		instances_.erase(invalidBegin, instances_.end());
+	}
+
+	rebuildTransforms();
+}
+
+void ForestObject::setPosition(const glm::vec3 &pos) {
+	position = pos;
+	rebuildTransforms();
+}
+
+void ForestObject::rebuildTransforms() {
+	modelMatrices_.resize(instances_.size());
+	normalMatrices_.resize(instances_.size());
+
+	TaskScheduler::instance().parallelFor(0, instances_.size(), 1024, [this](qsizetype begin, qsizetype end) {
+		for (qsizetype i = begin; i < end; i++) {
+			const TreeInstance &inst = instances_[i];
+			const float c = std::cos(inst.rotation);
+			const float s = std::sin(inst.rotation);
+
+			// Поворот вокруг Y и равномерный масштаб: матрица нормалей — тот же поворот
+			glm::mat3 rotation(glm::vec3(c, 0.0f, -s), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(s, 0.0f, c));
+			glm::mat3 linear = rotation * inst.scale;
+
+			modelMatrices_[i] = glm::mat4x3(linear[0], linear[1], linear[2], inst.position + position);
+			normalMatrices_[i] = rotation;
+		}
+	});
+}
+
+void ForestObject::applyWind(float time, const glm::vec3 &direction, float strength, float frequency) {
+	rebuildTransforms();
+	windLean = 0.0f;
+	if (strength == 0.0f)
+		return;
+
+	glm::vec3 along(direction.x, 0.0f, direction.z);
+	float horizontal = glm::length(along);
+	along = horizontal > 1e-6f ? along / horizontal : glm::vec3(1.0f, 0.0f, 0.0f);
+	const glm::vec3 across(-along.z, 0.0f, along.x);
+
+	// Наклон на единицу высоты дерева при strength = 1
+	constexpr float leanPerStrength = 0.03f;
+	const float lean = leanPerStrength * std::abs(strength);
+	windLean = lean * std::sqrt(1.0f + 0.2f * 0.2f);
+
+	TaskScheduler::instance().parallelFor(0, instances_.size(), 1024, [&](qsizetype begin, qsizetype end) {
+		for (qsizetype i = begin; i < end; i++) {
+			const TreeInstance &inst = instances_[i];
+			const float angle = frequency * time + inst.windPhase;
+			glm::vec3 shear = lean * ((0.6f + 0.4f * std::sin(angle)) * along + 0.2f * std::sin(1.3f * angle) * across);
+
+			// Сдвиг столбца Y: точка на высоте h уходит на h * shear; нормали почти не меняются
+			modelMatrices_[i][1] += shear * inst.scale;
+		}
+	});
+}
+
+glm::vec3 ForestObject::getInstanceCenter(qsizetype index) const {
+	const Species &entry = species[instances_[index].species];
+	return modelMatrices_[index] * glm::vec4(entry.boundsCenter, 1.0f);
+}
+
+float ForestObject::getInstanceRadius(qsizetype index) const {
+	// Центр сдвигается вместе с кроной, точки уходят от него не дальше lean * |y - centerY|
+	return species[instances_[index].species].boundsRadius * (1.0f + windLean) * instances_[index].scale;
+}
+
+void ForestObject::accept(BaseVisitor &visitor) {
+	visitor.visit(*this);
+}
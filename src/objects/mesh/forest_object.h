@@ -0,0 +1,70 @@
+#ifndef FOREST_OBJECT_H
+#define FOREST_OBJECT_H
+
+#include "scene_object.h"
+#include "mesh_object.h"
+#include "instanced_mesh_object.h"
+#include <QVector>
+#include <memory>
+#include <vector>
+
+// Лес из экземпляров нескольких видов деревьев. Ствол и листья вида хранятся один раз,
+// каждое дерево — это только преобразование, оттенок и фаза ветра
+class ForestObject : public SceneObject {
+public:
+	struct TreeInstance {
+		glm::vec3 position = glm::vec3(0.0f);
+		// Поворот вокруг вертикальной оси, радианы
+		float rotation = 0.0f;
+		float scale = 1.0f;
+		// Множитель цвета ствола и листьев
+		glm::vec3 tint = glm::vec3(1.0f);
+		// Сдвиг фазы колебаний от ветра, радианы
+		float windPhase = 0.0f;
+		uint32_t species = 0;
+	};
+
+	struct Species {
+		std::unique_ptr<MeshObject> trunk;
+		std::unique_ptr<InstancedMeshObject> leaves;
+		// Ограничивающая сфера дерева в его собственных координатах
+		glm::vec3 boundsCenter;
+		float boundsRadius;
+	};
+
+	// Геометрия вида задаётся в координатах дерева (корень в начале координат); возвращает индекс вида
+	int addSpecies(std::unique_ptr<MeshObject> trunk, std::unique_ptr<InstancedMeshObject> leaves);
+
+	[[nodiscard]] const std::vector<Species> &getSpecies() const { return species; }
+
+	void setInstances(QVector<TreeInstance> instances);
+	[[nodiscard]] const QVector<TreeInstance> &getInstances() const { return instances_; }
+
+	// Параллельны getInstances(): матрица дерева (с учётом позиции объекта) и матрица нормалей
+	[[nodiscard]] const QVector<glm::mat4x3> &getModelMatrices() const { return modelMatrices_; }
+	[[nodiscard]] const QVector<glm::mat3> &getNormalMatrices() const { return normalMatrices_; }
+
+	// Ограничивающая сфера экземпляра в мировых координатах
+	[[nodiscard]] glm::vec3 getInstanceCenter(qsizetype index) const;
+	[[nodiscard]] float getInstanceRadius(qsizetype index) const;
+
+	// Раскачивание целых деревьев: верх кроны сдвигается по ветру пропорционально высоте,
+	// фаза каждого дерева — его windPhase. strength = 0 возвращает позу покоя
+	void applyWind(float time, const glm::vec3 &direction, float strength, float frequency);
+
+	void setPosition(const glm::vec3 &pos) override;
+
+	void accept(BaseVisitor &visitor) override;
+
+private:
+	void rebuildTransforms();
+
+	std::vector<Species> species;
+	QVector<TreeInstance> instances_;
+	QVector<glm::mat4x3> modelMatrices_;
+	QVector<glm::mat3> normalMatrices_;
+	// Наибольший наклон от ветра на единицу высоты, расширяет ограничивающие сферы
+	float windLean = 0.0f;
+};
+
+#endif // FOREST_OBJECT_H
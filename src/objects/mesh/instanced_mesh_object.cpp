@@ -1,17 +1,374 @@
 #include "instanced_mesh_object.h"
 #include "base_visitor.h"
+#include "task_scheduler.h"
+#include <QDebug>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
 
-InstancedMeshObject::InstancedMeshObject(Mesh prototype, const QVector<LeafGenerator::Instance>& leafInstances, const QImage* tex)
-	: prototype_(std::move(prototype)), texture(tex) {
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+InstancedMeshObject::InstancedMeshObject(QVector<Mesh> prototypes, const QVector<LeafGenerator::Instance>& leafInstances, const QImage* tex)
+	: prototypes_(std::move(prototypes)), texture(tex) {
+	instances_.reserve(leafInstances.size());
 	for (const auto& leafInst : leafInstances) {
 		Instance inst;
 		inst.position = leafInst.position;
 		inst.rotation = leafInst.rotation;
 		inst.scale = leafInst.scale;
+		inst.prototype = leafInst.prototype;
 		instances_.append(inst);
 	}
+	buildClusters();
+}
+
+void InstancedMeshObject::setInstances(QVector<Instance> instances) {
+	instances_ = std::move(instances);
+	clearImpostors();
+	buildClusters();
+}
+
+void InstancedMeshObject::rebuildTransforms() {
+	modelMatrices_.resize(instances_.size());
+	normalMatrices_.resize(instances_.size());
+	prototypeIndices_.resize(instances_.size());
+
+	TaskScheduler::instance().parallelFor(0, instances_.size(), 1024, [this](qsizetype begin, qsizetype end) {
+		for (qsizetype i = begin; i < end; i++) {
+			const Instance &inst = instances_[i];
+			glm::mat3 linear = glm::mat3_cast(inst.rotation);
+			linear[0] *= inst.scale.x;
+			linear[1] *= inst.scale.y;
+			linear[2] *= inst.scale.z;
+
+			modelMatrices_[i] = glm::mat4x3(linear[0], linear[1], linear[2], inst.position);
+			normalMatrices_[i] = glm::transpose(glm::inverse(linear));
+			prototypeIndices_[i] = static_cast<uint16_t>(inst.prototype);
+		}
+	});
+}
+
+namespace {
+constexpr float fullTurn = 2.0f * static_cast<float>(M_PI);
+
+uint32_t spreadBits(uint32_t v) {
+	v = (v | (v << 16)) & 0x030000ffu;
+	v = (v | (v << 8)) & 0x0300f00fu;
+	v = (v | (v << 4)) & 0x030c30c3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+// Направление на камеру для вида k и горизонталь спрайта в этом виде
+glm::vec3 impostorViewDirection(int view) {
+	float angle = fullTurn * static_cast<float>(view) / InstancedMeshObject::impostorViews;
+	return {std::sin(angle), 0.0f, std::cos(angle)};
+}
+
+glm::vec3 impostorRight(const glm::vec3 &toCamera) {
+	return {toCamera.z, 0.0f, -toCamera.x};
+}
+}
+
+void InstancedMeshObject::buildClusters() {
+	clusters.clear();
+	if (instances_.isEmpty() || prototypes_.isEmpty()) {
+		instances_.clear();
+		sourceIndices_.clear();
+		rebuildTransforms();
+		return;
+	}
+
+	const uint32_t prototypeCount = prototypes_.size();
+	qsizetype invalid = 0;
+	for (Instance &inst : instances_) {
+		if (inst.prototype >= prototypeCount) {
+			inst.prototype = 0;
+			invalid++;
+		}
+	}
+	if (invalid > 0)
+		qWarning() << "InstancedMeshObject:" << invalid << "instances reference a missing prototype, using 0";
+
+	glm::vec3 minBound(FLT_MAX);
+	glm::vec3 maxBound(-FLT_MAX);
+	for (const Instance &inst : instances_) {
+		minBound = glm::min(minBound, inst.position);
+		maxBound = glm::max(maxBound, inst.position);
+	}
+
+	// Сортировка по коду Мортона делает соседние по индексу листья соседними в пространстве
+	glm::vec3 extent = glm::max(maxBound - minBound, glm::vec3(1e-6f));
+	std::vector<std::pair<uint32_t, qsizetype>> order(instances_.size());
+	for (qsizetype i = 0; i < instances_.size(); i++) {
+		glm::vec3 cell = (instances_[i].position - minBound) / extent * 1023.0f;
+		uint32_t code = spreadBits(static_cast<uint32_t>(cell.x)) |
+		                spreadBits(static_cast<uint32_t>(cell.y)) << 1 |
+		                spreadBits(static_cast<uint32_t>(cell.z)) << 2;
+		order[i] = {code, i};
+	}
+	std::sort(order.begin(), order.end());
+
+	// Внутри скопления экземпляры одного прототипа идут подряд: отрисовка меняет сетку реже
+	for (qsizetype first = 0; first < instances_.size(); first += leavesPerCluster) {
+		auto begin = order.begin() + first;
+		auto end = order.begin() + std::min<qsizetype>(first + leavesPerCluster, instances_.size());
+		std::stable_sort(begin, end, [this](const auto &a, const auto &b) {
+			return instances_[a.second].prototype < instances_[b.second].prototype;
+		});
+	}
+
+	QVector<Instance> sorted;
+	sorted.reserve(instances_.size());
+	sourceIndices_.resize(instances_.size());
+	for (qsizetype i = 0; i < instances_.size(); i++) {
+		sorted.append(instances_[order[i].second]);
+		sourceIndices_[i] = static_cast<uint32_t>(order[i].second);
+	}
+	instances_ = std::move(sorted);
+	animationMargin = 0.0f;
+	rebuildTransforms();
+
+	float prototypeRadius = 0.0f;
+	for (const Mesh &prototype : prototypes_)
+		for (const Vertex &v : prototype.vertices)
+			prototypeRadius = std::max(prototypeRadius, glm::length(v.position));
+
+	for (qsizetype first = 0; first < instances_.size(); first += leavesPerCluster) {
+		Cluster cluster{};
+		cluster.first = first;
+		cluster.count = std::min<qsizetype>(leavesPerCluster, instances_.size() - first);
+		cluster.atlasTile = clusters.size() * impostorViews;
+		cluster.boundsMin = glm::vec3(FLT_MAX);
+		cluster.boundsMax = glm::vec3(-FLT_MAX);
+
+		// Границы охватывают лист целиком: точка крепления плюс радиус прототипа с учётом масштаба
+		for (qsizetype i = first; i < first + cluster.count; i++) {
+			const Instance &inst = instances_[i];
+			glm::vec3 reach(prototypeRadius * std::max({inst.scale.x, inst.scale.y, inst.scale.z}));
+			cluster.boundsMin = glm::min(cluster.boundsMin, inst.position - reach);
+			cluster.boundsMax = glm::max(cluster.boundsMax, inst.position + reach);
+		}
+
+		cluster.center = (cluster.boundsMin + cluster.boundsMax) * 0.5f;
+		for (qsizetype i = first; i < first + cluster.count; i++) {
+			const Instance &inst = instances_[i];
+			float maxScale = std::max({inst.scale.x, inst.scale.y, inst.scale.z});
+			cluster.radius = std::max(cluster.radius,
+			                          glm::length(inst.position - cluster.center) + prototypeRadius * maxScale);
+		}
+
+		clusters.append(cluster);
+	}
+}
+
+void InstancedMeshObject::applyOffsets(const glm::vec3 *offsets, float maxOffset) {
+	TaskScheduler::instance().parallelFor(0, instances_.size(), 4096, [&](qsizetype begin, qsizetype end) {
+		for (qsizetype i = begin; i < end; i++)
+			modelMatrices_[i][3] = instances_[i].position + offsets[i];
+	});
+
+	// Границы только растут: скопление не выпадает из frustum, пока ветер не превысил прежний размах
+	if (maxOffset > animationMargin) {
+		const glm::vec3 grow(maxOffset - animationMargin);
+		for (Cluster &cluster : clusters) {
+			cluster.boundsMin -= grow;
+			cluster.boundsMax += grow;
+			cluster.radius += grow.x;
+		}
+		animationMargin = maxOffset;
+	}
+}
+
+void InstancedMeshObject::buildImpostors(int resolution) {
+	clearImpostors();
+	if (clusters.isEmpty() || resolution <= 0)
+		return;
+
+	impostorResolution = resolution;
+	const int tileCount = clusters.size() * impostorViews;
+	atlasTilesPerRow = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<float>(tileCount)))));
+	const int rows = (tileCount + atlasTilesPerRow - 1) / atlasTilesPerRow;
+
+	// Лишний пиксель по краям не даёт выборке последней ячейки заворачиваться на первую
+	impostorAtlas = QImage(atlasTilesPerRow * resolution + 1, rows * resolution + 1, QImage::Format_ARGB32);
+	impostorAtlas.fill(0u);
+
+	uchar *bits = impostorAtlas.bits();
+	const qsizetype bytesPerLine = impostorAtlas.bytesPerLine();
+	TaskScheduler::instance().parallelFor(0, clusters.size(), 4, [&](qsizetype begin, qsizetype end) {
+		for (qsizetype c = begin; c < end; c++)
+			bakeCluster(clusters[c], bits, bytesPerLine);
+	});
+}
+
+void InstancedMeshObject::clearImpostors() {
+	impostorAtlas = QImage();
+	impostorResolution = 0;
+	atlasTilesPerRow = 0;
+}
+
+void InstancedMeshObject::bakeCluster(const Cluster &cluster, uchar *atlasBits, qsizetype bytesPerLine) const {
+	const int res = impostorResolution;
+	const float scale = static_cast<float>(res) / (2.0f * cluster.radius);
+	const glm::vec3 up(0.0f, 1.0f, 0.0f);
+	std::vector<float> depth(res * res);
+
+	// Спрайт запекается с той же текстурой, которой рисуются листья вблизи
+	const bool hasTexture = texture && !texture->isNull();
+	auto sampleTexture = [this](const glm::vec2 &uv) {
+		int x = std::clamp(static_cast<int>(uv.x * (texture->width() - 1)), 0, texture->width() - 1);
+		int y = std::clamp(static_cast<int>(uv.y * (texture->height() - 1)), 0, texture->height() - 1);
+		QRgb texel = texture->pixel(x, y);
+		return glm::vec3(qRed(texel), qGreen(texel), qBlue(texel)) / 255.0f;
+	};
+
+	struct BakedVertex {
+		glm::vec2 screen;
+		float depth;
+		glm::vec3 color;
+		glm::vec2 uv;
+	};
+
+	for (int view = 0; view < impostorViews; view++) {
+		const glm::vec3 toCamera = impostorViewDirection(view);
+		const glm::vec3 right = impostorRight(toCamera);
+		const int tile = cluster.atlasTile + view;
+		const int tileX = (tile % atlasTilesPerRow) * res;
+		const int tileY = (tile / atlasTilesPerRow) * res;
+
+		std::fill(depth.begin(), depth.end(), -FLT_MAX);
+
+		for (qsizetype i = cluster.first; i < cluster.first + cluster.count; i++) {
+			const glm::mat4x3 &model = modelMatrices_[i];
+			const glm::mat3 &normalMatrix = normalMatrices_[i];
+			const Mesh &prototype = prototypes_[prototypeIndices_[i]];
+
+			for (const Triangle &tri : prototype.triangles) {
+				const Vertex *src[3] = {&prototype.vertices[tri.i0], &prototype.vertices[tri.i1], &prototype.vertices[tri.i2]};
+
+				// Двусторонний лист: в спрайт попадает только сторона, обращённая к камере
+				glm::vec3 faceNormal = normalMatrix * (src[0]->normal + src[1]->normal + src[2]->normal);
+				if (glm::dot(faceNormal, toCamera) <= 0.0f)
+					continue;
+
+				BakedVertex v[3];
+				for (int k = 0; k < 3; k++) {
+					glm::vec3 offset = model * glm::vec4(src[k]->position, 1.0f) - cluster.center;
+					v[k].screen = glm::vec2(glm::dot(offset, right) * scale + res * 0.5f,
+					                        res * 0.5f - glm::dot(offset, up) * scale);
+					v[k].depth = glm::dot(offset, toCamera);
+					v[k].color = src[k]->color;
+					v[k].uv = src[k]->texCoord;
+				}
+
+				float area = (v[1].screen.x - v[0].screen.x) * (v[2].screen.y - v[0].screen.y) -
+				             (v[2].screen.x - v[0].screen.x) * (v[1].screen.y - v[0].screen.y);
+				if (std::abs(area) < 1e-6f)
+					continue;
+
+				int minX = std::max(0, static_cast<int>(std::floor(std::min({v[0].screen.x, v[1].screen.x, v[2].screen.x}))));
+				int maxX = std::min(res - 1, static_cast<int>(std::ceil(std::max({v[0].screen.x, v[1].screen.x, v[2].screen.x}))));
+				int minY = std::max(0, static_cast<int>(std::floor(std::min({v[0].screen.y, v[1].screen.y, v[2].screen.y}))));
+				int maxY = std::min(res - 1, static_cast<int>(std::ceil(std::max({v[0].screen.y, v[1].screen.y, v[2].screen.y}))));
+
+				for (int y = minY; y <= maxY; y++) {
+					QRgb *row = reinterpret_cast<QRgb *>(atlasBits + (tileY + y) * bytesPerLine) + tileX;
+					for (int x = minX; x <= maxX; x++) {
+						glm::vec2 p(x + 0.5f, y + 0.5f);
+						float w0 = ((v[1].screen.x - p.x) * (v[2].screen.y - p.y) - (v[2].screen.x - p.x) * (v[1].screen.y - p.y)) / area;
+						float w1 = ((v[2].screen.x - p.x) * (v[0].screen.y - p.y) - (v[0].screen.x - p.x) * (v[2].screen.y - p.y)) / area;
+						float w2 = 1.0f - w0 - w1;
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+							continue;
+
+						float z = v[0].depth * w0 + v[1].depth * w1 + v[2].depth * w2;
+						float &stored = depth[y * res + x];
+						if (z <= stored)
+							continue;
+						stored = z;
+
+						glm::vec3 color = v[0].color * w0 + v[1].color * w1 + v[2].color * w2;
+						if (hasTexture)
+							color *= sampleTexture(v[0].uv * w0 + v[1].uv * w1 + v[2].uv * w2);
+						color = glm::clamp(color, 0.0f, 1.0f);
+						row[x] = qRgba(static_cast<int>(color.r * 255.0f + 0.5f),
+						               static_cast<int>(color.g * 255.0f + 0.5f),
+						               static_cast<int>(color.b * 255.0f + 0.5f),
+						               255);
+					}
+				}
+			}
+		}
+	}
+}
+
+glm::vec4 InstancedMeshObject::tileRect(int tile) const {
+	// Rasterizer выбирает тексель как u * (width - 1), поэтому границы смещены на полтекселя внутрь
+	const float res = static_cast<float>(impostorResolution);
+	const float x = static_cast<float>(tile % atlasTilesPerRow) * res;
+	const float y = static_cast<float>(tile / atlasTilesPerRow) * res;
+	const float invWidth = 1.0f / static_cast<float>(impostorAtlas.width() - 1);
+	const float invHeight = 1.0f / static_cast<float>(impostorAtlas.height() - 1);
+
+	return {(x + 0.5f) * invWidth, (y + 0.5f) * invHeight, (x + res - 0.5f) * invWidth, (y + res - 0.5f) * invHeight};
+}
+
+void InstancedMeshObject::selectClusters(const glm::mat4 &viewProj,
+                                         const Frustum &frustum,
+                                         const glm::vec3 &cameraPos,
+                                         int viewportHeight,
+                                         QVector<int> &nearClusters,
+                                         Mesh &billboards) const {
+	nearClusters.clear();
+	billboards.vertices.clear();
+	billboards.triangles.clear();
+
+	const glm::vec3 up(0.0f, 1.0f, 0.0f);
+	const glm::vec3 white(1.0f);
+
+	for (int c = 0; c < clusters.size(); c++) {
+		const Cluster &cluster = clusters[c];
+		if (!frustum.intersectsBox(cluster.boundsMin, cluster.boundsMax))
+			continue;
+
+		if (!hasImpostors() ||
+		    projectedSize(viewProj, cluster.center, cluster.radius, viewportHeight) >= impostorResolution) {
+			nearClusters.append(c);
+			continue;
+		}
+
+		glm::vec3 toCamera = cameraPos - cluster.center;
+		toCamera.y = 0.0f;
+		float horizontal = glm::length(toCamera);
+		toCamera = horizontal > 1e-4f ? toCamera / horizontal : glm::vec3(0.0f, 0.0f, 1.0f);
+
+		float angle = std::atan2(toCamera.x, toCamera.z);
+		int view = static_cast<int>(std::lround(angle / fullTurn * impostorViews));
+		view = (view % impostorViews + impostorViews) % impostorViews;
+
+		glm::vec4 rect = tileRect(cluster.atlasTile + view);
+		glm::vec3 right = impostorRight(toCamera) * cluster.radius;
+		glm::vec3 lift = up * cluster.radius;
+
+		// Нормали углов как у сферы, описанной вокруг скопления: освещение кроны остаётся объёмным.
+		// Квад выдвинут к камере, иначе он оказывается в тени собственных листьев
+		glm::vec3 front = toCamera * cluster.radius;
+		glm::vec3 pivot = cluster.center + front * 0.5f;
+		glm::vec3 corners[4] = {-right - lift, right - lift, right + lift, -right + lift};
+		glm::vec2 uvs[4] = {{rect.x, rect.w}, {rect.z, rect.w}, {rect.z, rect.y}, {rect.x, rect.y}};
+
+		uint32_t base = billboards.vertices.size();
+		for (int k = 0; k < 4; k++)
+			billboards.vertices.append(Vertex(pivot + corners[k], glm::normalize(corners[k] + front), white, uvs[k]));
+		billboards.addTriangle(base, base + 1, base + 2);
+		billboards.addTriangle(base, base + 2, base + 3);
+	}
 }
 
 void InstancedMeshObject::accept(BaseVisitor& visitor) {
 	visitor.visit(*this);
-}
\ No newline at end of file
+}
@@ -8,6 +8,7 @@
 #include <QImage>
 #include "leaf_generator.h"
 #include "lighting.h"
+#include "frustum.h"
 
 class InstancedMeshObject : public SceneObject {
 public:
@@ -15,22 +16,77 @@ public:
 		glm::vec3 position;
 		glm::quat rotation;
 		glm::vec3 scale = glm::vec3(1.0f);
+		// Индекс сетки в getPrototypes()
+		uint32_t prototype = 0;
 	};
 
-	InstancedMeshObject(Mesh prototype, QVector<Instance> instances)
-		: prototype_(std::move(prototype)), instances_(std::move(instances)), texture(nullptr) {
+	InstancedMeshObject(Mesh prototype, QVector<Instance> instances, const QImage *tex = nullptr)
+		: instances_(std::move(instances)), texture(tex) {
+		prototypes_.append(std::move(prototype));
+		buildClusters();
 	}
 
-	InstancedMeshObject(Mesh prototype, QVector<Instance> instances, const QImage *tex)
-		: prototype_(std::move(prototype)), instances_(std::move(instances)), texture(tex) {
+	InstancedMeshObject(QVector<Mesh> prototypes, QVector<Instance> instances, const QImage *tex = nullptr)
+		: prototypes_(std::move(prototypes)), instances_(std::move(instances)), texture(tex) {
+		buildClusters();
 	}
 
-	InstancedMeshObject(Mesh prototype,
+	InstancedMeshObject(QVector<Mesh> prototypes,
 	                    const QVector<LeafGenerator::Instance> &leafInstances,
 	                    const QImage *tex = nullptr);
 
-	[[nodiscard]] const Mesh &getPrototype() const { return prototype_; }
+	[[nodiscard]] const QVector<Mesh> &getPrototypes() const { return prototypes_; }
 	[[nodiscard]] const QVector<Instance> &getInstances() const { return instances_; }
+	void setInstances(QVector<Instance> instances);
+
+	// Готовые к отрисовке матрицы, параллельные instances_: аффинная 3×4 и матрица нормалей
+	[[nodiscard]] const QVector<glm::mat4x3> &getModelMatrices() const { return modelMatrices_; }
+	[[nodiscard]] const QVector<glm::mat3> &getNormalMatrices() const { return normalMatrices_; }
+	// Индексы прототипов, параллельные instances_; внутри скопления экземпляры сгруппированы по прототипу
+	[[nodiscard]] const QVector<uint16_t> &getPrototypeIndices() const { return prototypeIndices_; }
+	// Индекс экземпляра в списке, переданном в конструктор или setInstances: скопления переупорядочивают экземпляры
+	[[nodiscard]] const QVector<uint32_t> &getSourceIndices() const { return sourceIndices_; }
+
+	// Сдвигает экземпляры относительно позы покоя (анимация ветром), не пересобирая скопления.
+	// offsets параллельны getInstances(); границы скоплений расширяются на maxOffset
+	void applyOffsets(const glm::vec3 *offsets, float maxOffset);
+
+	// Скопление соседних листьев: непрерывный диапазон instances_, его границы и спрайты в атласе
+	struct Cluster {
+		qsizetype first;
+		qsizetype count;
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		glm::vec3 center;
+		float radius;
+		int atlasTile;
+	};
+
+	// Скопления строятся при создании объекта: листья упорядочиваются по кривой Мортона
+	// и режутся на куски по leavesPerCluster
+	static constexpr int leavesPerCluster = 128;
+	[[nodiscard]] const QVector<Cluster> &getClusters() const { return clusters; }
+
+	// Число направлений запекания вокруг вертикальной оси
+	static constexpr int impostorViews = 4;
+	static constexpr int defaultImpostorResolution = 32;
+
+	// Запекает спрайты скоплений. Скопление рисуется спрайтом,
+	// пока его диаметр на экране меньше resolution пикселей
+	void buildImpostors(int resolution = defaultImpostorResolution);
+	void clearImpostors();
+
+	[[nodiscard]] bool hasImpostors() const { return !impostorAtlas.isNull(); }
+	[[nodiscard]] const QImage &getImpostorAtlas() const { return impostorAtlas; }
+
+	// Скопления вне frustum отбрасываются. Остальные ближние попадают в nearClusters,
+	// дальние — повёрнутыми к камере квадами в billboards (только если спрайты запечены)
+	void selectClusters(const glm::mat4 &viewProj,
+	                    const Frustum &frustum,
+	                    const glm::vec3 &cameraPos,
+	                    int viewportHeight,
+	                    QVector<int> &nearClusters,
+	                    Mesh &billboards) const;
 
 	[[nodiscard]] const QImage *getTexture() const { return texture; }
 	void setTexture(const QImage *tex) { texture = tex; }
@@ -42,8 +98,23 @@ public:
 	void accept(BaseVisitor &visitor) override;
 
 private:
-	Mesh prototype_;
+	void buildClusters();
+	void rebuildTransforms();
+	void bakeCluster(const Cluster &cluster, uchar *atlasBits, qsizetype bytesPerLine) const;
+	[[nodiscard]] glm::vec4 tileRect(int tile) const;
+
+	QVector<Mesh> prototypes_;
 	QVector<Instance> instances_;
+	QVector<glm::mat4x3> modelMatrices_;
+	QVector<glm::mat3> normalMatrices_;
+	QVector<uint16_t> prototypeIndices_;
+	QVector<uint32_t> sourceIndices_;
+	float animationMargin = 0.0f;
+
+	QVector<Cluster> clusters;
+	QImage impostorAtlas;
+	int impostorResolution = 0;
+	int atlasTilesPerRow = 0;
 	const QImage *texture;
 	Lighting::Material material;
 };
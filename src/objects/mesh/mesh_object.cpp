@@ -1,6 +1,81 @@
 #include "mesh_object.h"
 #include "base_visitor.h"
+#include "mesh_simplifier.h"
+#include "task_scheduler.h"
+#include <cfloat>
+
+namespace {
+struct LodSetting {
+	float ratio;
+	float minScreenSize;
+};
+
+// Исходная сетка используется, пока дерево занимает больше 512 пикселей по высоте
+constexpr LodSetting lodSettings[] = {
+	{0.25f, 128.0f},
+	{0.06f, 0.0f},
+};
+
+constexpr float fullDetailScreenSize = 512.0f;
+}
 
 void MeshObject::accept(BaseVisitor &visitor) {
 	visitor.visit(*this);
 }
+
+void MeshObject::buildLods() {
+	lods.clear();
+	if (mesh.vertices.isEmpty())
+		return;
+
+	glm::vec3 minBound(FLT_MAX);
+	glm::vec3 maxBound(-FLT_MAX);
+	for (const Vertex &v : mesh.vertices) {
+		minBound = glm::min(minBound, v.position);
+		maxBound = glm::max(maxBound, v.position);
+	}
+
+	boundsCenter = (minBound + maxBound) * 0.5f;
+	boundsRadius = 0.0f;
+	for (const Vertex &v : mesh.vertices)
+		boundsRadius = std::max(boundsRadius, glm::length(v.position - boundsCenter));
+
+	// Уровни упрощаются из исходной сетки независимо друг от друга
+	constexpr int lodSettingCount = std::size(lodSettings);
+	Mesh simplified[lodSettingCount];
+	std::vector<uint32_t> sourceVertices[lodSettingCount];
+
+	TaskGroup group;
+	for (int i = 0; i < lodSettingCount; i++) {
+		group.run([this, &simplified, &sourceVertices, i] {
+			simplified[i] = MeshSimplifier::simplifyRatio(mesh, lodSettings[i].ratio, sourceVertices[i]);
+		});
+	}
+	group.wait();
+
+	for (int i = 0; i < lodSettingCount; i++) {
+		// Упрощение упёрлось в зафиксированные вершины — следующий уровень ничего не даст
+		const Mesh &previous = lods.isEmpty() ? mesh : lods.last().mesh;
+		if (simplified[i].triangles.size() >= previous.triangles.size() * 0.9f)
+			break;
+
+		lods.append({std::move(simplified[i]), lodSettings[i].minScreenSize, std::move(sourceVertices[i])});
+	}
+}
+
+int MeshObject::selectLodLevel(const glm::mat4 &viewProj, int viewportHeight) const {
+	if (lods.isEmpty())
+		return 0;
+
+	float screenSize = projectedSize(viewProj, position + boundsCenter, boundsRadius + boundsPadding, viewportHeight);
+
+	if (screenSize >= fullDetailScreenSize)
+		return 0;
+
+	for (int level = 0; level < lods.size(); level++) {
+		if (screenSize >= lods[level].minScreenSize)
+			return level + 1;
+	}
+
+	return lods.size();
+}
@@ -4,6 +4,8 @@
 #include "../scene_object.h"
 #include "mesh.h"
 #include <QImage>
+#include <QVector>
+#include <vector>
 
 class MeshObject : public SceneObject {
 public:
@@ -16,16 +18,55 @@ public:
 	[[nodiscard]] const Mesh &getMesh() const { return mesh; }
 	Mesh &getMesh() { return mesh; }
 
-	void setMesh(Mesh newMesh) { mesh = std::move(newMesh); }
+	void setMesh(Mesh newMesh) {
+		mesh = std::move(newMesh);
+		lods.clear();
+	}
+
+	// Цепочка упрощённых копий сетки; уровень 0 — исходная сетка
+	void buildLods();
+	[[nodiscard]] int getLodCount() const { return lods.size() + 1; }
+	[[nodiscard]] const Mesh &getLod(int level) const { return level == 0 ? mesh : lods[level - 1].mesh; }
+	Mesh &getLod(int level) { return level == 0 ? mesh : lods[level - 1].mesh; }
+
+	// Для уровня level > 0: индекс вершины исходной сетки для каждой вершины уровня
+	[[nodiscard]] const std::vector<uint32_t> &getLodSourceVertices(int level) const {
+		return lods[level - 1].sourceVertices;
+	}
+
+	// Запас ограничивающей сферы на деформацию поверх позы, в которой строились уровни (ветер)
+	void setBoundsPadding(float padding) { boundsPadding = padding; }
+
+	// Выбор уровня по размеру ограничивающей сферы на экране (в пикселях)
+	[[nodiscard]] int selectLodLevel(const glm::mat4 &viewProj, int viewportHeight) const;
+	[[nodiscard]] const Mesh &selectLod(const glm::mat4 &viewProj, int viewportHeight) const {
+		return getLod(selectLodLevel(viewProj, viewportHeight));
+	}
 
 	[[nodiscard]] const QImage* getTexture() const { return texture; }
 	void setTexture(const QImage* tex) { texture = tex; }
 
+	// Замкнутая сетка (ствол): задние грани закрыты передними и не растеризуются
+	void setBackFaceCulling(bool enabled) { backFaceCulling = enabled; }
+	[[nodiscard]] bool hasBackFaceCulling() const { return backFaceCulling; }
+
 	void accept(BaseVisitor &visitor) override;
 
 private:
+	struct Lod {
+		Mesh mesh;
+		float minScreenSize;
+		std::vector<uint32_t> sourceVertices;
+	};
+
 	Mesh mesh;
 	const QImage* texture;
+	bool backFaceCulling = false;
+
+	QVector<Lod> lods;
+	glm::vec3 boundsCenter{0.0f};
+	float boundsRadius = 0.0f;
+	float boundsPadding = 0.0f;
 };
 
 #endif //L_SYS_TREE_GENERATOR_OBJECTS_MESH_OBJECT_H
\ No newline at end of file
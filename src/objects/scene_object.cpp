@@ -1,3 +1,17 @@
 #include "scene_object.h"
+#include <limits>
 
-size_t SceneObject::nextId = 0;
\ No newline at end of file
+std::atomic<size_t> SceneObject::nextId{0};
+
+float SceneObject::projectedSize(const glm::mat4 &viewProj, const glm::vec3 &center, float radius, int viewportHeight) {
+	glm::vec4 clip = viewProj * glm::vec4(center, 1.0f);
+
+	// У перспективной проекции w зависит от положения точки, у ортографической w = 1
+	bool perspective = viewProj[0][3] != 0.0f || viewProj[1][3] != 0.0f || viewProj[2][3] != 0.0f;
+	if (perspective && clip.w <= radius)
+		return std::numeric_limits<float>::infinity();
+
+	// Масштаб по вертикали в NDC; NDC занимает 2 единицы на viewportHeight пикселей
+	glm::vec3 row(viewProj[0][1], viewProj[1][1], viewProj[2][1]);
+	return radius * glm::length(row) / clip.w * static_cast<float>(viewportHeight);
+}
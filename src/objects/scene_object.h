@@ -2,6 +2,7 @@
 #define L_SYS_TREE_GENERATOR_OBJECTS_SCENE_OBJECT_H
 
 #include <glm/glm.hpp>
+#include <atomic>
 
 class BaseVisitor;
 
@@ -9,7 +10,8 @@ class SceneObject {
 protected:
 	const size_t id;
 	glm::vec3 position{};
-	static size_t nextId;
+	// Объекты создаются и в рабочих потоках (ForestBuilder)
+	static std::atomic<size_t> nextId;
 
 public:
 	SceneObject() : id(nextId++), position(0.0f) {
@@ -23,6 +25,10 @@ public:
 	virtual void setPosition(const glm::vec3 &pos) { position = pos; }
 
 	virtual void accept(BaseVisitor &visitor) = 0;
+
+protected:
+	// Диаметр сферы на экране в пикселях; бесконечность, если камера внутри сферы
+	static float projectedSize(const glm::mat4 &viewProj, const glm::vec3 &center, float radius, int viewportHeight);
 };
 
 #endif //L_SYS_TREE_GENERATOR_OBJECTS_SCENE_OBJECT_H
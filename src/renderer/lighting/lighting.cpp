@@ -70,6 +70,21 @@ glm::vec3 Lighting::calculateSimple(
 	return glm::clamp(result, 0.0f, 1.0f);
 }
 
+glm::vec3 Lighting::calculateShadowedLight(const glm::vec3 &fragPos,
+                                           const glm::vec3 &normal,
+                                           const glm::vec3 &viewPos,
+                                           const glm::vec3 &baseColor,
+                                           const Light &light,
+                                           const Material &material,
+                                           float shadowFactor) {
+	glm::vec3 lightContribution = calculatePhong(fragPos, normal, viewPos, baseColor, light, material);
+
+	glm::vec3 ambientPart = light.ambient * material.ambient * baseColor;
+	glm::vec3 diffuseSpecularPart = lightContribution - ambientPart;
+
+	return ambientPart + diffuseSpecularPart * shadowFactor;
+}
+
 glm::vec3 Lighting::calculateMultipleLights(const glm::vec3 &fragPos,
                                             const glm::vec3 &normal,
                                             const glm::vec3 &viewPos,
@@ -79,16 +94,8 @@ glm::vec3 Lighting::calculateMultipleLights(const glm::vec3 &fragPos,
                                             float shadowFactor) {
 	glm::vec3 result(0.0f);
 
-	for (const auto &light : lights) {
-		glm::vec3 lightContribution = calculatePhong(fragPos, normal, viewPos, baseColor, light, material);
-
-		glm::vec3 ambientPart = light.ambient * material.ambient * baseColor;
-		glm::vec3 diffuseSpecularPart = lightContribution - ambientPart;
-
-		glm::vec3 shadowedDiffuseSpec = diffuseSpecularPart * shadowFactor;
-
-		result += ambientPart + shadowedDiffuseSpec;
-	}
+	for (const auto &light : lights)
+		result += calculateShadowedLight(fragPos, normal, viewPos, baseColor, light, material, shadowFactor);
 
 	return glm::clamp(result, 0.0f, 1.0f);
 }
@@ -33,6 +33,16 @@ public:
 	                                 const glm::vec3 &baseColor,
 	                                 const Light &light);
 
+	// Вклад одного источника без ограничения сверху: рассеянная часть не затеняется,
+	// диффузная и зеркальная умножаются на shadowFactor
+	static glm::vec3 calculateShadowedLight(const glm::vec3 &fragPos,
+	                                        const glm::vec3 &normal,
+	                                        const glm::vec3 &viewPos,
+	                                        const glm::vec3 &baseColor,
+	                                        const Light &light,
+	                                        const Material &material,
+	                                        float shadowFactor);
+
 	static glm::vec3 calculateMultipleLights(const glm::vec3 &fragPos,
 	                                         const glm::vec3 &normal,
 	                                         const glm::vec3 &viewPos,
@@ -2,21 +2,113 @@
 #include <glm/common.hpp>
 #include <cmath>
 #include <algorithm>
-#include "draw_visitor.h"
+#include <array>
+#include <utility>
+#include "task_scheduler.h"
+
+namespace {
+enum ClipCode : uint8_t {
+	clipNear = 1 << 0,
+	clipFar = 1 << 1,
+	clipLeft = 1 << 2,
+	clipRight = 1 << 3,
+	clipBottom = 1 << 4,
+	clipTop = 1 << 5,
+	// За запасной полосой: по x и y обрезаются только такие треугольники, остальные ограничивает плитка
+	clipGuard = 1 << 6
+};
+constexpr uint8_t clipRequired = clipNear | clipFar | clipGuard;
+
+// Ближняя плоскость совпадает с наименьшей глубиной, которую проходят пиксели
+constexpr float clipMinDepth = 0.01f;
+// Ширина запасной полосы в половинах экрана
+constexpr float guardBand = 4.0f;
+
+// Точка лежит внутри плоскости, если dot(plane, clip) >= 0
+constexpr int clipPlaneCount = 6;
+const glm::vec4 clipPlanes[clipPlaneCount] = {
+	glm::vec4(0.0f, 0.0f, 1.0f, -clipMinDepth),
+	glm::vec4(0.0f, 0.0f, -1.0f, 1.0f),
+	glm::vec4(1.0f, 0.0f, 0.0f, guardBand),
+	glm::vec4(-1.0f, 0.0f, 0.0f, guardBand),
+	glm::vec4(0.0f, 1.0f, 0.0f, guardBand),
+	glm::vec4(0.0f, -1.0f, 0.0f, guardBand)
+};
+
+// Экранные координаты вершин привязаны к сетке в 1/256 пикселя: в этих единицах площади
+// и функции рёбер целые и считаются без ошибок округления
+constexpr int subpixelBits = 8;
+constexpr int64_t subpixelOne = int64_t(1) << subpixelBits;
+constexpr int64_t halfPixel = subpixelOne / 2;
+constexpr float subpixelScale = static_cast<float>(subpixelOne);
+
+float snapToSubpixel(float v) {
+	return std::nearbyint(v * subpixelScale) * (1.0f / subpixelScale);
+}
+
+// Для привязанной координаты преобразование точное
+int64_t toFixed(float v) {
+	return static_cast<int64_t>(v * subpixelScale);
+}
+
+// Первый и последний пиксель, центр которого лежит в [min, max]
+int firstPixel(int64_t min) {
+	return static_cast<int>((min - halfPixel + subpixelOne - 1) >> subpixelBits);
+}
+
+int lastPixel(int64_t max) {
+	return static_cast<int>((max - halfPixel) >> subpixelBits);
+}
+
+// Доля канала в байт с насыщением; дробная часть отбрасывается. Сравнение с нулём первым переводит NaN в 0
+int packChannel(float value) {
+	return static_cast<int>(std::min(std::max(0.0f, value * 255.0f), 255.0f));
+}
+
+// Цвета пикселей строки переводятся в ARGB32 одним проходом без ветвлений и пишутся прямо в строку
+// изображения; пиксели без отметки written сохраняют прежнее значение
+void storePixels(const glm::vec3 *colors, const bool *written, QRgb *row, int count) {
+	for (int l = 0; l < count; l++) {
+		const QRgb packed = qRgb(packChannel(colors[l].r), packChannel(colors[l].g), packChannel(colors[l].b));
+		row[l] = written[l] ? packed : row[l];
+	}
+}
+
+struct ClipVertex {
+	glm::vec4 clip;
+	ScreenVertex vertex;
+};
+
+// До деления на w атрибуты линейны, поэтому новая вершина на ребре — обычная интерполяция
+ClipVertex clipEdge(const ClipVertex &a, const ClipVertex &b, float t) {
+	ClipVertex result = a;
+	result.clip = a.clip + (b.clip - a.clip) * t;
+	result.vertex.color = glm::mix(a.vertex.color, b.vertex.color, t);
+	result.vertex.normal = glm::mix(a.vertex.normal, b.vertex.normal, t);
+	result.vertex.worldPos = glm::mix(a.vertex.worldPos, b.vertex.worldPos, t);
+	result.vertex.texCoord = glm::mix(a.vertex.texCoord, b.vertex.texCoord, t);
+	return result;
+}
+}
 
 Rasterizer::Rasterizer(int width, int height)
 	: image(width, height, QImage::Format_RGB32),
 	  zBuffer(std::make_shared<ZBuffer>(width, height)),
 	  enableLighting(true),
-	  currentTexture(nullptr),
 	  trianglesDrawn(0),
 	  trianglesCulled(0),
-	  pixelsDrawn(0) {
+	  pixelsDrawn(0),
+	  tilesX((width + tileSize - 1) / tileSize),
+	  tilesY((height + tileSize - 1) / tileSize) {
 
 	material.ambient = glm::vec3(0.2f);
 	material.diffuse = glm::vec3(1.5f);
 	material.specular = glm::vec3(0.2f);
 	material.shininess = 16.0f;
+
+	tileBins.resize(static_cast<size_t>(tilesX) * tilesY);
+	visibilityIds.resize(static_cast<size_t>(width) * height, noTriangle);
+	visibilityWeights.resize(static_cast<size_t>(width) * height);
 }
 
 void Rasterizer::beginFrame() {
@@ -26,379 +118,930 @@ void Rasterizer::beginFrame() {
 	shadowMapWidth = 0;
 	shadowMapHeight = 0;
 	useShadows = false;
+	stateDirty = true;
 }
 
 void Rasterizer::renderMesh(const Mesh &mesh, const glm::mat4 &mvp, const glm::vec3 &cameraPos, const QImage* texture) {
-	currentTexture = texture;
+	makeRoom(mesh.vertices.size());
+	const uint32_t state = captureState(texture, cameraPos);
+	const size_t base = appendVertices(mesh.vertices.size());
+
+	// Каждая вершина преобразуется один раз за вызов, треугольники дальше ссылаются на неё по индексу
+	TaskScheduler::instance().parallelFor(0, mesh.vertices.size(), 1024, [&](qsizetype first, qsizetype last) {
+		ScreenVertex *out = frameVertices.data() + base;
+		for (qsizetype i = first; i < last; i++) {
+			const Vertex &src = mesh.vertices[i];
+			out[i].color = src.color * tint;
+			out[i].normal = src.normal;
+			out[i].worldPos = src.position;
+			out[i].texCoord = src.texCoord;
+		}
+		projectVertices(base + first, last - first, mvp);
+	});
 
-	for (const Triangle &tri : mesh.triangles) {
-		const Vertex &v0 = mesh.vertices[tri.i0];
-		const Vertex &v1 = mesh.vertices[tri.i1];
-		const Vertex &v2 = mesh.vertices[tri.i2];
+	for (const Triangle &tri : mesh.triangles)
+		binTriangle(base + tri.i0, base + tri.i1, base + tri.i2, state);
+}
+
+void Rasterizer::renderInstanced(const Mesh &prototype,
+                                 const glm::mat4x3 *models,
+                                 const glm::mat3 *normalMatrices,
+                                 qsizetype instanceCount,
+                                 const glm::mat4 &viewProj,
+                                 const glm::vec3 &cameraPos,
+                                 const QImage* texture) {
+	const qsizetype vertexCount = prototype.vertices.size();
+	if (vertexCount == 0)
+		return;
+
+	// Большие вызовы делятся на пачки, чтобы отложенные вершины не превышали бюджет кадра
+	const qsizetype batchSize = std::max<qsizetype>(1, static_cast<qsizetype>(maxBinnedVertices / 4) / vertexCount);
+	const qsizetype grain = std::max<qsizetype>(1, 1024 / vertexCount);
+
+	for (qsizetype batchBegin = 0; batchBegin < instanceCount; batchBegin += batchSize) {
+		const qsizetype count = std::min(batchSize, instanceCount - batchBegin);
+		makeRoom(count * vertexCount);
+		const uint32_t state = captureState(texture, cameraPos);
+		const size_t base = appendVertices(count * vertexCount);
+
+		TaskScheduler::instance().parallelFor(0, count, grain, [&](qsizetype first, qsizetype last) {
+			for (qsizetype i = first; i < last; i++) {
+				const glm::mat4x3 &model = models[batchBegin + i];
+				const glm::mat3 &normalMatrix = normalMatrices[batchBegin + i];
+				ScreenVertex *out = frameVertices.data() + base + i * vertexCount;
+
+				for (qsizetype v = 0; v < vertexCount; v++) {
+					const Vertex &src = prototype.vertices[v];
+					out[v].color = src.color * tint;
+					out[v].normal = glm::normalize(normalMatrix * src.normal);
+					out[v].worldPos = model * glm::vec4(src.position, 1.0f);
+					out[v].texCoord = src.texCoord;
+				}
+			}
 
-		ScreenVertex sv0 = transformVertex(v0, mvp);
-		ScreenVertex sv1 = transformVertex(v1, mvp);
-		ScreenVertex sv2 = transformVertex(v2, mvp);
+			// Вершины соседних экземпляров идут подряд, поэтому дорожки заполнены и для маленьких прототипов
+			projectVertices(base + first * vertexCount, (last - first) * vertexCount, viewProj);
+		});
 
-		drawTriangle(sv0, sv1, sv2, cameraPos);
+		for (qsizetype i = 0; i < count; i++) {
+			const uint32_t offset = static_cast<uint32_t>(base + i * vertexCount);
+			for (const Triangle &tri : prototype.triangles)
+				binTriangle(offset + tri.i0, offset + tri.i1, offset + tri.i2, state);
+		}
 	}
+}
 
-	currentTexture = nullptr;
+void Rasterizer::renderInstanced(const QVector<Mesh> &prototypes,
+                                 const uint16_t *prototypeIndices,
+                                 const glm::mat4x3 *models,
+                                 const glm::mat3 *normalMatrices,
+                                 qsizetype instanceCount,
+                                 const glm::mat4 &viewProj,
+                                 const glm::vec3 &cameraPos,
+                                 const QImage* texture) {
+	qsizetype first = 0;
+	while (first < instanceCount) {
+		qsizetype last = first + 1;
+		while (last < instanceCount && prototypeIndices[last] == prototypeIndices[first])
+			last++;
+
+		renderInstanced(prototypes[prototypeIndices[first]], models + first, normalMatrices + first,
+		                last - first, viewProj, cameraPos, texture);
+		first = last;
+	}
 }
 
-QImage Rasterizer::endFrame() {
-	qDebug() << "Frame stats: Triangles drawn:" << trianglesDrawn
-			<< "Culled:" << trianglesCulled
-			<< "Pixels drawn:" << pixelsDrawn;
+uint32_t Rasterizer::captureState(const QImage* texture, const glm::vec3 &cameraPos) {
+	if (!stateDirty && !drawStates.empty() &&
+		drawStates.back().texture == texture && drawStates.back().cameraPos == cameraPos)
+		return static_cast<uint32_t>(drawStates.size() - 1);
 
-	return image;
-}
+	uint32_t features = 0;
+	if (texture && !texture->isNull())
+		features |= featureTextured | (alphaTest ? featureAlphaTest : 0);
+	if (enableLighting && !lights.empty()) {
+		features |= featureLit | (lights.size() == 1 ? featureSingleLight : 0);
+		if (useShadows && shadowMapData && shadowMapWidth > 0 && shadowMapHeight > 0)
+			features |= featureShadowed;
+	}
 
-void Rasterizer::clear() {
-	image.fill(QColor(220, 230, 240));
-	zBuffer->clear();
-	trianglesDrawn = 0;
-	trianglesCulled = 0;
-	pixelsDrawn = 0;
+	drawStates.push_back(DrawState{
+		texture,
+		features,
+		lights,
+		material,
+		cameraPos,
+		shadowMapData,
+		shadowMapWidth,
+		shadowMapHeight,
+		lightMVP
+	});
+	stateDirty = false;
+
+	return static_cast<uint32_t>(drawStates.size() - 1);
 }
 
-glm::vec3 Rasterizer::sampleTexture(float u, float v) const {
-	if (!currentTexture || currentTexture->isNull())
-		return glm::vec3(1.0f);
-
-	u = u - std::floor(u);
-	v = v - std::floor(v);
+void Rasterizer::makeRoom(size_t vertexCount) {
+	if (!frameVertices.empty() && frameVertices.size() + vertexCount > maxBinnedVertices)
+		flush();
+}
 
-	int x = static_cast<int>(u * (currentTexture->width() - 1));
-	int y = static_cast<int>(v * (currentTexture->height() - 1));
+size_t Rasterizer::appendVertices(size_t count) {
+	const size_t base = frameVertices.size();
+	frameVertices.resize(base + count);
+	frameClip.resize(base + count);
+	frameOutcodes.resize(base + count);
+	return base;
+}
 
-	x = std::clamp(x, 0, currentTexture->width() - 1);
-	y = std::clamp(y, 0, currentTexture->height() - 1);
+void Rasterizer::binTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t state) {
+	const uint8_t code0 = frameOutcodes[i0];
+	const uint8_t code1 = frameOutcodes[i1];
+	const uint8_t code2 = frameOutcodes[i2];
 
-	QRgb pixel = currentTexture->pixel(x, y);
+	// Все три вершины за одной плоскостью пирамиды видимости
+	if (code0 & code1 & code2) {
+		trianglesCulled++;
+		return;
+	}
 
-	return glm::vec3(
-		qRed(pixel) / 255.0f,
-		qGreen(pixel) / 255.0f,
-		qBlue(pixel) / 255.0f
-	);
+	if ((code0 | code1 | code2) & clipRequired)
+		clipTriangle(i0, i1, i2, state);
+	else
+		addTriangle(i0, i1, i2, state);
 }
 
-ScreenVertex Rasterizer::transformVertex(const Vertex &v, const glm::mat4 &mvp) const {
-	glm::vec4 worldPos4 = mvp * glm::vec4(v.position, 1.0f);
+void Rasterizer::clipTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t state) {
+	// Каждая плоскость добавляет выпуклому многоугольнику не больше одной вершины
+	constexpr int maxVertices = 3 + clipPlaneCount;
+	ClipVertex buffers[2][maxVertices];
+	ClipVertex *polygon = buffers[0];
+	ClipVertex *next = buffers[1];
+
+	const uint32_t source[3] = {i0, i1, i2};
+	for (int k = 0; k < 3; k++)
+		polygon[k] = {frameClip[source[k]], frameVertices[source[k]]};
+	int count = 3;
+
+	for (const glm::vec4 &plane : clipPlanes) {
+		float distance[maxVertices];
+		int outside = 0;
+		for (int k = 0; k < count; k++) {
+			distance[k] = glm::dot(plane, polygon[k].clip);
+			outside += distance[k] < 0.0f;
+		}
 
-	if (worldPos4.w <= 0.0f)
-		return {};
+		if (outside == 0)
+			continue;
+		if (outside == count) {
+			trianglesCulled++;
+			return;
+		}
 
-	glm::vec3 clipPos = glm::vec3(worldPos4) / worldPos4.w;
+		int nextCount = 0;
+		for (int k = 0; k < count; k++) {
+			const int n = (k + 1) % count;
+			if (distance[k] >= 0.0f)
+				next[nextCount++] = polygon[k];
+			if ((distance[k] >= 0.0f) != (distance[n] >= 0.0f))
+				next[nextCount++] = clipEdge(polygon[k], polygon[n], distance[k] / (distance[k] - distance[n]));
+		}
+		std::swap(polygon, next);
+		count = nextCount;
+	}
 
-	if (clipPos.z < -0.95f || clipPos.z > 1.0f)
-		return {};
+	const float width = image.width();
+	const float height = image.height();
+	const size_t base = appendVertices(count);
+	for (int k = 0; k < count; k++) {
+		const glm::vec4 &clip = polygon[k].clip;
+		ScreenVertex &out = frameVertices[base + k];
+		out = polygon[k].vertex;
+		out.position = glm::vec2(snapToSubpixel((clip.x / clip.w * 0.5f + 0.5f) * width),
+		                         snapToSubpixel((1.0f - (clip.y / clip.w * 0.5f + 0.5f)) * height));
+		out.depth = clip.z / clip.w;
+		frameClip[base + k] = clip;
+		frameOutcodes[base + k] = 0;
+	}
 
-	if (worldPos4.w < 0.1f)
-		return {};
+	for (int k = 1; k + 1 < count; k++)
+		addTriangle(base, base + k, base + k + 1, state);
+}
 
-	int w = image.width();
-	int h = image.height();
-	glm::vec2 screenPos(
-		(clipPos.x * 0.5f + 0.5f) * w,
-		(1.0f - (clipPos.y * 0.5f + 0.5f)) * h
-	);
+void Rasterizer::addTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t state) {
+	const ScreenVertex &v0 = frameVertices[i0];
+	const ScreenVertex &v1 = frameVertices[i1];
+	const ScreenVertex &v2 = frameVertices[i2];
 
-	return ScreenVertex{
-		screenPos,
-		clipPos.z,
-		v.color,
-		v.normal,
-		v.position,
-		v.texCoord
-	};
-}
+	const int64_t x0 = toFixed(v0.position.x), y0 = toFixed(v0.position.y);
+	const int64_t x1 = toFixed(v1.position.x), y1 = toFixed(v1.position.y);
+	const int64_t x2 = toFixed(v2.position.x), y2 = toFixed(v2.position.y);
 
-void Rasterizer::drawTriangle(const ScreenVertex &v0,
-                              const ScreenVertex &v1,
-                              const ScreenVertex &v2,
-                              const glm::vec3 &cameraPos) {
-	float area2D = std::abs(
-		(v1.position.x - v0.position.x) * (v2.position.y - v0.position.y) -
-		(v2.position.x - v0.position.x) * (v1.position.y - v0.position.y)
-	);
+	// Ось y экрана направлена вниз, поэтому у лицевых граней (против часовой стрелки в NDC) площадь отрицательна
+	const int64_t area2 = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+
+	// Треугольник без площади или без центров пикселей в рамке не закрасит ни одного пикселя
+	const int minX = std::max(0, firstPixel(std::min({x0, x1, x2})));
+	const int minY = std::max(0, firstPixel(std::min({y0, y1, y2})));
+	const int maxX = std::min(image.width() - 1, lastPixel(std::max({x0, x1, x2})));
+	const int maxY = std::min(image.height() - 1, lastPixel(std::max({y0, y1, y2})));
 
-	if (area2D < 0.5f) {
+	if (area2 == 0 || (cullBackFaces && area2 > 0) || minX > maxX || minY > maxY) {
 		trianglesCulled++;
 		return;
 	}
+	trianglesDrawn++;
 
-	if (!isOnScreen(v0) && !isOnScreen(v1) && !isOnScreen(v2)) {
-		trianglesCulled++;
-		return;
+	const int tileX0 = minX / tileSize;
+	const int tileY0 = minY / tileSize;
+	const int tileX1 = maxX / tileSize;
+	const int tileY1 = maxY / tileSize;
+
+	const uint32_t index = static_cast<uint32_t>(frameTriangles.size());
+	frameTriangles.push_back({i0, i1, i2, state});
+
+	for (int ty = tileY0; ty <= tileY1; ty++) {
+		for (int tx = tileX0; tx <= tileX1; tx++)
+			tileBins[ty * tilesX + tx].push_back(index);
 	}
+}
 
-	fillTriangle(v0, v1, v2, cameraPos);
-	trianglesDrawn++;
+void Rasterizer::flush() {
+	if (!frameTriangles.empty()) {
+		std::vector<int> activeTiles;
+		for (int tile = 0; tile < static_cast<int>(tileBins.size()); tile++) {
+			if (!tileBins[tile].empty())
+				activeTiles.push_back(tile);
+		}
+
+		// Самые загруженные плитки первыми, чтобы в конце кадра не ждать одну тяжёлую плитку
+		std::stable_sort(activeTiles.begin(), activeTiles.end(), [this](int a, int b) {
+			return tileBins[a].size() > tileBins[b].size();
+		});
+
+		framePixels = reinterpret_cast<QRgb*>(image.bits());
+		frameStride = image.bytesPerLine() / static_cast<qsizetype>(sizeof(QRgb));
+
+		// Плитки раздаются по одной через общий счётчик: нагрузка по плиткам сильно неравномерна
+		TaskScheduler &scheduler = TaskScheduler::instance();
+		std::atomic<size_t> nextTile(0);
+		scheduler.parallelFor(0, scheduler.getConcurrency(), 1, [&](qsizetype, qsizetype) {
+			for (size_t i = nextTile++; i < activeTiles.size(); i = nextTile++)
+				rasterizeTile(activeTiles[i]);
+		});
+
+		framePixels = nullptr;
+	}
+
+	frameVertices.clear();
+	frameClip.clear();
+	frameOutcodes.clear();
+	frameTriangles.clear();
+	drawStates.clear();
+	stateDirty = true;
 }
 
-void Rasterizer::fillTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2, const glm::vec3& cameraPos) {
-	if (v0.position.y > v1.position.y) std::swap(v0, v1);
-	if (v0.position.y > v2.position.y) std::swap(v0, v2);
-	if (v1.position.y > v2.position.y) std::swap(v1, v2);
+void Rasterizer::rasterizeTile(int tile) {
+	const int tx = tile % tilesX;
+	const int ty = tile / tilesX;
+	const TileRect rect{
+		tx * tileSize,
+		ty * tileSize,
+		std::min(image.width(), (tx + 1) * tileSize) - 1,
+		std::min(image.height(), (ty + 1) * tileSize) - 1
+	};
 
-	float dy = v2.position.y - v0.position.y;
-	if (dy < 0.5f) return;
+	const std::vector<uint32_t> &bin = tileBins[tile];
+	int pixels = 0;
 
-	float area = std::abs(
-		(v1.position.x - v0.position.x) * (v2.position.y - v0.position.y) -
-		(v2.position.x - v0.position.x) * (v1.position.y - v0.position.y)
-	) * 0.5f;
+	if (shadingMode == ShadingMode::Visibility) {
+		for (int y = rect.minY; y <= rect.maxY; y++) {
+			uint32_t *ids = visibilityIds.data() + static_cast<size_t>(y) * image.width();
+			std::fill(ids + rect.minX, ids + rect.maxX + 1, noTriangle);
+		}
 
-	if (area < 0.1f) return;
+		for (uint32_t index : bin)
+			fillTriangle(index, drawStates[frameTriangles[index].state], rect, TilePass::Visibility);
+		pixels = resolveTile(rect);
+	} else if (depthPrepass) {
+		for (uint32_t index : bin)
+			fillTriangle(index, drawStates[frameTriangles[index].state], rect, TilePass::DepthOnly);
+		for (uint32_t index : bin)
+			pixels += fillTriangle(index, drawStates[frameTriangles[index].state], rect, TilePass::ShadeVisible);
+
+		// Освещённые пиксели помечены отрицательной глубиной, возвращаем z-буфер плитки
+		for (int y = rect.minY; y <= rect.maxY; y++) {
+			float *depthRow = zBuffer->row(y);
+			for (int x = rect.minX; x <= rect.maxX; x++)
+				depthRow[x] = std::abs(depthRow[x]);
+		}
+	} else {
+		for (uint32_t index : bin)
+			pixels += fillTriangle(index, drawStates[frameTriangles[index].state], rect, TilePass::Forward);
+	}
 
-	float invTotalHeight = 1.0f / dy;
+	pixelsDrawn += pixels;
+	tileBins[tile].clear();
+}
 
-	float upperHeight = v1.position.y - v0.position.y;
-	if (upperHeight > 0.1f) {
-		int yStart = std::max(0, (int)std::ceil(v0.position.y - 0.5f));
-		int yEnd = std::min(image.height() - 1, (int)std::floor(v1.position.y - 0.5f));
+int Rasterizer::resolveTile(const TileRect &tile) {
+	const int width = image.width();
+	int pixels = 0;
 
-		for (int y = yStart; y <= yEnd; y++) {
-			float py = y + 0.5f;
+	using PixelResolver = glm::vec3 (Rasterizer::*)(const BinnedTriangle &, const glm::vec2 &, const DrawState &) const;
+	static constexpr auto resolvers = []<size_t... F>(std::index_sequence<F...>) {
+		return std::array<PixelResolver, featureCombinations>{&Rasterizer::resolvePixel<F>...};
+	}(std::make_index_sequence<featureCombinations>());
 
-			float alpha = (py - v0.position.y) * invTotalHeight;
-			alpha = glm::clamp(alpha, 0.0f, 1.0f);
+	// Соседние пиксели обычно принадлежат одному вызову отрисовки, вариант выбирается при смене состояния
+	uint32_t currentState = ~0u;
+	PixelResolver resolve = nullptr;
 
-			float beta = (py - v0.position.y) / upperHeight;
-			beta = glm::clamp(beta, 0.0f, 1.0f);
+	glm::vec3 colors[tileSize] = {};
+	bool written[tileSize];
 
-			ScreenVertex edgeLong = interpolate(v0, v2, alpha);
-			ScreenVertex edgeShort = interpolate(v0, v1, beta);
+	for (int y = tile.minY; y <= tile.maxY; y++) {
+		const uint32_t *ids = visibilityIds.data() + static_cast<size_t>(y) * width;
+		const glm::vec2 *weights = visibilityWeights.data() + static_cast<size_t>(y) * width;
 
-			if (edgeLong.position.x > edgeShort.position.x)
-				std::swap(edgeLong, edgeShort);
+		for (int x = tile.minX; x <= tile.maxX; x++) {
+			const int l = x - tile.minX;
+			written[l] = ids[x] != noTriangle;
+			if (!written[l])
+				continue;
 
-			drawScanline(y, edgeLong, edgeShort, cameraPos);
+			const BinnedTriangle &tri = frameTriangles[ids[x]];
+			if (tri.state != currentState) {
+				currentState = tri.state;
+				resolve = genericPipeline ? &Rasterizer::resolvePixel<featureGeneric>
+				                          : resolvers[drawStates[currentState].features];
+			}
+			colors[l] = (this->*resolve)(tri, weights[x], drawStates[currentState]);
+			pixels++;
 		}
+
+		storePixels(colors, written, framePixels + y * frameStride + tile.minX, tile.maxX + 1 - tile.minX);
 	}
 
-	float lowerHeight = v2.position.y - v1.position.y;
-	if (lowerHeight > 0.1f) {
-		int yStart = std::max(0, (int)std::ceil(v1.position.y - 0.5f));
-		int yEnd = std::min(image.height() - 1, (int)std::floor(v2.position.y - 0.5f));
+	return pixels;
+}
+
+template<uint32_t Features>
+glm::vec3 Rasterizer::resolvePixel(const BinnedTriangle &tri, const glm::vec2 &weights, const DrawState &state) const {
+	const ScreenVertex pixel = blend<Features>(frameVertices[tri.i0], frameVertices[tri.i1], frameVertices[tri.i2],
+	                                           1.0f - weights.x - weights.y, weights.x, weights.y, state.features);
+	return calculateColor<Features>(pixel, state);
+}
+
+QImage Rasterizer::endFrame() {
+	flush();
+
+	qDebug() << "Frame stats: Triangles drawn:" << trianglesDrawn
+			<< "Culled:" << trianglesCulled
+			<< "Pixels drawn:" << pixelsDrawn;
+
+	return image;
+}
+
+void Rasterizer::clear() {
+	frameVertices.clear();
+	frameClip.clear();
+	frameOutcodes.clear();
+	frameTriangles.clear();
+	drawStates.clear();
+	for (auto &bin : tileBins)
+		bin.clear();
+
+	image.fill(QColor(220, 230, 240));
+	zBuffer->clear();
+	trianglesDrawn = 0;
+	trianglesCulled = 0;
+	pixelsDrawn = 0;
+}
 
-		for (int y = yStart; y <= yEnd; y++) {
-			float py = y + 0.5f;
+QRgb Rasterizer::fetchTexel(const QImage &texture, float u, float v) {
+	u = u - std::floor(u);
+	v = v - std::floor(v);
 
-			float alpha = (py - v0.position.y) * invTotalHeight;
-			alpha = glm::clamp(alpha, 0.0f, 1.0f);
+	int x = static_cast<int>(u * (texture.width() - 1));
+	int y = static_cast<int>(v * (texture.height() - 1));
 
-			float beta = (py - v1.position.y) / lowerHeight;
-			beta = glm::clamp(beta, 0.0f, 1.0f);
+	x = std::clamp(x, 0, texture.width() - 1);
+	y = std::clamp(y, 0, texture.height() - 1);
 
-			ScreenVertex edgeLong = interpolate(v0, v2, alpha);
-			ScreenVertex edgeShort = interpolate(v1, v2, beta);
+	return texture.pixel(x, y);
+}
 
-			if (edgeLong.position.x > edgeShort.position.x) {
-				std::swap(edgeLong, edgeShort);
-			}
+glm::vec3 Rasterizer::sampleTexture(const QImage* texture, float u, float v) {
+	QRgb pixel = fetchTexel(*texture, u, v);
 
-			drawScanline(y, edgeLong, edgeShort, cameraPos);
+	return glm::vec3(
+		qRed(pixel) / 255.0f,
+		qGreen(pixel) / 255.0f,
+		qBlue(pixel) / 255.0f
+	);
+}
+
+bool Rasterizer::passesAlphaTest(const glm::vec2 &texCoord, const DrawState &state) {
+	return qAlpha(fetchTexel(*state.texture, texCoord.x, texCoord.y)) >= 128;
+}
+
+void Rasterizer::projectVertices(size_t first, qsizetype count, const glm::mat4 &mvp) {
+	const float width = image.width();
+	const float height = image.height();
+
+	for (qsizetype pack = 0; pack < count; pack += vertexLanes) {
+		ScreenVertex *out = frameVertices.data() + first + pack;
+		glm::vec4 *clip = frameClip.data() + first + pack;
+		uint8_t *codes = frameOutcodes.data() + first + pack;
+		const int active = static_cast<int>(std::min<qsizetype>(vertexLanes, count - pack));
+
+		// Неполная пачка дополняется повтором последней вершины, результат для неё не записывается
+		float x[vertexLanes], y[vertexLanes], z[vertexLanes];
+		for (int l = 0; l < vertexLanes; l++) {
+			const glm::vec3 &p = out[std::min(l, active - 1)].worldPos;
+			x[l] = p.x;
+			y[l] = p.y;
+			z[l] = p.z;
+		}
+
+		// Порядок сложений как в glm: (m0 * x + m1 * y) + (m2 * z + m3)
+		float cx[vertexLanes], cy[vertexLanes], cz[vertexLanes], cw[vertexLanes];
+		float screenX[vertexLanes], screenY[vertexLanes], depth[vertexLanes];
+		uint8_t code[vertexLanes];
+		for (int l = 0; l < vertexLanes; l++) {
+			cx[l] = (mvp[0][0] * x[l] + mvp[1][0] * y[l]) + (mvp[2][0] * z[l] + mvp[3][0]);
+			cy[l] = (mvp[0][1] * x[l] + mvp[1][1] * y[l]) + (mvp[2][1] * z[l] + mvp[3][1]);
+			cz[l] = (mvp[0][2] * x[l] + mvp[1][2] * y[l]) + (mvp[2][2] * z[l] + mvp[3][2]);
+			cw[l] = (mvp[0][3] * x[l] + mvp[1][3] * y[l]) + (mvp[2][3] * z[l] + mvp[3][3]);
+
+			const float guard = guardBand * cw[l];
+			code[l] = (cz[l] < clipMinDepth * cw[l] ? clipNear : 0) |
+			          (cz[l] > cw[l] ? clipFar : 0) |
+			          (cx[l] < -cw[l] ? clipLeft : 0) |
+			          (cx[l] > cw[l] ? clipRight : 0) |
+			          (cy[l] < -cw[l] ? clipBottom : 0) |
+			          (cy[l] > cw[l] ? clipTop : 0) |
+			          (std::abs(cx[l]) > guard || std::abs(cy[l]) > guard ? clipGuard : 0);
+
+			// Для вершин за ближней плоскостью результат не используется: их треугольники обрезаются
+			screenX[l] = snapToSubpixel((cx[l] / cw[l] * 0.5f + 0.5f) * width);
+			screenY[l] = snapToSubpixel((1.0f - (cy[l] / cw[l] * 0.5f + 0.5f)) * height);
+			depth[l] = cz[l] / cw[l];
+		}
+
+		for (int l = 0; l < active; l++) {
+			out[l].position = glm::vec2(screenX[l], screenY[l]);
+			out[l].depth = depth[l];
+			clip[l] = glm::vec4(cx[l], cy[l], cz[l], cw[l]);
+			codes[l] = code[l];
 		}
 	}
 }
 
-void Rasterizer::drawScanline(int y, const ScreenVertex &left, const ScreenVertex &right, const glm::vec3 &cameraPos) {
-	if (left.position.x > right.position.x)
-		return;
+// Функция ребра E(x, y) = a * x + b * y + c неотрицательна по левую сторону от ребра from -> to
+// Коэффициенты в единицах подпикселя, значения в центрах пикселей точные
+struct Rasterizer::EdgeFunction {
+	int64_t a, b, c;
+	// Правило верхнего левого ребра: пиксель ровно на ребре закрашивает только треугольник, для которого
+	// ребро верхнее или левое, поэтому общие рёбра не закрашиваются дважды и не оставляют щелей
+	int64_t bias;
+
+	EdgeFunction() = default;
+	// Внутренность треугольника там, где функция положительна
+	EdgeFunction(int64_t fromX, int64_t fromY, int64_t toX, int64_t toY)
+		: a(fromY - toY), b(toX - fromX), c(fromX * toY - fromY * toX),
+		  bias(a > 0 || (a == 0 && b > 0) ? 0 : -1) {}
+
+	[[nodiscard]] int64_t at(int64_t x, int64_t y) const { return a * x + b * y + c; }
+};
+
+// Величина, линейная на экране: значение в начале отсчёта и приращения на пиксель
+struct Rasterizer::Gradient {
+	float value, dx, dy;
+
+	[[nodiscard]] float at(float x, float y) const { return value + dx * x + dy * y; }
+};
+
+struct Rasterizer::TriangleSetup {
+	const ScreenVertex *vertices[3];
+	// edges[i] лежит напротив вершины i, поэтому её значение пропорционально барицентрической координате
+	EdgeFunction edges[3];
+	uint32_t triangle;
+	// Вершины 1 и 2 переставлены ради положительной площади
+	bool swapped;
+
+	// Начало отсчёта — центр первого пикселя рамки треугольника в плитке: смещения не больше плитки,
+	// и сложение значения с приращениями не теряет точности
+	glm::vec2 origin;
+	// Глубина NDC линейна на экране, остальные атрибуты линейны после деления на w
+	Gradient depth;
+	Gradient invW;
+	float minDepth, maxDepth;
+	float minInvW, maxInvW;
+	// Барицентрические координаты вершин 1 и 2, делённые на w
+	Gradient bary[2];
+	Gradient color[3];
+	Gradient texCoord[2];
+	Gradient normal[3];
+	Gradient worldPos[3];
+};
+
+int Rasterizer::fillTriangle(uint32_t triangle, const DrawState &state, const TileRect &tile, TilePass pass) {
+	const BinnedTriangle &tri = frameTriangles[triangle];
+	const ScreenVertex &v0 = frameVertices[tri.i0];
+	const ScreenVertex &v1 = frameVertices[tri.i1];
+	const ScreenVertex &v2 = frameVertices[tri.i2];
+
+	TriangleSetup setup;
+	setup.vertices[0] = &v0;
+	setup.vertices[1] = &v1;
+	setup.vertices[2] = &v2;
+	setup.triangle = triangle;
+	setup.swapped = false;
+
+	int64_t x[3] = {toFixed(v0.position.x), toFixed(v1.position.x), toFixed(v2.position.x)};
+	int64_t y[3] = {toFixed(v0.position.y), toFixed(v1.position.y), toFixed(v2.position.y)};
+	const int64_t area2 = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area2 == 0)
+		return 0;
+
+	const int minX = std::max(tile.minX, firstPixel(std::min({x[0], x[1], x[2]})));
+	const int minY = std::max(tile.minY, firstPixel(std::min({y[0], y[1], y[2]})));
+	const int maxX = std::min(tile.maxX, lastPixel(std::max({x[0], x[1], x[2]})));
+	const int maxY = std::min(tile.maxY, lastPixel(std::max({y[0], y[1], y[2]})));
+	if (minX > maxX || minY > maxY)
+		return 0;
+
+	// Глубина пикселя ограничена глубинами вершин, поэтому не меньше наименьшей из них.
+	// После предварительного прохода освещаются пиксели с равной глубиной, поэтому там сравнение нестрогое
+	const float nearest = std::min({v0.depth, v1.depth, v2.depth});
+	const bool inclusive = pass == TilePass::ShadeVisible;
+	auto occluded = [&](int bx, int by) {
+		const float farthest = zBuffer->blockMax(bx / blockSize, by / blockSize);
+		return inclusive ? nearest > farthest : nearest >= farthest;
+	};
 
-	float dx = right.position.x - left.position.x;
+	// Блоки выровнены по сетке плитки
+	const int blockX0 = tile.minX + ((minX - tile.minX) & ~(blockSize - 1));
+	const int blockY0 = tile.minY + ((minY - tile.minY) & ~(blockSize - 1));
 
-	if (dx < 0.1f) {
-		int x = (int)(left.position.x + 0.5f);
-		if (x >= 0 && x < image.width()) {
-			if (zBuffer->testAndSet(x, y, left.depth)) {
-				QColor color = calculateColor(left, cameraPos);
-				image.setPixel(x, y, color.rgb());
-				pixelsDrawn++;
-			}
-		}
-		return;
+	// Перекрытый треугольник стоит одной проверки своей рамки
+	bool visible = false;
+	for (int by = blockY0; by <= maxY && !visible; by += blockSize) {
+		for (int bx = blockX0; bx <= maxX && !visible; bx += blockSize)
+			visible = !occluded(bx, by);
+	}
+	if (!visible)
+		return 0;
+
+	// Обход против часовой стрелки на экране, чтобы внутренность была там, где все функции рёбер положительны
+	uint32_t source[3] = {tri.i0, tri.i1, tri.i2};
+	if (area2 < 0) {
+		std::swap(setup.vertices[1], setup.vertices[2]);
+		std::swap(source[1], source[2]);
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		setup.swapped = true;
 	}
 
-	int xStart = std::max(0, static_cast<int>(std::floor(left.position.x + 0.5f)));
-	int xEnd = std::min(image.width() - 1, static_cast<int>(std::floor(right.position.x + 0.5f)));
+	// Производные барицентрических координат по экрану: функция ребра растёт на a за подпиксель
+	const double scale = static_cast<double>(subpixelOne) / static_cast<double>(std::abs(area2));
+	double gradientX[3], gradientY[3], invW[3];
+	for (int i = 0; i < 3; i++) {
+		const int from = (i + 1) % 3;
+		const int to = (i + 2) % 3;
+		setup.edges[i] = EdgeFunction(x[from], y[from], x[to], y[to]);
+		gradientX[i] = setup.edges[i].a * scale;
+		gradientY[i] = setup.edges[i].b * scale;
+		invW[i] = 1.0 / frameClip[source[i]].w;
+	}
 
-	float invDx = 1.0f / dx;
-	QRgb* scanline = reinterpret_cast<QRgb*>(image.scanLine(y));
+	setup.origin = glm::vec2(minX + 0.5f, minY + 0.5f);
+	const glm::vec2 &first = setup.vertices[0]->position;
+	const double offsetX = static_cast<double>(setup.origin.x) - first.x;
+	const double offsetY = static_cast<double>(setup.origin.y) - first.y;
+	auto gradient = [&](double q0, double q1, double q2) {
+		const double dx = gradientX[0] * q0 + gradientX[1] * q1 + gradientX[2] * q2;
+		const double dy = gradientY[0] * q0 + gradientY[1] * q1 + gradientY[2] * q2;
+		return Gradient{static_cast<float>(q0 + dx * offsetX + dy * offsetY), static_cast<float>(dx), static_cast<float>(dy)};
+	};
+	// Атрибут, делённый на w, для компоненты component вершинного поля field
+	auto perspective = [&](auto field, int component) {
+		return gradient((setup.vertices[0]->*field)[component] * invW[0],
+		                (setup.vertices[1]->*field)[component] * invW[1],
+		                (setup.vertices[2]->*field)[component] * invW[2]);
+	};
 
-	for (int x = xStart; x <= xEnd; x++) {
-		float px = x + 0.5f;
-		float t = (px - left.position.x) * invDx;
-		t = glm::clamp(t, 0.0f, 1.0f);
+	const ScreenVertex &a = *setup.vertices[0];
+	const ScreenVertex &b = *setup.vertices[1];
+	const ScreenVertex &c = *setup.vertices[2];
+	setup.depth = gradient(a.depth, b.depth, c.depth);
+	setup.minDepth = nearest;
+	setup.maxDepth = std::max({a.depth, b.depth, c.depth});
+	setup.invW = gradient(invW[0], invW[1], invW[2]);
+	setup.minInvW = static_cast<float>(std::min({invW[0], invW[1], invW[2]}));
+	setup.maxInvW = static_cast<float>(std::max({invW[0], invW[1], invW[2]}));
+
+	// Без освещения пикселя от состояния нужен только тест альфы
+	const bool shading = pass == TilePass::Forward || pass == TilePass::ShadeVisible;
+	const uint32_t features = shading ? state.features : state.features & featureAlphaTest;
+
+	if (pass == TilePass::Visibility) {
+		setup.bary[0] = gradient(0.0, invW[1], 0.0);
+		setup.bary[1] = gradient(0.0, 0.0, invW[2]);
+	}
+	for (int i = 0; shading && i < 3; i++)
+		setup.color[i] = perspective(&ScreenVertex::color, i);
+	for (int i = 0; (features & (featureTextured | featureAlphaTest)) && i < 2; i++)
+		setup.texCoord[i] = perspective(&ScreenVertex::texCoord, i);
+	for (int i = 0; (features & featureLit) && i < 3; i++) {
+		setup.normal[i] = perspective(&ScreenVertex::normal, i);
+		setup.worldPos[i] = perspective(&ScreenVertex::worldPos, i);
+	}
+
+	using BlockRasterizer = int (Rasterizer::*)(const TriangleSetup &, int, int, bool,
+	                                            const DrawState &, const TileRect &, TilePass);
+	static constexpr auto blockRasterizers = []<size_t... F>(std::index_sequence<F...>) {
+		return std::array<BlockRasterizer, featureCombinations>{&Rasterizer::rasterizeBlock<F>...};
+	}(std::make_index_sequence<featureCombinations>());
+	const BlockRasterizer rasterize = genericPipeline ? &Rasterizer::rasterizeBlock<featureGeneric>
+	                                                  : blockRasterizers[features];
 
-		ScreenVertex pixel = interpolate(left, right, t);
+	int pixels = 0;
 
-		if (pixel.depth >= 0.0f && pixel.depth <= 1.0f) {
-			if (pixel.depth < 0.01f)
+	for (int by = blockY0; by <= maxY; by += blockSize) {
+		for (int bx = blockX0; bx <= maxX; bx += blockSize) {
+			if (occluded(bx, by))
 				continue;
 
-			if (zBuffer->testAndSet(x, y, pixel.depth)) {
-				QColor color = calculateColor(pixel, cameraPos);
-				scanline[x] = color.rgb();
-				pixelsDrawn++;
+			// Функция ребра линейна, поэтому её крайние значения на блоке достигаются в угловых пикселях
+			const int64_t x0 = (int64_t(bx) << subpixelBits) + halfPixel;
+			const int64_t y0 = (int64_t(by) << subpixelBits) + halfPixel;
+			const int64_t x1 = x0 + (blockSize - 1) * subpixelOne;
+			const int64_t y1 = y0 + (blockSize - 1) * subpixelOne;
+
+			bool rejected = false;
+			bool covered = true;
+			for (const EdgeFunction &edge : setup.edges) {
+				const int64_t c00 = edge.at(x0, y0) + edge.bias;
+				const int64_t c10 = edge.at(x1, y0) + edge.bias;
+				const int64_t c01 = edge.at(x0, y1) + edge.bias;
+				const int64_t c11 = edge.at(x1, y1) + edge.bias;
+				rejected = rejected || std::max({c00, c10, c01, c11}) < 0;
+				covered = covered && std::min({c00, c10, c01, c11}) >= 0;
 			}
+
+			if (!rejected)
+				pixels += (this->*rasterize)(setup, bx, by, covered, state, tile, pass);
 		}
 	}
-}
 
-ScreenVertex Rasterizer::interpolate(const ScreenVertex &v0, const ScreenVertex &v1, float t) const {
-	ScreenVertex result;
-	float s = 1.0f - t;
-
-	result.position = v0.position * s + v1.position * t;
+	return pixels;
+}
 
-	float z0 = v0.depth;
-	float z1 = v1.depth;
+template<uint32_t Features>
+int Rasterizer::rasterizeBlock(const TriangleSetup &setup,
+                               int blockX,
+                               int blockY,
+                               bool covered,
+                               const DrawState &state,
+                               const TileRect &tile,
+                               TilePass pass) {
+	const int columns = std::min(blockSize, tile.maxX + 1 - blockX);
+	const int rowEnd = std::min(blockY + blockSize, tile.maxY + 1);
+	const EdgeFunction *edges = setup.edges;
+	const bool writesDepth = pass != TilePass::ShadeVisible;
+	const bool shading = pass == TilePass::Forward || pass == TilePass::ShadeVisible;
+	int pixels = 0;
+	bool depthWritten = false;
+	// Цвета строки упаковываются все сразу, неосвещённые дорожки хранят прежние значения и не записываются
+	glm::vec3 colors[blockSize] = {};
+
+	const int64_t blockStartX = (int64_t(blockX) << subpixelBits) + halfPixel;
+	const int64_t step0 = edges[0].a * subpixelOne;
+	const int64_t step1 = edges[1].a * subpixelOne;
+	const int64_t step2 = edges[2].a * subpixelOne;
+	const float startX = blockX + 0.5f - setup.origin.x;
+
+	for (int y = blockY; y < rowEnd; y++) {
+		const float py = y + 0.5f;
+		const float localY = py - setup.origin.y;
+		const int64_t rowY = (int64_t(y) << subpixelBits) + halfPixel;
+		const int64_t row0 = edges[0].at(blockStartX, rowY);
+		const int64_t row1 = edges[1].at(blockStartX, rowY);
+		const int64_t row2 = edges[2].at(blockStartX, rowY);
+		const float depthStart = setup.depth.at(startX, localY);
+		const float invWStart = setup.invW.at(startX, localY);
+
+		float *depthRow = zBuffer->row(y) + blockX;
+		QRgb *colorRow = framePixels + y * frameStride + blockX;
+		const size_t visibilityRow = static_cast<size_t>(y) * image.width() + blockX;
+		uint32_t *idRow = visibilityIds.data() + visibilityRow;
+		glm::vec2 *weightRow = visibilityWeights.data() + visibilityRow;
+
+		// Покрытие, глубина и 1/w строки блока считаются сразу для всех дорожек, по одному сложению на величину.
+		// Ограничение диапазоном вершин убирает ошибку округления у тонких треугольников
+		float depth[blockSize], invW[blockSize];
+		bool inside[blockSize];
+		bool shaded[blockSize] = {};
+		for (int l = 0; l < blockSize; l++) {
+			const int64_t edge0 = row0 + step0 * l;
+			const int64_t edge1 = row1 + step1 * l;
+			const int64_t edge2 = row2 + step2 * l;
+			inside[l] = covered || (edge0 + edges[0].bias >= 0 && edge1 + edges[1].bias >= 0 && edge2 + edges[2].bias >= 0);
+			depth[l] = std::clamp(depthStart + setup.depth.dx * l, setup.minDepth, setup.maxDepth);
+			invW[l] = std::clamp(invWStart + setup.invW.dx * l, setup.minInvW, setup.maxInvW);
+		}
 
-	if (z0 < 0.0001f) z0 = 0.0001f;
-	if (z1 < 0.0001f) z1 = 0.0001f;
+		for (int l = 0; l < columns; l++) {
+			if (!inside[l] || !(depth[l] >= 0.01f && depth[l] <= 1.0f))
+				continue;
+			if (writesDepth ? depth[l] >= depthRow[l] : depth[l] > depthRow[l])
+				continue;
 
-	float invZ0 = 1.0f / z0;
-	float invZ1 = 1.0f / z1;
-	float invZ = invZ0 * s + invZ1 * t;
+			// Одно деление на пиксель, дальше атрибуты — произведения
+			const float localX = startX + l;
+			const float w = 1.0f / invW[l];
 
-	result.depth = 1.0f / invZ;
+			if (hasFeature<Features>(featureAlphaTest, state.features)) {
+				const glm::vec2 texCoord(setup.texCoord[0].at(localX, localY), setup.texCoord[1].at(localX, localY));
+				if (!passesAlphaTest(texCoord * w, state))
+					continue;
+			}
 
-	float w0 = invZ0 * s;
-	float w1 = invZ1 * t;
-	float wSum = w0 + w1;
+			if (writesDepth) {
+				depthRow[l] = depth[l];
+				depthWritten = true;
+			}
 
-	if (wSum > 0.0001f) {
-		w0 /= wSum;
-		w1 /= wSum;
+			if (pass == TilePass::DepthOnly)
+				continue;
 
-		result.color = v0.color * w0 + v1.color * w1;
-		result.normal = v0.normal * w0 + v1.normal * w1;
-		result.worldPos = v0.worldPos * w0 + v1.worldPos * w1;
-		result.texCoord = v0.texCoord * w0 + v1.texCoord * w1;
+			if (pass == TilePass::Visibility) {
+				// Веса хранятся для вершин треугольника в исходном порядке
+				const float b1 = setup.bary[0].at(localX, localY) * w;
+				const float b2 = setup.bary[1].at(localX, localY) * w;
+				idRow[l] = setup.triangle;
+				weightRow[l] = setup.swapped ? glm::vec2(b2, b1) : glm::vec2(b1, b2);
+			} else {
+				ScreenVertex pixel = interpolate<Features>(setup, localX, localY, w, state.features);
+				pixel.position = glm::vec2(blockX + l + 0.5f, py);
+				pixel.depth = depth[l];
+				colors[l] = calculateColor<Features>(pixel, state);
+				shaded[l] = true;
+				pixels++;
+
+				// Из треугольников с равной глубиной, как и без предварительного прохода, побеждает первый:
+				// отрицательная глубина не пропускает следующие до конца прохода
+				if (pass == TilePass::ShadeVisible)
+					depthRow[l] = -depth[l];
+			}
+		}
 
-		float normalLen = glm::length(result.normal);
-		if (normalLen > 0.0001f)
-			result.normal /= normalLen;
-		else
-			result.normal = glm::vec3(0, 1, 0);
-	} else {
-		result.color = v0.color * s + v1.color * t;
-		result.normal = glm::normalize(v0.normal * s + v1.normal * t);
-		result.worldPos = v0.worldPos * s + v1.worldPos * t;
-		result.texCoord = v0.texCoord * s + v1.texCoord * t;
+		if (shading)
+			storePixels(colors, shaded, colorRow, columns);
 	}
 
-	return result;
+	if (depthWritten)
+		zBuffer->updateBlock(blockX / blockSize, blockY / blockSize);
+
+	return pixels;
 }
 
-QColor Rasterizer::calculateColor(const ScreenVertex &pixel, const glm::vec3 &cameraPos) const {
-	glm::vec3 textureColor = sampleTexture(pixel.texCoord.x, pixel.texCoord.y);
+template<uint32_t Features>
+ScreenVertex Rasterizer::interpolate(const TriangleSetup &setup, float x, float y, float w, uint32_t stateFeatures) {
+	ScreenVertex pixel;
+	pixel.color = glm::vec3(setup.color[0].at(x, y), setup.color[1].at(x, y), setup.color[2].at(x, y)) * w;
 
-	glm::vec3 baseColor = pixel.color * textureColor;
+	if (hasFeature<Features>(featureTextured, stateFeatures))
+		pixel.texCoord = glm::vec2(setup.texCoord[0].at(x, y), setup.texCoord[1].at(x, y)) * w;
 
-	glm::vec3 finalColor;
+	// Нормаль нормируется при освещении, поэтому множитель w ей не нужен
+	if (hasFeature<Features>(featureLit, stateFeatures)) {
+		pixel.normal = glm::vec3(setup.normal[0].at(x, y), setup.normal[1].at(x, y), setup.normal[2].at(x, y));
+		pixel.worldPos = glm::vec3(setup.worldPos[0].at(x, y), setup.worldPos[1].at(x, y), setup.worldPos[2].at(x, y)) * w;
+	}
 
-	if (enableLighting && !lights.empty()) {
-		glm::vec3 normal = pixel.normal;
-		float normalLength = glm::length(normal);
-		if (normalLength < 0.001f)
-			normal = glm::vec3(0, 1, 0);
-		else
-			normal /= normalLength;
+	return pixel;
+}
 
-		float shadowFactor = 1.0f;
+template<uint32_t Features>
+ScreenVertex Rasterizer::blend(const ScreenVertex &a, const ScreenVertex &b, const ScreenVertex &c,
+                               float w0, float w1, float w2, uint32_t stateFeatures) {
+	ScreenVertex result;
+	result.color = a.color * w0 + b.color * w1 + c.color * w2;
 
-		if (useShadows && shadowMapData != nullptr && shadowMapWidth > 0 && shadowMapHeight > 0) {
-			glm::vec4 lightSpacePos = lightMVP * glm::vec4(pixel.worldPos, 1.0f);
+	if (hasFeature<Features>(featureTextured, stateFeatures))
+		result.texCoord = a.texCoord * w0 + b.texCoord * w1 + c.texCoord * w2;
 
-			if (lightSpacePos.w > 0.001f) {
-				glm::vec3 ndcCoords = glm::vec3(lightSpacePos) / lightSpacePos.w;
+	if (hasFeature<Features>(featureLit, stateFeatures)) {
+		result.worldPos = a.worldPos * w0 + b.worldPos * w1 + c.worldPos * w2;
 
-				glm::vec3 shadowCoords;
-				shadowCoords.x = ndcCoords.x * 0.5f + 0.5f;
-				float ndcYNormalized = ndcCoords.y * 0.5f + 0.5f;
-				shadowCoords.y = 1.0f - ndcYNormalized;
-				shadowCoords.z = ndcCoords.z * 0.5f + 0.5f;
+		glm::vec3 normal = a.normal * w0 + b.normal * w1 + c.normal * w2;
+		float normalLen = glm::length(normal);
+		result.normal = normalLen > 0.0001f ? normal / normalLen : glm::vec3(0, 1, 0);
+	}
 
-				if (shadowCoords.x >= 0.0f && shadowCoords.x <= 1.0f &&
-					shadowCoords.y >= 0.0f && shadowCoords.y <= 1.0f &&
-					shadowCoords.z >= 0.0f && shadowCoords.z <= 1.0f) {
+	return result;
+}
 
-					float shadow = 0.0f;
-					int samples = 0;
+float Rasterizer::shadowFactor(const glm::vec3 &worldPos, const DrawState &state) {
+	glm::vec4 lightSpacePos = state.lightMVP * glm::vec4(worldPos, 1.0f);
+	if (lightSpacePos.w <= 0.001f)
+		return 1.0f;
 
-					int filterSize = 3;
-					float texelSize = 1.0f / static_cast<float>(shadowMapWidth);
+	glm::vec3 ndcCoords = glm::vec3(lightSpacePos) / lightSpacePos.w;
 
-					for (int x = -filterSize/2; x <= filterSize/2; ++x) {
-						for (int y = -filterSize/2; y <= filterSize/2; ++y) {
-							float sampleX = shadowCoords.x + x * texelSize;
-							float sampleY = shadowCoords.y + y * texelSize;
+	glm::vec3 shadowCoords;
+	shadowCoords.x = ndcCoords.x * 0.5f + 0.5f;
+	float ndcYNormalized = ndcCoords.y * 0.5f + 0.5f;
+	shadowCoords.y = 1.0f - ndcYNormalized;
+	shadowCoords.z = ndcCoords.z * 0.5f + 0.5f;
 
-							if (sampleX >= 0.0f && sampleX <= 1.0f &&
-								sampleY >= 0.0f && sampleY <= 1.0f) {
+	if (shadowCoords.x < 0.0f || shadowCoords.x > 1.0f ||
+		shadowCoords.y < 0.0f || shadowCoords.y > 1.0f ||
+		shadowCoords.z < 0.0f || shadowCoords.z > 1.0f)
+		return 1.0f;
 
-								int shadowX = static_cast<int>(std::round(sampleX * (shadowMapWidth - 1)));
-								int shadowY = static_cast<int>(std::round(sampleY * (shadowMapHeight - 1)));
+	float shadow = 0.0f;
+	int samples = 0;
 
-								shadowX = std::clamp(shadowX, 0, shadowMapWidth - 1);
-								shadowY = std::clamp(shadowY, 0, shadowMapHeight - 1);
+	int filterSize = 3;
+	float texelSize = 1.0f / static_cast<float>(state.shadowMapWidth);
 
-								int shadowIdx = shadowY * shadowMapWidth + shadowX;
-								int maxIdx = shadowMapWidth * shadowMapHeight;
+	for (int x = -filterSize/2; x <= filterSize/2; ++x) {
+		for (int y = -filterSize/2; y <= filterSize/2; ++y) {
+			float sampleX = shadowCoords.x + x * texelSize;
+			float sampleY = shadowCoords.y + y * texelSize;
 
-								if (shadowIdx >= 0 && shadowIdx < maxIdx && shadowMapData != nullptr) {
-									float shadowDepth = shadowMapData[shadowIdx];
-									float fragmentDepth = shadowCoords.z;
+			if (sampleX < 0.0f || sampleX > 1.0f || sampleY < 0.0f || sampleY > 1.0f)
+				continue;
 
-									float bias = 0.001f;
+			int shadowX = static_cast<int>(std::round(sampleX * (state.shadowMapWidth - 1)));
+			int shadowY = static_cast<int>(std::round(sampleY * (state.shadowMapHeight - 1)));
 
-									bool inShadow = fragmentDepth > shadowDepth + bias;
+			shadowX = std::clamp(shadowX, 0, state.shadowMapWidth - 1);
+			shadowY = std::clamp(shadowY, 0, state.shadowMapHeight - 1);
 
-									if (inShadow) {
-										shadow += 1.0f;
-									}
-									samples++;
-								}
-							}
-						}
-					}
+			float shadowDepth = state.shadowMapData[shadowY * state.shadowMapWidth + shadowX];
+			float bias = 0.001f;
 
-					if (samples > 0) {
-						float shadowAmount = shadow / static_cast<float>(samples);
-						shadowFactor = 1.0f - shadowAmount * 0.8f;
-					}
-				}
-			}
+			if (shadowCoords.z > shadowDepth + bias)
+				shadow += 1.0f;
+			samples++;
 		}
+	}
 
-		finalColor = Lighting::calculateMultipleLights(
-			pixel.worldPos,
-			normal,
-			cameraPos,
-			baseColor,
-			lights,
-			material,
-			shadowFactor
-		);
-	} else
-		finalColor = baseColor;
-
-	return QColor(
-		std::clamp(static_cast<int>(finalColor.r * 255), 0, 255),
-		std::clamp(static_cast<int>(finalColor.g * 255), 0, 255),
-		std::clamp(static_cast<int>(finalColor.b * 255), 0, 255)
-	);
+	if (samples == 0)
+		return 1.0f;
+
+	float shadowAmount = shadow / static_cast<float>(samples);
+	return 1.0f - shadowAmount * 0.8f;
 }
 
-bool Rasterizer::isOnScreen(const ScreenVertex &sv) const {
-	return sv.position.x >= -100 && sv.position.x < image.width() + 100 &&
-			sv.position.y >= -100 && sv.position.y < image.height() + 100 &&
-			sv.depth >= 0 && sv.depth <= 1;
+template<uint32_t Features>
+glm::vec3 Rasterizer::calculateColor(const ScreenVertex &pixel, const DrawState &state) {
+	glm::vec3 baseColor = pixel.color;
+	if (hasFeature<Features>(featureTextured, state.features))
+		baseColor *= sampleTexture(state.texture, pixel.texCoord.x, pixel.texCoord.y);
+
+	glm::vec3 finalColor = baseColor;
+
+	if (hasFeature<Features>(featureLit, state.features)) {
+		glm::vec3 normal = pixel.normal;
+		float normalLength = glm::length(normal);
+		if (normalLength < 0.001f)
+			normal = glm::vec3(0, 1, 0);
+		else
+			normal /= normalLength;
+
+		float shadow = 1.0f;
+		if (hasFeature<Features>(featureShadowed, state.features))
+			shadow = shadowFactor(pixel.worldPos, state);
+
+		if (hasFeature<Features>(featureSingleLight, state.features)) {
+			finalColor = glm::clamp(Lighting::calculateShadowedLight(pixel.worldPos,
+			                                                         normal,
+			                                                         state.cameraPos,
+			                                                         baseColor,
+			                                                         state.lights.front(),
+			                                                         state.material,
+			                                                         shadow), 0.0f, 1.0f);
+		} else {
+			finalColor = Lighting::calculateMultipleLights(
+				pixel.worldPos,
+				normal,
+				state.cameraPos,
+				baseColor,
+				state.lights,
+				state.material,
+				shadow
+			);
+		}
+	}
+
+	return finalColor;
 }
 
 void Rasterizer::setShadowMap(const float *data, int w, int h, const glm::mat4 &mvp) {
@@ -407,22 +1050,27 @@ void Rasterizer::setShadowMap(const float *data, int w, int h, const glm::mat4 &
 	shadowMapHeight = h;
 	lightMVP = mvp;
 	useShadows = data != nullptr;
+	stateDirty = true;
 }
 
 void Rasterizer::setLightingEnabled(bool enabled) {
 	enableLighting = enabled;
+	stateDirty = true;
 }
 
 void Rasterizer::addLight(const Light &light) {
 	lights.push_back(light);
+	stateDirty = true;
 }
 
 void Rasterizer::clearLights() {
 	lights.clear();
+	stateDirty = true;
 }
 
 void Rasterizer::setMaterial(const Lighting::Material &mat) {
 	material = mat;
+	stateDirty = true;
 }
 
 int Rasterizer::getWidth() const {
@@ -438,4 +1086,5 @@ void Rasterizer::clearShadowMap() {
 	shadowMapWidth = 0;
 	shadowMapHeight = 0;
 	useShadows = false;
+	stateDirty = true;
 }
\ No newline at end of file
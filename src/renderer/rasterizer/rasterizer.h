@@ -11,8 +11,6 @@
 #include "lighting.h"
 #include <atomic>
 #include <vector>
-#include <thread>
-#include <mutex>
 #include <limits>
 
 struct ScreenVertex {
@@ -35,14 +33,47 @@ struct ScreenVertex {
 		  worldPos(worldPos), texCoord(texCoord) {}
 };
 
+// Растеризатор с сортировкой в середине конвейера: вызовы отрисовки только проецируют вершины
+// и раскладывают треугольники по плиткам экрана, а плитки растеризуются и освещаются параллельно
+// в flush(). Каждая плитка пишет только в свою область изображения и z-буфера
 class Rasterizer {
 public:
+	// Forward освещает каждый пиксель, прошедший тест глубины. Visibility сначала находит
+	// для пикселей плитки видимый треугольник и его веса, а затем освещает каждый пиксель один раз
+	enum class ShadingMode {
+		Forward,
+		Visibility
+	};
+
 	Rasterizer(int width, int height);
 
 	void beginFrame();
 
 	void renderMesh(const Mesh &mesh, const glm::mat4 &mvp, const glm::vec3 &cameraPos, const QImage* texture = nullptr);
 
+	// Прототип проецируется через матрицу каждого экземпляра во внутренний буфер, без копии сетки
+	void renderInstanced(const Mesh &prototype,
+	                     const glm::mat4x3 *models,
+	                     const glm::mat3 *normalMatrices,
+	                     qsizetype instanceCount,
+	                     const glm::mat4 &viewProj,
+	                     const glm::vec3 &cameraPos,
+	                     const QImage* texture = nullptr);
+
+	// Экземпляры нескольких прототипов: подряд идущие экземпляры одной сетки рисуются одним вызовом
+	void renderInstanced(const QVector<Mesh> &prototypes,
+	                     const uint16_t *prototypeIndices,
+	                     const glm::mat4x3 *models,
+	                     const glm::mat3 *normalMatrices,
+	                     qsizetype instanceCount,
+	                     const glm::mat4 &viewProj,
+	                     const glm::vec3 &cameraPos,
+	                     const QImage* texture = nullptr);
+
+	// Растеризует накопленные треугольники; endFrame вызывает его сам.
+	// Текстуры и карта теней должны жить до сброса, сетки можно освобождать сразу после вызова
+	void flush();
+
 	QImage endFrame();
 
 	void setLightingEnabled(bool enabled);
@@ -50,6 +81,33 @@ public:
 	void clearLights();
 	void setMaterial(const Lighting::Material &mat);
 
+	// Пиксели с альфой текстуры меньше 0.5 отбрасываются до теста глубины
+	void setAlphaTest(bool enabled) {
+		alphaTest = enabled;
+		stateDirty = true;
+	}
+
+	// Треугольники, повёрнутые к камере обратной стороной, отбрасываются при раскладке по плиткам;
+	// включается для замкнутых сеток, у которых задние грани всё равно закрыты передними
+	void setBackFaceCulling(bool enabled) { cullBackFaces = enabled; }
+	[[nodiscard]] bool isBackFaceCullingEnabled() const { return cullBackFaces; }
+
+	void setShadingMode(ShadingMode mode) { shadingMode = mode; }
+	[[nodiscard]] ShadingMode getShadingMode() const { return shadingMode; }
+
+	// В режиме Forward плитка сначала проходится только по глубине: z-буфер и его блоки заполняются
+	// до освещения, и освещаются только пиксели, глубина которых совпала с итоговой
+	void setDepthPrepass(bool enabled) { depthPrepass = enabled; }
+	[[nodiscard]] bool isDepthPrepassEnabled() const { return depthPrepass; }
+
+	// Множитель цвета вершин для следующих вызовов; экземпляры леса задают свой оттенок
+	void setTint(const glm::vec3 &value) { tint = value; }
+
+	// Для измерений: все вызовы идут через общий вариант конвейера пикселя, который проверяет
+	// возможности состояния во время выполнения, вместо варианта, собранного под набор возможностей
+	void setGenericPipeline(bool enabled) { genericPipeline = enabled; }
+	[[nodiscard]] bool isGenericPipelineEnabled() const { return genericPipeline; }
+
 	int getWidth() const;
 	int getHeight() const;
 
@@ -58,11 +116,70 @@ public:
 	}
 
 	void setShadowMap(const float* data, int w, int h, const glm::mat4& mvp);
-	void enableShadows(bool enable) { useShadows = enable; }
+	void enableShadows(bool enable) {
+		useShadows = enable;
+		stateDirty = true;
+	}
 
 	void clearShadowMap();
 
 private:
+	// Состояние конвейера на момент вызова отрисовки; треугольники кадра ссылаются на него индексом
+	struct DrawState {
+		const QImage* texture;
+		// Набор возможностей конвейера пикселя, см. feature*
+		uint32_t features;
+		std::vector<Light> lights;
+		Lighting::Material material;
+		glm::vec3 cameraPos;
+
+		const float* shadowMapData;
+		int shadowMapWidth;
+		int shadowMapHeight;
+		glm::mat4 lightMVP;
+	};
+
+	struct BinnedTriangle {
+		uint32_t i0, i1, i2;
+		uint32_t state;
+	};
+
+	// Включительные границы области в пикселях
+	struct TileRect {
+		int minX, minY, maxX, maxY;
+	};
+
+	struct EdgeFunction;
+	struct Gradient;
+	struct TriangleSetup;
+
+	// Возможности конвейера пикселя. Обход блока, интерполяция и освещение собираются для каждого набора
+	// отдельно, набор вычисляется один раз при захвате состояния, и внутренние циклы не проверяют
+	// текстуру, источники света и карту теней. Лишние атрибуты не интерполируются вовсе
+	static constexpr uint32_t featureTextured = 1 << 0;
+	static constexpr uint32_t featureAlphaTest = 1 << 1;
+	static constexpr uint32_t featureLit = 1 << 2;
+	static constexpr uint32_t featureShadowed = 1 << 3;
+	static constexpr uint32_t featureSingleLight = 1 << 4;
+	static constexpr uint32_t featureCombinations = 1 << 5;
+	// Общий вариант: все ветви собраны, а набор берётся из состояния вызова
+	static constexpr uint32_t featureGeneric = featureCombinations;
+
+	template<uint32_t Features>
+	[[nodiscard]] static constexpr bool hasFeature(uint32_t feature, uint32_t stateFeatures) {
+		if constexpr (Features == featureGeneric)
+			return (stateFeatures & feature) != 0;
+		else
+			return (Features & feature) != 0;
+	}
+
+	static constexpr int tileSize = 64;
+	static constexpr int blockSize = ZBuffer::blockSize;
+	static constexpr int vertexLanes = 8;
+	static_assert(tileSize % blockSize == 0);
+	// Отложенные вершины занимают память; при превышении кадр растеризуется по частям
+	static constexpr size_t maxBinnedVertices = size_t(1) << 21;
+
 	QImage image;
 	std::shared_ptr<ZBuffer> zBuffer;
 
@@ -70,7 +187,10 @@ private:
 	bool enableLighting;
 	Lighting::Material material;
 
-	const QImage* currentTexture;
+	bool alphaTest = false;
+	bool cullBackFaces = false;
+	bool genericPipeline = false;
+	glm::vec3 tint = glm::vec3(1.0f);
 
 	std::atomic<int> trianglesDrawn;
 	std::atomic<int> trianglesCulled;
@@ -82,19 +202,78 @@ private:
 	glm::mat4 lightMVP;
 	bool useShadows = false;
 
+	std::vector<DrawState> drawStates;
+	bool stateDirty = true;
+
+	std::vector<ScreenVertex> frameVertices;
+	// Параллельны frameVertices: однородные координаты и биты плоскостей отсечения, за которыми лежит вершина
+	std::vector<glm::vec4> frameClip;
+	std::vector<uint8_t> frameOutcodes;
+	std::vector<BinnedTriangle> frameTriangles;
+	int tilesX;
+	int tilesY;
+	// Индексы треугольников каждой плитки в порядке отправки
+	std::vector<std::vector<uint32_t>> tileBins;
+
+	ShadingMode shadingMode = ShadingMode::Visibility;
+	bool depthPrepass = false;
+
+	// Проход по треугольникам плитки: что проверять в z-буфере и что записывать
+	enum class TilePass {
+		Forward,
+		DepthOnly,
+		ShadeVisible,
+		Visibility
+	};
+	// Буфер видимости: номер треугольника кадра и веса его вершин 1 и 2 для каждого пикселя
+	static constexpr uint32_t noTriangle = ~0u;
+	std::vector<uint32_t> visibilityIds;
+	std::vector<glm::vec2> visibilityWeights;
+
+	// Пиксели изображения на время сброса; отделяются от общих копий QImage до запуска потоков
+	QRgb* framePixels = nullptr;
+	qsizetype frameStride = 0;
+
 	void clear();
-	[[nodiscard]] glm::vec3 sampleTexture(float u, float v) const;
-
-	[[nodiscard]] ScreenVertex transformVertex(const Vertex &v, const glm::mat4 &mvp) const;
-	void drawTriangle(const ScreenVertex &v0,
-	                  const ScreenVertex &v1,
-	                  const ScreenVertex &v2,
-	                  const glm::vec3 &cameraPos);
-	void fillTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2, const glm::vec3 &cameraPos);
-	void drawScanline(int y, const ScreenVertex &left, const ScreenVertex &right, const glm::vec3 &cameraPos);
-	[[nodiscard]] ScreenVertex interpolate(const ScreenVertex &v0, const ScreenVertex &v1, float t) const;
-	[[nodiscard]] QColor calculateColor(const ScreenVertex &pixel, const glm::vec3 &cameraPos) const;
-	[[nodiscard]] bool isOnScreen(const ScreenVertex &sv) const;
+	[[nodiscard]] static QRgb fetchTexel(const QImage &texture, float u, float v);
+	[[nodiscard]] static glm::vec3 sampleTexture(const QImage* texture, float u, float v);
+	[[nodiscard]] static bool passesAlphaTest(const glm::vec2 &texCoord, const DrawState &state);
+	// Доля света, дошедшего до точки: карта теней фильтруется по соседним 3x3 текселям
+	[[nodiscard]] static float shadowFactor(const glm::vec3 &worldPos, const DrawState &state);
+
+	uint32_t captureState(const QImage* texture, const glm::vec3 &cameraPos);
+	void makeRoom(size_t vertexCount);
+	[[nodiscard]] size_t appendVertices(size_t count);
+	void binTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t state);
+	// Треугольник, пересекающий ближнюю или дальнюю плоскость или запасную полосу вокруг экрана,
+	// обрезается в однородных координатах; получившийся многоугольник раскладывается веером
+	void clipTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t state);
+	void addTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t state);
+	void rasterizeTile(int tile);
+	int resolveTile(const TileRect &tile);
+	template<uint32_t Features>
+	[[nodiscard]] glm::vec3 resolvePixel(const BinnedTriangle &tri, const glm::vec2 &weights, const DrawState &state) const;
+
+	// Переводит в экран вершины кадра с уже заполненными worldPos, по восемь за раз в раздельных массивах
+	// координат, и записывает их однородные координаты и биты отсечения
+	void projectVertices(size_t first, qsizetype count, const glm::mat4 &mvp);
+	// Треугольник обходится блоками 8x8 пикселей: блок целиком отбрасывается или принимается
+	// по угловым значениям функций рёбер, строка блока считается восемью дорожками
+	// Блоки, где треугольник целиком дальше содержимого z-буфера, пропускаются без обхода пикселей
+	int fillTriangle(uint32_t triangle, const DrawState &state, const TileRect &tile, TilePass pass);
+	template<uint32_t Features>
+	int rasterizeBlock(const TriangleSetup &setup, int blockX, int blockY, bool covered,
+	                   const DrawState &state, const TileRect &tile, TilePass pass);
+	// Атрибуты в точке (x, y) относительно начала отсчёта градиентов; w — обратное к интерполированному 1/w
+	template<uint32_t Features>
+	[[nodiscard]] static ScreenVertex interpolate(const TriangleSetup &setup, float x, float y, float w,
+	                                              uint32_t stateFeatures);
+	template<uint32_t Features>
+	[[nodiscard]] static ScreenVertex blend(const ScreenVertex &v0, const ScreenVertex &v1, const ScreenVertex &v2,
+	                                        float w0, float w1, float w2, uint32_t stateFeatures);
+	// Цвет пикселя в долях канала; в ARGB32 с насыщением он переводится при записи строки
+	template<uint32_t Features>
+	[[nodiscard]] static glm::vec3 calculateColor(const ScreenVertex &pixel, const DrawState &state);
 
 };
 
@@ -4,6 +4,7 @@
 #include "mesh_object.h"
 #include "instanced_mesh_object.h"
 #include "plane_object.h"
+#include "forest_object.h"
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -49,12 +50,30 @@ void SceneRenderer::setShadowMapSize(const int size) {
 	shadowMapRenderer = std::make_unique<ShadowMapRenderer>(shadowMapSize, shadowMapSize);
 }
 
+void SceneRenderer::setShadingMode(Rasterizer::ShadingMode mode) {
+	shadingMode = mode;
+	rasterizer->setShadingMode(mode);
+}
+
+void SceneRenderer::setDepthPrepass(bool enabled) {
+	depthPrepass = enabled;
+	rasterizer->setDepthPrepass(enabled);
+}
+
+void SceneRenderer::setGenericPipeline(bool enabled) {
+	genericPipeline = enabled;
+	rasterizer->setGenericPipeline(enabled);
+}
+
 void SceneRenderer::setSunLight(const Light &light) {
 	sunLight = light;
 }
 
 void SceneRenderer::resize(int width, int height) {
 	rasterizer = std::make_unique<Rasterizer>(width, height);
+	rasterizer->setShadingMode(shadingMode);
+	rasterizer->setDepthPrepass(depthPrepass);
+	rasterizer->setGenericPipeline(genericPipeline);
 }
 
 int SceneRenderer::getWidth() const {
@@ -82,15 +101,23 @@ glm::vec3 SceneRenderer::computeSceneCenter(const Scene &scene) {
 				hasGeometry = true;
 			}
 		} else if (auto *instObj = dynamic_cast<InstancedMeshObject *>(obj.get())) {
-			const auto &proto = instObj->getPrototype();
+			const auto &prototypes = instObj->getPrototypes();
 			for (const auto &inst : instObj->getInstances()) {
-				for (const auto &v : proto.vertices) {
+				for (const auto &v : prototypes[inst.prototype].vertices) {
 					glm::vec3 worldPos = inst.position + v.position;
 					minBound = glm::min(minBound, worldPos);
 					maxBound = glm::max(maxBound, worldPos);
 					hasGeometry = true;
 				}
 			}
+		} else if (auto *forestObj = dynamic_cast<ForestObject *>(obj.get())) {
+			for (qsizetype i = 0; i < forestObj->getInstances().size(); i++) {
+				glm::vec3 center = forestObj->getInstanceCenter(i);
+				glm::vec3 reach(forestObj->getInstanceRadius(i));
+				minBound = glm::min(minBound, center - reach);
+				maxBound = glm::max(maxBound, center + reach);
+				hasGeometry = true;
+			}
 		} else if (auto *planeObj = dynamic_cast<PlaneObject *>(obj.get())) {
 			for (const auto &v : planeObj->getMesh().vertices) {
 				glm::vec3 worldPos = v.position + planeObj->getPosition();
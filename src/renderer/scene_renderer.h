@@ -16,10 +16,15 @@ public:
 
 	void setShadowsEnabled(bool enabled);
 	void setShadowMapSize(int size);
+	void setShadingMode(Rasterizer::ShadingMode mode);
+	void setDepthPrepass(bool enabled);
+	// Общий вариант конвейера пикселя вместо собранных под набор возможностей, для сравнения в бенчмарке
+	void setGenericPipeline(bool enabled);
 	void setSunLight(const Light& light);
 	void resize(int width, int height);
 
 	bool areShadowsEnabled() const { return shadowsEnabled; }
+	Rasterizer::ShadingMode getShadingMode() const { return shadingMode; }
 	Light getSunLight() const { return sunLight; }
 	int getWidth() const;
 	int getHeight() const;
@@ -32,6 +37,9 @@ private:
 
 	bool shadowsEnabled;
 	int shadowMapSize;
+	Rasterizer::ShadingMode shadingMode = Rasterizer::ShadingMode::Visibility;
+	bool depthPrepass = false;
+	bool genericPipeline = false;
 	Light sunLight;
 
 	void renderWithShadows(const Scene& scene, Camera& camera, const std::vector<Light>& sceneLights) const;
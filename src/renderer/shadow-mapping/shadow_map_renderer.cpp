@@ -2,6 +2,7 @@
 #include <QDebug>
 #include <algorithm>
 #include <cmath>
+#include "task_scheduler.h"
 
 ShadowMapRenderer::ShadowMapRenderer(int w, int h)
 	: width(w), height(h) {
@@ -12,9 +13,15 @@ ShadowMapRenderer::ShadowMapRenderer(int w, int h)
 void ShadowMapRenderer::beginFrame() {
 	zBuffer->clear();
 	std::ranges::fill(shadowMap, 1.0f);
+	pendingRuns.clear();
 }
 
 void ShadowMapRenderer::renderMesh(const Mesh &mesh, const glm::mat4 &mvp) {
+	if (mesh.triangles.size() >= parallelTriangleThreshold && TaskScheduler::instance().getConcurrency() > 1) {
+		renderMeshParallel(mesh, mvp);
+		return;
+	}
+
 	for (const auto &tri : mesh.triangles) {
 			const Vertex &v0 = mesh.vertices[tri.i0];
 			const Vertex &v1 = mesh.vertices[tri.i1];
@@ -51,11 +58,164 @@ void ShadowMapRenderer::renderMesh(const Mesh &mesh, const glm::mat4 &mvp) {
 		}
 }
 
+ShadowMapRenderer::ProjectedVertex ShadowMapRenderer::project(const glm::vec3 &position, const glm::mat4 &mvp) const {
+	glm::vec4 clip = mvp * glm::vec4(position, 1.0f);
+	if (clip.w <= 0)
+		return {glm::vec2(0.0f), 0.0f, false};
+
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+
+	return {
+		glm::vec2((ndc.x * 0.5f + 0.5f) * width, (1.0f - (ndc.y * 0.5f + 0.5f)) * height),
+		ndc.z * 0.5f + 0.5f,
+		true
+	};
+}
+
+void ShadowMapRenderer::renderMeshParallel(const Mesh &mesh, const glm::mat4 &mvp) {
+	projected.resize(mesh.vertices.size());
+	TaskScheduler::instance().parallelFor(0, mesh.vertices.size(), 1024, [&](qsizetype first, qsizetype last) {
+		for (qsizetype i = first; i < last; i++)
+			projected[i] = project(mesh.vertices[i].position, mvp);
+	});
+
+	rasterizeProjected(mesh.triangles.constData(), mesh.triangles.size());
+}
+
+void ShadowMapRenderer::renderInstanced(const QVector<Mesh> &prototypes,
+                                        const uint16_t *prototypeIndices,
+                                        const glm::mat4x3 *models,
+                                        qsizetype instanceCount,
+                                        const glm::mat4 &viewProj) {
+	if (instanceCount > 0)
+		pendingRuns.push_back({&prototypes, prototypeIndices, models, instanceCount, viewProj});
+}
+
+void ShadowMapRenderer::flush() {
+	if (pendingRuns.empty())
+		return;
+
+	// Смещения вершин и треугольников каждого экземпляра в общем потоке
+	struct InstanceRef {
+		const InstanceRun *run;
+		qsizetype index;
+		size_t firstVertex;
+		size_t firstTriangle;
+	};
+
+	std::vector<InstanceRef> refs;
+	size_t vertexCount = 0;
+	size_t triangleCount = 0;
+	for (const InstanceRun &run : pendingRuns) {
+		for (qsizetype i = 0; i < run.count; i++) {
+			const Mesh &proto = (*run.prototypes)[run.prototypeIndices[i]];
+			refs.push_back({&run, i, vertexCount, triangleCount});
+			vertexCount += proto.vertices.size();
+			triangleCount += proto.triangles.size();
+		}
+	}
+
+	projected.resize(vertexCount);
+	instanceTriangles.resize(triangleCount);
+
+	TaskScheduler::instance().parallelFor(0, refs.size(), 64, [&](qsizetype first, qsizetype last) {
+		for (qsizetype r = first; r < last; r++) {
+			const InstanceRef &ref = refs[r];
+			const Mesh &proto = (*ref.run->prototypes)[ref.run->prototypeIndices[ref.index]];
+			const glm::mat4 mvp = ref.run->viewProj * glm::mat4(ref.run->models[ref.index]);
+
+			for (qsizetype v = 0; v < proto.vertices.size(); v++)
+				projected[ref.firstVertex + v] = project(proto.vertices[v].position, mvp);
+
+			const uint32_t base = static_cast<uint32_t>(ref.firstVertex);
+			Triangle *out = instanceTriangles.data() + ref.firstTriangle;
+			for (qsizetype t = 0; t < proto.triangles.size(); t++) {
+				const Triangle &tri = proto.triangles[t];
+				out[t] = Triangle(base + tri.i0, base + tri.i1, base + tri.i2);
+			}
+		}
+	});
+
+	pendingRuns.clear();
+	rasterizeProjected(instanceTriangles.data(), instanceTriangles.size());
+}
+
+void ShadowMapRenderer::rasterizeProjected(const Triangle *triangles, qsizetype triangleCount) {
+	TaskScheduler &scheduler = TaskScheduler::instance();
+
+	const int bandCount = std::max(1, std::min(scheduler.getConcurrency() * 4, height / minBandHeight));
+	const int bandHeight = (height + bandCount - 1) / bandCount;
+
+	// Полосы треугольника считаются параллельно, раскладка по полосам — подсчётом за два прохода
+	triangleBands.resize(triangleCount);
+	scheduler.parallelFor(0, triangleCount, 4096, [&](qsizetype first, qsizetype last) {
+		for (qsizetype t = first; t < last; t++) {
+			const ProjectedVertex &p0 = projected[triangles[t].i0];
+			const ProjectedVertex &p1 = projected[triangles[t].i1];
+			const ProjectedVertex &p2 = projected[triangles[t].i2];
+			if (!p0.valid || !p1.valid || !p2.valid) {
+				triangleBands[t] = {1, 0};
+				continue;
+			}
+
+			// Те же границы строк, что и в fillTriangle
+			const int top = std::max(0, static_cast<int>(std::floor(std::min({p0.position.y, p1.position.y, p2.position.y}))));
+			const int bottom = std::min(height - 1, static_cast<int>(std::ceil(std::max({p0.position.y, p1.position.y, p2.position.y}))));
+			if (top > bottom)
+				triangleBands[t] = {1, 0};
+			else
+				triangleBands[t] = {top / bandHeight, bottom / bandHeight};
+		}
+	});
+
+	bandOffsets.assign(bandCount + 1, 0);
+	for (const BandSpan &span : triangleBands) {
+		for (int band = span.first; band <= span.last; band++)
+			bandOffsets[band + 1]++;
+	}
+	for (int band = 0; band < bandCount; band++)
+		bandOffsets[band + 1] += bandOffsets[band];
+
+	bandTriangles.resize(bandOffsets[bandCount]);
+	std::vector<uint32_t> fill(bandOffsets.begin(), bandOffsets.end() - 1);
+	for (qsizetype t = 0; t < triangleCount; t++) {
+		for (int band = triangleBands[t].first; band <= triangleBands[t].last; band++)
+			bandTriangles[fill[band]++] = static_cast<uint32_t>(t);
+	}
+
+	// Каждая полоса пишет только свои строки карты теней
+	scheduler.parallelFor(0, bandCount, 1, [&](qsizetype firstBand, qsizetype lastBand) {
+		for (qsizetype band = firstBand; band < lastBand; band++) {
+			const int minY = static_cast<int>(band) * bandHeight;
+			const int maxY = std::min(height, minY + bandHeight) - 1;
+
+			for (uint32_t k = bandOffsets[band]; k < bandOffsets[band + 1]; k++) {
+				const Triangle &tri = triangles[bandTriangles[k]];
+				const ProjectedVertex &p0 = projected[tri.i0];
+				const ProjectedVertex &p1 = projected[tri.i1];
+				const ProjectedVertex &p2 = projected[tri.i2];
+				fillTriangle(p0.position, p1.position, p2.position, p0.depth, p1.depth, p2.depth, minY, maxY);
+			}
+		}
+	});
+}
+
 void ShadowMapRenderer::fillTriangle(glm::vec2 v0, glm::vec2 v1, glm::vec2 v2, float z0, float z1, float z2) {
+	fillTriangle(v0, v1, v2, z0, z1, z2, 0, height - 1);
+}
+
+void ShadowMapRenderer::fillTriangle(glm::vec2 v0,
+                                     glm::vec2 v1,
+                                     glm::vec2 v2,
+                                     float z0,
+                                     float z1,
+                                     float z2,
+                                     int clipMinY,
+                                     int clipMaxY) {
 	int minX = std::max(0, (int)std::floor(std::min({v0.x, v1.x, v2.x})));
 	int maxX = std::min(width - 1, (int)std::ceil(std::max({v0.x, v1.x, v2.x})));
-	int minY = std::max(0, (int)std::floor(std::min({v0.y, v1.y, v2.y})));
-	int maxY = std::min(height - 1, (int)std::ceil(std::max({v0.y, v1.y, v2.y})));
+	int minY = std::max(clipMinY, (int)std::floor(std::min({v0.y, v1.y, v2.y})));
+	int maxY = std::min(clipMaxY, (int)std::ceil(std::max({v0.y, v1.y, v2.y})));
 
 	for (int y = minY; y <= maxY; ++y) {
 		for (int x = minX; x <= maxX; ++x) {
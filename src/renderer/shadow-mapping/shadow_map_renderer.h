@@ -3,6 +3,7 @@
 
 #include "z_buffer.h"
 #include "mesh.h"
+#include <QVector>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
@@ -13,6 +14,15 @@ public:
 	void beginFrame();
 	void renderMesh(const Mesh &mesh, const glm::mat4 &mvp);
 
+	// Экземпляры прототипов (листья) копятся до flush(): тогда вершины всех накопленных экземпляров
+	// проецируются в один поток и растеризуются полосами параллельно. Массивы должны жить до flush()
+	void renderInstanced(const QVector<Mesh> &prototypes,
+	                     const uint16_t *prototypeIndices,
+	                     const glm::mat4x3 *models,
+	                     qsizetype instanceCount,
+	                     const glm::mat4 &viewProj);
+	void flush();
+
 	[[nodiscard]] const float *getShadowMapData() const;
 	[[nodiscard]] int getWidth() const;
 	[[nodiscard]] int getHeight() const;
@@ -21,7 +31,43 @@ private:
 	std::shared_ptr<ZBuffer> zBuffer;
 	int width, height;
 
+	struct ProjectedVertex {
+		glm::vec2 position;
+		float depth;
+		bool valid;
+	};
+
+	static constexpr int parallelTriangleThreshold = 2048;
+	static constexpr int minBandHeight = 16;
+
+	struct InstanceRun {
+		const QVector<Mesh> *prototypes;
+		const uint16_t *prototypeIndices;
+		const glm::mat4x3 *models;
+		qsizetype count;
+		glm::mat4 viewProj;
+	};
+
+	// Первая и последняя полоса, которые задевает треугольник; first > last — треугольник пропускается
+	struct BandSpan {
+		int first;
+		int last;
+	};
+
+	std::vector<ProjectedVertex> projected;
+	std::vector<InstanceRun> pendingRuns;
+	std::vector<Triangle> instanceTriangles;
+	std::vector<BandSpan> triangleBands;
+	std::vector<uint32_t> bandOffsets;
+	std::vector<uint32_t> bandTriangles;
+
+	void renderMeshParallel(const Mesh &mesh, const glm::mat4 &mvp);
+	// Растеризует треугольники над уже заполненным projected: каждый треугольник один раз
+	// раскладывается по полосам строк, полосы заполняются параллельно
+	void rasterizeProjected(const Triangle *triangles, qsizetype triangleCount);
+	[[nodiscard]] ProjectedVertex project(const glm::vec3 &position, const glm::mat4 &mvp) const;
 	void fillTriangle(glm::vec2 v0, glm::vec2 v1, glm::vec2 v2, float z0, float z1, float z2);
+	void fillTriangle(glm::vec2 v0, glm::vec2 v1, glm::vec2 v2, float z0, float z1, float z2, int clipMinY, int clipMaxY);
 	[[nodiscard]] glm::vec2 interpolate(const glm::vec2 &v0, const glm::vec2 &v1, float t) const;
 	void drawScanline(int y, const glm::vec2 &left, const glm::vec2 &right, float z0, float z1, float z2);
 
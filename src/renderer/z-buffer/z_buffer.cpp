@@ -2,12 +2,31 @@
 #include <algorithm>
 #include <limits>
 
-ZBuffer::ZBuffer(int w, int h) : width(w), height(h) {
+ZBuffer::ZBuffer(int w, int h)
+	: width(w), height(h), blocksX((w + blockSize - 1) / blockSize), blocksY((h + blockSize - 1) / blockSize) {
 	buffer.resize(w * h, std::numeric_limits<float>::max());
+	blockDepth.resize(blocksX * blocksY, std::numeric_limits<float>::max());
 }
 
 void ZBuffer::clear() {
 	std::ranges::fill(buffer, std::numeric_limits<float>::max());
+	std::ranges::fill(blockDepth, std::numeric_limits<float>::max());
+}
+
+void ZBuffer::updateBlock(int blockX, int blockY) {
+	const int x0 = blockX * blockSize;
+	const int y0 = blockY * blockSize;
+	const int x1 = std::min(x0 + blockSize, width);
+	const int y1 = std::min(y0 + blockSize, height);
+
+	float farthest = 0.0f;
+	for (int y = y0; y < y1; y++) {
+		const float *line = buffer.data() + y * width;
+		for (int x = x0; x < x1; x++)
+			farthest = std::max(farthest, line[x]);
+	}
+
+	blockDepth[blockY * blocksX + blockX] = farthest;
 }
 
 bool ZBuffer::testAndSet(int x, int y, float depth) {
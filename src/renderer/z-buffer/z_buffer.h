@@ -1,10 +1,15 @@
 #ifndef ZBUFFER_H
 #define ZBUFFER_H
 
+#include <cstddef>
 #include <vector>
 
+// Буфер глубины с иерархическим уровнем: для каждого блока 8x8 хранится наибольшая глубина.
+// Треугольник, ближайшая точка которого не ближе этой глубины, в блоке заведомо не виден
 class ZBuffer {
 public:
+  static constexpr int blockSize = 8;
+
   ZBuffer(int w, int h);
 
   void clear();
@@ -15,10 +20,20 @@ public:
 
   float get(int x, int y) const;
 
+  // Строка без проверки границ для растеризатора, который сам обрезает треугольники по экрану
+  float *row(int y) { return buffer.data() + static_cast<std::size_t>(y) * width; }
+
+  // Оценка сверху для глубины блока; после записи через row() блок пересчитывается updateBlock
+  float blockMax(int blockX, int blockY) const { return blockDepth[blockY * blocksX + blockX]; }
+  void updateBlock(int blockX, int blockY);
+
 private:
   std::vector<float> buffer;
+  std::vector<float> blockDepth;
   int width;
   int height;
+  int blocksX;
+  int blocksY;
 };
 
 #endif // ZBUFFER_H
\ No newline at end of file
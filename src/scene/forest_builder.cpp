@@ -0,0 +1,114 @@
+#include "forest_builder.h"
+#include "tree_cache.h"
+#include <QHash>
+#include <chrono>
+
+ForestBuilder::ForestBuilder(TaskScheduler &scheduler)
+	: scheduler(scheduler) {
+}
+
+ForestBuilder::Workspace *ForestBuilder::acquireWorkspace() {
+	std::lock_guard<std::mutex> lock(workspaceMutex);
+	if (freeWorkspaces.empty()) {
+		workspaces.push_back(std::make_unique<Workspace>());
+		return workspaces.back().get();
+	}
+
+	Workspace *workspace = freeWorkspaces.back();
+	freeWorkspaces.pop_back();
+	return workspace;
+}
+
+void ForestBuilder::releaseWorkspace(Workspace *workspace) {
+	std::lock_guard<std::mutex> lock(workspaceMutex);
+	freeWorkspaces.push_back(workspace);
+}
+
+ForestBuilder::Result ForestBuilder::build(const QVector<ForestTreeSpec> &specs,
+                                           const QImage *barkTexture,
+                                           const QImage *leafTexture,
+                                           const Options &options) {
+	Result result;
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Деревья с одинаковым config становятся экземплярами одного вида.
+	// Кора общая для всего леса, поэтому в ключ она не входит
+	QHash<QByteArray, uint32_t> speciesByKey;
+	QVector<const TreeConfig *> speciesConfigs;
+	QVector<uint32_t> specSpecies(specs.size());
+	for (qsizetype i = 0; i < specs.size(); i++) {
+		const QByteArray key = TreeCache::keyFor(specs[i].config, QImage());
+		if (!speciesByKey.contains(key)) {
+			speciesByKey.insert(key, speciesConfigs.size());
+			speciesConfigs.append(&specs[i].config);
+		}
+		specSpecies[i] = speciesByKey.value(key);
+	}
+
+	std::vector<SpeciesGeometry> geometry(speciesConfigs.size());
+
+	// Рабочее место берётся на блок, а не на вид: блокировка не попадает во внутренний цикл
+	scheduler.parallelFor(0, speciesConfigs.size(), 1, [&](qsizetype begin, qsizetype end) {
+		Workspace *workspace = acquireWorkspace();
+		for (qsizetype i = begin; i < end; i++)
+			geometry[i] = buildSpecies(*speciesConfigs[i], barkTexture, leafTexture, options, *workspace);
+		releaseWorkspace(workspace);
+	});
+
+	result.forest = std::make_unique<ForestObject>();
+	for (SpeciesGeometry &species : geometry)
+		result.forest->addSpecies(std::move(species.trunk), std::move(species.leaves));
+
+	QVector<ForestObject::TreeInstance> instances(specs.size());
+	for (qsizetype i = 0; i < specs.size(); i++) {
+		const ForestTreeSpec &spec = specs[i];
+		ForestObject::TreeInstance &inst = instances[i];
+		inst.position = spec.position;
+		inst.rotation = glm::radians(spec.rotation);
+		inst.scale = spec.scale;
+		inst.tint = spec.tint;
+		inst.windPhase = spec.windPhase;
+		inst.species = specSpecies[i];
+
+		result.triangleCount += geometry[specSpecies[i]].triangleCount;
+		result.leafCount += geometry[specSpecies[i]].leafCount;
+	}
+	result.forest->setInstances(std::move(instances));
+	result.speciesCount = speciesConfigs.size();
+
+	auto end = std::chrono::steady_clock::now();
+	result.elapsedMs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+	if (result.elapsedMs > 0.0)
+		result.treesPerSecond = specs.size() * 1000.0 / result.elapsedMs;
+
+	return result;
+}
+
+ForestBuilder::SpeciesGeometry ForestBuilder::buildSpecies(const TreeConfig &config,
+                                                           const QImage *barkTexture,
+                                                           const QImage *leafTexture,
+                                                           const Options &options,
+                                                           Workspace &workspace) const {
+	GeneratedTree tree = TreeBuilder::build(config,
+	                                        barkTexture ? *barkTexture : QImage(),
+	                                        workspace.turtle,
+	                                        workspace.leafGenerator);
+
+	SpeciesGeometry result;
+	result.triangleCount = tree.trunk.triangles.size();
+	result.leafCount = tree.leaves.instances.size();
+
+	result.trunk = std::make_unique<MeshObject>(std::move(tree.trunk), barkTexture);
+	result.trunk->setBackFaceCulling(true);
+	if (options.buildLods)
+		result.trunk->buildLods();
+
+	result.leaves = std::make_unique<InstancedMeshObject>(std::move(tree.leaves.prototypes),
+	                                                      std::move(tree.leaves.instances),
+	                                                      leafTexture);
+	if (options.buildImpostors)
+		result.leaves->buildImpostors();
+
+	return result;
+}
@@ -0,0 +1,87 @@
+#ifndef FOREST_BUILDER_H
+#define FOREST_BUILDER_H
+
+#include "tree_builder.h"
+#include "forest_object.h"
+#include "task_scheduler.h"
+#include <QImage>
+#include <QVector>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Одно дерево леса: параметры L-системы (пресет, зерно в config.seed) и размещение в сцене.
+// Деревья с одинаковым config — экземпляры одного вида и строятся один раз
+struct ForestTreeSpec {
+	TreeConfig config;
+	glm::vec3 position = glm::vec3(0.0f);
+	// Поворот вокруг вертикальной оси, градусы
+	float rotation = 0.0f;
+	float scale = 1.0f;
+	glm::vec3 tint = glm::vec3(1.0f);
+	// Сдвиг фазы раскачивания дерева, радианы
+	float windPhase = 0.0f;
+};
+
+// Пакетная генерация деревьев на пуле потоков. Каждый поток берёт себе рабочее место
+// (интерпретатор и генератор листьев), которое сохраняется между заданиями и вызовами build
+class ForestBuilder {
+public:
+	struct Options {
+		bool buildLods = true;
+		bool buildImpostors = true;
+	};
+
+	struct Result {
+		std::unique_ptr<ForestObject> forest;
+		int speciesCount = 0;
+		double elapsedMs = 0.0;
+		double treesPerSecond = 0.0;
+		// Суммы по всем деревьям леса, а не по видам
+		qint64 triangleCount = 0;
+		qint64 leafCount = 0;
+	};
+
+	explicit ForestBuilder(TaskScheduler &scheduler = TaskScheduler::instance());
+
+	// Текстуры должны жить дольше созданных объектов
+	Result build(const QVector<ForestTreeSpec> &specs,
+	             const QImage *barkTexture,
+	             const QImage *leafTexture,
+	             const Options &options);
+
+	Result build(const QVector<ForestTreeSpec> &specs, const QImage *barkTexture, const QImage *leafTexture) {
+		return build(specs, barkTexture, leafTexture, Options());
+	}
+
+private:
+	struct Workspace {
+		TurtleInterpreter3D turtle;
+		LeafGenerator leafGenerator;
+	};
+
+	Workspace *acquireWorkspace();
+	void releaseWorkspace(Workspace *workspace);
+
+	// Геометрия вида в координатах дерева
+	struct SpeciesGeometry {
+		std::unique_ptr<MeshObject> trunk;
+		std::unique_ptr<InstancedMeshObject> leaves;
+		int triangleCount = 0;
+		int leafCount = 0;
+	};
+
+	SpeciesGeometry buildSpecies(const TreeConfig &config,
+	                             const QImage *barkTexture,
+	                             const QImage *leafTexture,
+	                             const Options &options,
+	                             Workspace &workspace) const;
+
+	TaskScheduler &scheduler;
+
+	std::mutex workspaceMutex;
+	std::vector<std::unique_ptr<Workspace> > workspaces;
+	std::vector<Workspace *> freeWorkspaces;
+};
+
+#endif // FOREST_BUILDER_H
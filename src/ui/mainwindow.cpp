@@ -5,6 +5,9 @@
 #include <QMouseEvent>
 #include <QHeaderView>
 #include <QMessageBox>
+#include <QFileDialog>
+#include <QRandomGenerator>
+#include <limits>
 #include <glm/gtx/quaternion.hpp>
 
 #include "free_camera.h"
@@ -12,7 +15,9 @@
 #include "instanced_mesh_object.h"
 #include "orbit_camera.h"
 #include "plane_object.h"
+#include "task_scheduler.h"
 #include "texture_loader.h"
+#include "tree_exporter.h"
 
 MainWindow::MainWindow(QWidget *parent)
 	: QMainWindow(parent)
@@ -121,6 +126,18 @@ void MainWindow::setupUi() {
 	ui->radial_segments_spin_box->setSingleStep(1);
 	ui->radial_segments_spin_box->setValue(5);
 
+	// 0 — без ограничения
+	ui->triangle_budget_spin_box->setRange(0, 10000000);
+	ui->triangle_budget_spin_box->setSingleStep(10000);
+	ui->triangle_budget_spin_box->setDecimals(0);
+	ui->triangle_budget_spin_box->setValue(0);
+
+	// Одно зерно — одно и то же дерево; кнопка «Новое зерно» выбирает случайное
+	ui->seed_spin_box->setRange(0, std::numeric_limits<uint32_t>::max());
+	ui->seed_spin_box->setSingleStep(1);
+	ui->seed_spin_box->setDecimals(0);
+	ui->seed_spin_box->setValue(QRandomGenerator::global()->generate());
+
 	ui->intensity_spin_box->setRange(0.0, 5.0);
 	ui->intensity_spin_box->setSingleStep(0.1);
 	ui->intensity_spin_box->setDecimals(2);
@@ -143,6 +160,9 @@ void MainWindow::setupUi() {
 
 	ui->enable_shadows_check_box->setChecked(true);
 
+	// Около 30 кадров в секунду, пока включён ветер
+	windTimer.setInterval(33);
+
 	ui->trees_combo_box->addItem("Дерево 1");
 	ui->trees_combo_box->addItem("Дерево 2");
 	ui->trees_combo_box->addItem("Дерево 3");
@@ -172,10 +192,14 @@ void MainWindow::connectSignals() {
 	connect(ui->orbit_camera_radio_btn, &QRadioButton::toggled, this, &MainWindow::onOrbitCameraToggled);
 	connect(ui->free_camera_radio_btn, &QRadioButton::toggled, this, &MainWindow::onFreeCameraToggled);
 	connect(ui->enable_shadows_check_box, &QCheckBox::toggled, this, &MainWindow::onShadowsToggled);
+	connect(ui->wind_check_box, &QCheckBox::toggled, this, &MainWindow::onWindToggled);
+	connect(&windTimer, &QTimer::timeout, this, &MainWindow::onWindFrame);
 	connect(ui->light_push_button, &QPushButton::clicked, this, &MainWindow::updateLight);
 
 	// Новые подключения
 	connect(ui->add_rule_btn, &QPushButton::clicked, this, &MainWindow::onAddRuleClicked);
+	connect(ui->export_btn, &QPushButton::clicked, this, &MainWindow::onExportTree);
+	connect(ui->new_seed_btn, &QPushButton::clicked, this, &MainWindow::onNewSeed);
 }
 
 void MainWindow::loadPreset(const QString &name) {
@@ -408,60 +432,68 @@ void MainWindow::loadPreset(const QString &name) {
 
 void MainWindow::buildAndRenderTree() {
 	try {
-		QString axiom = ui->axiome_edit->text();
-		int iterations = ui->iterations_spin_box->value();
-		float angle = ui->angle_spin_box->value();
-		float step = ui->step_spin_box->value();
-
-		float baseRadius = ui->base_radius_spin_box->value();
-		float radiusDecay = ui->radius_decay_spin_box->value();
-		float minLeafRadius = ui->min_leaf_radius_spin_box->value();
-		float gravityFactor = ui->gravity_factor_spin_box->value();
-		int radialSegments = ui->radial_segments_spin_box->value();
-
-		// Создание L-системы и добавление всех правил из таблицы
-		LSystemGenerator lsys;
-		lsys.setAxiom(axiom);
-
+		TreeConfig config;
+		config.axiom = ui->axiome_edit->text();
+		config.iterations = ui->iterations_spin_box->value();
+		config.angle = ui->angle_spin_box->value();
+		config.stepLength = ui->step_spin_box->value();
+
+		config.baseRadius = ui->base_radius_spin_box->value();
+		config.radiusDecay = ui->radius_decay_spin_box->value();
+		config.minLeafRadius = ui->min_leaf_radius_spin_box->value();
+		config.gravityFactor = ui->gravity_factor_spin_box->value();
+		config.radialSegments = ui->radial_segments_spin_box->value();
+		config.triangleBudget = static_cast<int>(ui->triangle_budget_spin_box->value());
+		config.seed = static_cast<uint32_t>(ui->seed_spin_box->value());
+
+		// Добавление всех правил из таблицы
 		for (int row = 0; row < rulesModel->rowCount(); ++row) {
 			QString symbol = rulesModel->item(row, 0)->text();
 			QString rule = rulesModel->item(row, 1)->text();
 
 			if (!symbol.isEmpty() && !rule.isEmpty()) {
-				lsys.addRule(symbol[0].toLatin1(), rule);
+				config.rules[symbol[0]] = rule;
 			}
 		}
 
-		lsys.setIterations(iterations);
-		QString commands = lsys.generate();
-
 		static QImage barkTex = TextureLoader::loadTexture("../textures/bark_2.jpg");
 		static QImage grassTex = TextureLoader::loadTexture("../textures/grass_2.jpg");
+		static QImage leafAtlas = LeafLibrary::buildAtlas();
 
-		TurtleInterpreter3D turtle;
-		turtle.setStepLength(step);
-		turtle.setAngle(angle);
-		turtle.setBaseRadius(baseRadius);
-		turtle.setRadiusDecay(radiusDecay);
-		turtle.setMinLeafRadius(minLeafRadius);
-		turtle.setGravityFactor(gravityFactor);
-		turtle.setRadialSegments(radialSegments);
-		turtle.setBarkTexture(barkTex);
-
-		auto treeData = turtle.interpretTree(commands);
+		GeneratedTree tree = treeCache.getOrBuild(config, barkTex);
 
-		LeafGenerator leafGen;
-		auto leafMeshData = leafGen.generate(treeData.leafPositions, treeData.leafNormals);
+		if (config.triangleBudget > 0) {
+			statusBar()->showMessage(QString("Сегментов: %1, разрешение сплайна: %2, отсечено ветвей: %3, треугольников: %4 из %5")
+				.arg(tree.detail.radialSegments)
+				.arg(tree.detail.splineResolution)
+				.arg(tree.detail.prunedBranches)
+				.arg(tree.detail.totalTriangles)
+				.arg(config.triangleBudget));
+		}
 
+		// Деформер ссылается на объекты старого дерева и удаляется раньше них
+		windDeformer.reset();
 		scene3D.clear();
 
-		scene3D.addObject(std::make_unique<MeshObject>(std::move(treeData.trunk), &barkTex));
+		auto trunkObject = std::make_unique<MeshObject>(std::move(tree.trunk), &barkTex);
+		trunkObject->setBackFaceCulling(true);
 
 		auto leafObject = std::make_unique<InstancedMeshObject>(
-			std::move(leafMeshData.prototype),
-			std::move(leafMeshData.instances)
+			std::move(tree.leaves.prototypes),
+			std::move(tree.leaves.instances),
+			&leafAtlas
 		);
 
+		// Уровни детализации ствола и импосторы листвы строятся одновременно
+		TaskGroup detailBuild;
+		detailBuild.run([&] { trunkObject->buildLods(); });
+		detailBuild.run([&] { leafObject->buildImpostors(); });
+		detailBuild.wait();
+
+		windDeformer = std::make_unique<WindDeformer>(std::move(tree.wind), *trunkObject, leafObject.get());
+
+		scene3D.addObject(std::move(trunkObject));
+
 		Lighting::Material leafMaterial;
 		leafMaterial.ambient = glm::vec3(0.3f);
 		leafMaterial.diffuse = glm::vec3(0.9f);
@@ -551,6 +583,11 @@ void MainWindow::onGenerateTree() {
 	buildAndRenderTree();
 }
 
+void MainWindow::onNewSeed() {
+	ui->seed_spin_box->setValue(QRandomGenerator::global()->generate());
+	buildAndRenderTree();
+}
+
 void MainWindow::onPresetChanged(const QString &name) {
 	loadPreset(name);
 	buildAndRenderTree();
@@ -577,6 +614,28 @@ void MainWindow::onShadowsToggled(bool checked) {
 	}
 }
 
+void MainWindow::onWindToggled(bool checked) {
+	if (checked) {
+		windClock.start();
+		windTimer.start();
+		return;
+	}
+
+	windTimer.stop();
+	if (windDeformer) {
+		windDeformer->reset();
+		render();
+	}
+}
+
+void MainWindow::onWindFrame() {
+	if (!windDeformer)
+		return;
+
+	windDeformer->apply(windClock.elapsed() / 1000.0f);
+	render();
+}
+
 void MainWindow::onAddRuleClicked() {
 	QString symbol = ui->symbols_combo_box->currentText();
 	QString rule = ui->rule_edit->text();
@@ -633,6 +692,39 @@ void MainWindow::onDeleteRule() {
 	}
 }
 
+void MainWindow::onExportTree() {
+	const MeshObject *trunk = nullptr;
+	const InstancedMeshObject *leaves = nullptr;
+
+	for (const auto &obj : scene3D.getObjects()) {
+		if (!trunk)
+			trunk = dynamic_cast<const MeshObject *>(obj.get());
+		if (!leaves)
+			leaves = dynamic_cast<const InstancedMeshObject *>(obj.get());
+	}
+
+	if (!trunk) {
+		QMessageBox::information(this, "Информация", "Сначала сгенерируйте дерево!");
+		return;
+	}
+
+	// Для просмотрщиков без EXT_mesh_gpu_instancing листья glTF можно запечь в один меш
+	const QString expandedGltfFilter = "glTF, листья одним мешем (*.gltf)";
+	QString selectedFilter;
+	QString path = QFileDialog::getSaveFileName(this, "Экспорт дерева", "tree.gltf",
+		"glTF (*.gltf);;" + expandedGltfFilter + ";;Wavefront OBJ (*.obj);;Stanford PLY (*.ply)",
+		&selectedFilter);
+	if (path.isEmpty())
+		return;
+
+	const auto leafMode = selectedFilter == expandedGltfFilter
+		? TreeExporter::LeafMode::Expanded
+		: TreeExporter::LeafMode::Instanced;
+
+	if (!TreeExporter::exportTree(path, trunk->getMesh(), leaves, leafMode))
+		QMessageBox::critical(this, "Ошибка", QString("Не удалось экспортировать дерево в %1").arg(path));
+}
+
 void MainWindow::keyPressEvent(QKeyEvent *event) {
 	Camera &cam = cameraManager.getActiveCamera();
 
@@ -3,6 +3,7 @@
 
 #include <QMainWindow>
 #include <QGraphicsScene>
+#include <QElapsedTimer>
 #include <QImage>
 #include <QTimer>
 #include <QStandardItemModel>
@@ -13,6 +14,8 @@
 #include "turtle_interpreter_3_d.h"
 #include "leaf_generator.h"
 #include "l_system_generator.h"
+#include "tree_cache.h"
+#include "wind_deformer.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -29,12 +32,16 @@ public:
 
 private slots:
 	void onGenerateTree();
+	void onNewSeed();
 	void onPresetChanged(const QString& name);
 	void onOrbitCameraToggled(bool checked);
 	void onFreeCameraToggled(bool checked);
 	void onShadowsToggled(bool checked);
+	void onWindToggled(bool checked);
+	void onWindFrame();
 	void onAddRuleClicked();
 	void onDeleteRule();
+	void onExportTree();
 
 private:
 	Ui::MainWindow *ui;
@@ -44,6 +51,12 @@ private:
 	std::unique_ptr<SceneRenderer> renderer;
 	Scene scene3D;
 	CameraManager cameraManager;
+	TreeCache treeCache;
+
+	// Деформирует ствол и листья текущего дерева; объекты принадлежат scene3D
+	std::unique_ptr<WindDeformer> windDeformer;
+	QTimer windTimer;
+	QElapsedTimer windClock;
 
 	bool isDragging = false;
 	QPoint lastMousePos;
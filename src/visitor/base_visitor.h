@@ -5,6 +5,7 @@ class PlaneObject;
 class SceneObject;
 class MeshObject;
 class InstancedMeshObject;
+class ForestObject;
 
 class BaseVisitor {
 public:
@@ -12,6 +13,7 @@ public:
 	virtual void visit(MeshObject& obj) = 0;
 	virtual void visit(InstancedMeshObject& obj) = 0;
 	virtual void visit(PlaneObject& obj) = 0;
+	virtual void visit(ForestObject& obj) = 0;
 };
 
 #endif // BASE_VISITOR_H
\ No newline at end of file
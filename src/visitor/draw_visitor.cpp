@@ -2,6 +2,7 @@
 #include "mesh_object.h"
 #include "instanced_mesh_object.h"
 #include "plane_object.h"
+#include "forest_object.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtc/quaternion.hpp>
@@ -14,38 +15,41 @@ DrawVisitor::DrawVisitor(Rasterizer& r, Camera& cam)
 
 void DrawVisitor::visit(MeshObject& obj) {
 	glm::mat4 model = glm::translate(glm::mat4(1.0f), obj.getPosition());
-	glm::mat4 mvp = camera.getProjectionMatrix(rasterizer.getWidth(), rasterizer.getHeight()) * camera.getViewMatrix() * model;
+	glm::mat4 viewProj = camera.getProjectionMatrix(rasterizer.getWidth(), rasterizer.getHeight()) * camera.getViewMatrix();
+	glm::mat4 mvp = viewProj * model;
 
-	rasterizer.renderMesh(obj.getMesh(), mvp, camera.getPosition(), obj.getTexture());
+	const Mesh &mesh = obj.selectLod(viewProj, rasterizer.getHeight());
+	rasterizer.setBackFaceCulling(obj.hasBackFaceCulling());
+	rasterizer.renderMesh(mesh, mvp, camera.getPosition(), obj.getTexture());
+	rasterizer.setBackFaceCulling(false);
 }
 
 void DrawVisitor::visit(InstancedMeshObject& obj) {
-	const auto& proto = obj.getPrototype();
-
-    for (const auto& inst : obj.getInstances()) {
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), inst.position);
-        model = model * glm::toMat4(inst.rotation);
-        model = glm::scale(model, inst.scale);
-
-        Mesh transformedMesh = proto;
-
-        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
-
-        for (auto& vertex : transformedMesh.vertices) {
-            glm::vec4 worldPos = model * glm::vec4(vertex.position, 1.0f);
-            vertex.position = glm::vec3(worldPos);
-
-            vertex.normal = glm::normalize(normalMatrix * vertex.normal);
-        }
-
-        glm::mat4 vp = camera.getProjectionMatrix(
-            rasterizer.getWidth(),
-            rasterizer.getHeight()
-        ) * camera.getViewMatrix();
-
-
-        rasterizer.renderMesh(transformedMesh, vp, camera.getPosition(), obj.getTexture());
-    }
+	glm::mat4 vp = camera.getProjectionMatrix(rasterizer.getWidth(), rasterizer.getHeight()) * camera.getViewMatrix();
+	const auto& prototypes = obj.getPrototypes();
+	const auto& prototypeIndices = obj.getPrototypeIndices();
+	const auto& models = obj.getModelMatrices();
+	const auto& normalMatrices = obj.getNormalMatrices();
+
+	obj.selectClusters(vp, Frustum(vp), camera.getPosition(), rasterizer.getHeight(), nearClusters, billboards);
+
+	for (int c : nearClusters) {
+		const auto& cluster = obj.getClusters()[c];
+		rasterizer.renderInstanced(prototypes,
+		                           prototypeIndices.constData() + cluster.first,
+		                           models.constData() + cluster.first,
+		                           normalMatrices.constData() + cluster.first,
+		                           cluster.count,
+		                           vp,
+		                           camera.getPosition(),
+		                           obj.getTexture());
+	}
+
+	if (!billboards.triangles.isEmpty()) {
+		rasterizer.setAlphaTest(true);
+		rasterizer.renderMesh(billboards, vp, camera.getPosition(), &obj.getImpostorAtlas());
+		rasterizer.setAlphaTest(false);
+	}
 }
 
 void DrawVisitor::visit(PlaneObject& obj) {
@@ -65,3 +69,87 @@ void DrawVisitor::visit(PlaneObject& obj) {
 		obj.getTexture()
 	);
 }
+
+void DrawVisitor::visit(ForestObject& obj) {
+	glm::mat4 vp = camera.getProjectionMatrix(rasterizer.getWidth(), rasterizer.getHeight()) * camera.getViewMatrix();
+	Frustum frustum(vp);
+
+	const auto& species = obj.getSpecies();
+	const auto& instances = obj.getInstances();
+	const auto& models = obj.getModelMatrices();
+	const auto& normalMatrices = obj.getNormalMatrices();
+
+	for (qsizetype i = 0; i < instances.size(); i++) {
+		if (!frustum.intersectsSphere(obj.getInstanceCenter(i), obj.getInstanceRadius(i)))
+			continue;
+
+		const auto& entry = species[instances[i].species];
+		rasterizer.setTint(instances[i].tint);
+
+		if (entry.trunk) {
+			const Mesh& mesh = entry.trunk->selectLod(vp * glm::mat4(models[i]), rasterizer.getHeight());
+			rasterizer.setBackFaceCulling(entry.trunk->hasBackFaceCulling());
+			rasterizer.renderInstanced(mesh,
+			                           models.constData() + i,
+			                           normalMatrices.constData() + i,
+			                           1,
+			                           vp,
+			                           camera.getPosition(),
+			                           entry.trunk->getTexture());
+			rasterizer.setBackFaceCulling(false);
+		}
+
+		if (entry.leaves)
+			drawForestLeaves(*entry.leaves, models[i], normalMatrices[i], vp);
+	}
+
+	rasterizer.setTint(glm::vec3(1.0f));
+}
+
+void DrawVisitor::drawForestLeaves(const InstancedMeshObject& leaves,
+                                   const glm::mat4x3& treeModel,
+                                   const glm::mat3& treeNormalMatrix,
+                                   const glm::mat4& viewProj) {
+	// Скопления выбираются в координатах дерева: матрица дерева входит в view-projection
+	glm::mat4 treeViewProj = viewProj * glm::mat4(treeModel);
+	glm::vec3 localCamera(glm::inverse(glm::mat4(treeModel)) * glm::vec4(camera.getPosition(), 1.0f));
+	leaves.selectClusters(treeViewProj, Frustum(treeViewProj), localCamera, rasterizer.getHeight(), nearClusters, billboards);
+
+	const auto& leafModels = leaves.getModelMatrices();
+	const auto& leafNormals = leaves.getNormalMatrices();
+
+	for (int c : nearClusters) {
+		const auto& cluster = leaves.getClusters()[c];
+		composedModels.resize(cluster.count);
+		composedNormals.resize(cluster.count);
+
+		for (qsizetype k = 0; k < cluster.count; k++) {
+			const glm::mat4x3& leaf = leafModels[cluster.first + k];
+			composedModels[k] = glm::mat4x3(treeModel * glm::vec4(leaf[0], 0.0f),
+			                                treeModel * glm::vec4(leaf[1], 0.0f),
+			                                treeModel * glm::vec4(leaf[2], 0.0f),
+			                                treeModel * glm::vec4(leaf[3], 1.0f));
+			composedNormals[k] = treeNormalMatrix * leafNormals[cluster.first + k];
+		}
+
+		rasterizer.renderInstanced(leaves.getPrototypes(),
+		                           leaves.getPrototypeIndices().constData() + cluster.first,
+		                           composedModels.constData(),
+		                           composedNormals.constData(),
+		                           cluster.count,
+		                           viewProj,
+		                           camera.getPosition(),
+		                           leaves.getTexture());
+	}
+
+	if (!billboards.triangles.isEmpty()) {
+		for (Vertex& v : billboards.vertices) {
+			v.position = treeModel * glm::vec4(v.position, 1.0f);
+			v.normal = glm::normalize(treeNormalMatrix * v.normal);
+		}
+
+		rasterizer.setAlphaTest(true);
+		rasterizer.renderMesh(billboards, viewProj, camera.getPosition(), &leaves.getImpostorAtlas());
+		rasterizer.setAlphaTest(false);
+	}
+}
@@ -12,9 +12,22 @@ public:
 	void visit(MeshObject& obj) override;
 	void visit(InstancedMeshObject& obj) override;
 	void visit(PlaneObject& obj) override;
+	void visit(ForestObject& obj) override;
 private:
 	Rasterizer& rasterizer;
 	Camera& camera;
+
+	QVector<int> nearClusters;
+	Mesh billboards;
+
+	// Матрицы листьев дерева леса, умноженные на матрицу самого дерева
+	QVector<glm::mat4x3> composedModels;
+	QVector<glm::mat3> composedNormals;
+
+	void drawForestLeaves(const InstancedMeshObject& leaves,
+	                      const glm::mat4x3& treeModel,
+	                      const glm::mat3& treeNormalMatrix,
+	                      const glm::mat4& viewProj);
 };
 
 
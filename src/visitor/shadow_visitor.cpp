@@ -2,9 +2,9 @@
 #include "mesh_object.h"
 #include "instanced_mesh_object.h"
 #include "plane_object.h"
+#include "forest_object.h"
 
 #include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtx/quaternion.hpp>
 
 ShadowVisitor::ShadowVisitor(ShadowMapRenderer& renderer, const glm::mat4& lightMVP)
 	: shadowRenderer(renderer), lightMVP(lightMVP) {
@@ -13,18 +13,51 @@ ShadowVisitor::ShadowVisitor(ShadowMapRenderer& renderer, const glm::mat4& light
 void ShadowVisitor::visit(MeshObject& obj) {
 	glm::mat4 model = glm::translate(glm::mat4(1.0f), obj.getPosition());
 	glm::mat4 mvp = lightMVP * model;
-	shadowRenderer.renderMesh(obj.getMesh(), mvp);
+	shadowRenderer.renderMesh(obj.selectLod(lightMVP, shadowRenderer.getHeight()), mvp);
 }
 
 void ShadowVisitor::visit(InstancedMeshObject& obj) {
-	const auto& prototype = obj.getPrototype();
-
-	for (const auto& instance : obj.getInstances()) {
-		glm::mat4 model = glm::translate(glm::mat4(1.0f), instance.position);
-		model = model * glm::toMat4(instance.rotation);
-		model = glm::scale(model, instance.scale);
-		glm::mat4 mvp = lightMVP * model;
-		shadowRenderer.renderMesh(prototype, mvp);
+	renderLeaves(obj, lightMVP);
+}
+
+void ShadowVisitor::renderLeaves(const InstancedMeshObject& obj, const glm::mat4& mvp) {
+	const auto& prototypes = obj.getPrototypes();
+	const auto& prototypeIndices = obj.getPrototypeIndices();
+	const auto& models = obj.getModelMatrices();
+	Frustum frustum(mvp);
+
+	for (const auto& cluster : obj.getClusters()) {
+		if (!frustum.intersectsBox(cluster.boundsMin, cluster.boundsMax))
+			continue;
+
+		shadowRenderer.renderInstanced(prototypes,
+		                               prototypeIndices.constData() + cluster.first,
+		                               models.constData() + cluster.first,
+		                               cluster.count,
+		                               mvp);
+	}
+
+	// Видимые скопления объекта растеризуются одним потоком треугольников
+	shadowRenderer.flush();
+}
+
+void ShadowVisitor::visit(ForestObject& obj) {
+	Frustum frustum(lightMVP);
+	const auto& species = obj.getSpecies();
+	const auto& instances = obj.getInstances();
+	const auto& models = obj.getModelMatrices();
+
+	for (qsizetype i = 0; i < instances.size(); i++) {
+		if (!frustum.intersectsSphere(obj.getInstanceCenter(i), obj.getInstanceRadius(i)))
+			continue;
+
+		const auto& entry = species[instances[i].species];
+		glm::mat4 treeMVP = lightMVP * glm::mat4(models[i]);
+
+		if (entry.trunk)
+			shadowRenderer.renderMesh(entry.trunk->selectLod(treeMVP, shadowRenderer.getHeight()), treeMVP);
+		if (entry.leaves)
+			renderLeaves(*entry.leaves, treeMVP);
 	}
 }
 
@@ -13,10 +13,14 @@ public:
 	void visit(MeshObject& obj) override;
 	void visit(InstancedMeshObject& obj) override;
 	void visit(PlaneObject& obj) override;
+	void visit(ForestObject& obj) override;
 
 private:
 	ShadowMapRenderer& shadowRenderer;
 	glm::mat4 lightMVP;
+
+	// mvp переводит координаты объекта листьев в пространство карты теней
+	void renderLeaves(const InstancedMeshObject& obj, const glm::mat4& mvp);
 };
 
 #endif //L_SYS_TREE_GENERATOR_SHADOW_VISITOR_H
\ No newline at end of file